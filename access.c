@@ -0,0 +1,119 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "util.h"
+#include "access.h"
+
+typedef char access_rec_size_check[sizeof(struct access_rec) == ACCESS_REC_SIZE ? 1 : -1];
+typedef char access_hdr_size_check[sizeof(struct access_hdr) == ACCESS_REC_SIZE ? 1 : -1];
+
+static uint64_t
+now_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* unmap and cut the file to what was written */
+static void
+segment_close(struct access_log *l)
+{
+	if (!l->map)
+		return;
+	munmap(l->map, l->segsize);
+	if (ftruncate(l->fd, l->off) < 0)
+		wrlog(L_WARNING, "Access log truncate error: %s", strerror(errno));
+	close(l->fd);
+	l->map = NULL;
+	l->fd = -1;
+}
+
+static int
+segment_open(struct access_log *l)
+{
+	struct access_hdr *h;
+	char path[4096];
+	uint64_t now = now_us();
+
+	snprintf(path, sizeof(path), "%s/access-w%d-%llu-%u.bin", l->dir, l->worker,
+		(unsigned long long)(now / 1000000), l->seq++);
+	l->fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	if (l->fd < 0) {
+		wrlog(L_ERROR, "Can't create access log %s: %s", path, strerror(errno));
+		return -1;
+	}
+	if (ftruncate(l->fd, l->segsize) < 0 ||
+	    (l->map = mmap(NULL, l->segsize, PROT_READ | PROT_WRITE, MAP_SHARED,
+			l->fd, 0)) == MAP_FAILED) {
+		wrlog(L_ERROR, "Can't map access log %s: %s", path, strerror(errno));
+		l->map = NULL;
+		close(l->fd);
+		unlink(path);
+		l->fd = -1;
+		return -1;
+	}
+
+	h = (struct access_hdr *)l->map;
+	memcpy(h->magic, ACCESS_MAGIC, sizeof(h->magic));
+	h->recsize = ACCESS_REC_SIZE;
+	h->worker = l->worker;
+	h->created_us = now;
+	l->off = sizeof(*h);
+	l->segments++;
+	return 0;
+}
+
+int
+access_open(struct access_log *l, const char *dir, int worker, size_t segsize)
+{
+	memset(l, 0, sizeof(*l));
+	l->fd = -1;
+	if (!dir)
+		return 0;
+	if (!(l->dir = strdup(dir)))
+		return -1;
+	l->worker = worker;
+	/* whole records only */
+	l->segsize = segsize / ACCESS_REC_SIZE * ACCESS_REC_SIZE;
+	if (l->segsize < 2 * ACCESS_REC_SIZE)
+		l->segsize = 2 * ACCESS_REC_SIZE;
+	if (segment_open(l) < 0) {
+		free(l->dir);
+		l->dir = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+void
+access_close(struct access_log *l)
+{
+	segment_close(l);
+	free(l->dir);
+	l->dir = NULL;
+}
+
+void
+access_write(struct access_log *l, const struct access_rec *r)
+{
+	if (!l->dir)
+		return;
+	if (l->map && l->off == l->segsize)
+		segment_close(l);
+	/* retried on every record until the disk is back */
+	if (!l->map && segment_open(l) < 0) {
+		l->errors++;
+		return;
+	}
+	memcpy(l->map + l->off, r, sizeof(*r));
+	l->off += sizeof(*r);
+	l->records++;
+}
@@ -0,0 +1,86 @@
+#ifndef ACCESS_H
+#define ACCESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ACCESS_MAGIC		"SFPACC1"
+#define ACCESS_REC_SIZE		256
+#define ACCESS_HOST		64
+#define ACCESS_TARGET		(ACCESS_REC_SIZE - ACCESS_HOST - 40)
+#define ACCESS_SEGMENT_SIZE	64		/* default, MB */
+
+/* what happened to the connection, last request decides */
+enum {
+	ACC_NONE = 0,		/* closed before a request */
+	ACC_OK,
+	ACC_DENIED,		/* client ACL */
+	ACC_BADREQ,
+	ACC_BLOCK_HOST,
+	ACC_BLOCK_URL,
+	ACC_BLOCK_REGEX,
+	ACC_NOTIMPL,
+	ACC_NORESP,		/* no response head from the server */
+	ACC_UNAVAIL,		/* out of buffers */
+	ACC_STATS,
+	ACC_TIMEOUT,
+	ACC_BLOCK_SNI,		/* CONNECT, TLS server name */
+	ACC_HIT,		/* answered from the cache */
+	ACC_VERDICTS
+};
+
+/* one per connection, fixed size so a segment is an array of them;
+ * integers are host order, the file is read on the same host */
+struct access_rec {
+	uint64_t	start_us;	/* accept time, microseconds since the epoch */
+	uint64_t	duration_us;
+	uint64_t	bytes;		/* relayed both ways */
+	uint32_t	cliaddr;	/* network order */
+	uint16_t	srvport;
+	uint16_t	requests;	/* on this client connection */
+	uint16_t	errors;
+	uint8_t		verdict;
+	uint8_t		pad[5];
+	char		host[ACCESS_HOST];	/* nul terminated, cut if longer */
+	char		target[ACCESS_TARGET];
+};
+
+/* first record slot of every segment */
+struct access_hdr {
+	char		magic[8];
+	uint32_t	recsize;
+	uint32_t	worker;
+	uint64_t	created_us;
+	char		pad[ACCESS_REC_SIZE - 24];
+};
+
+/* segments of one worker: <dir>/access-w<worker>-<time>-<seq>.bin,
+ * each mapped and filled up to its size, then truncated to the records
+ * written; an all-zero record ends a segment which is still open */
+struct access_log {
+	char		*dir;
+	int		worker;
+	size_t		segsize;
+	int		fd;
+	char		*map;
+	size_t		off;
+	unsigned	seq;
+	unsigned long	records;
+	unsigned long	segments;
+	unsigned long	errors;		/* records lost to failed rotations */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* dir NULL keeps the log off */
+int access_open(struct access_log *l, const char *dir, int worker, size_t segsize);
+void access_close(struct access_log *l);
+void access_write(struct access_log *l, const struct access_rec *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ACCESS_H */
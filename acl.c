@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "acl.h"
+
+#define ACL_DIRECT_SIZE	(1u << ACL_DIRECT_BITS)
+
+struct acl_bnode {
+	struct acl_bnode *child[2];
+	int		value;
+};
+
+/* binary trie cut at some depth: subtree going on below it, if any, and
+ * the verdict of the longest prefix above */
+struct slot {
+	struct acl_bnode *n;
+	int		inh;
+};
+
+int
+acl_init(struct acl *a)
+{
+	memset(a, 0, sizeof(*a));
+	a->deflt = ACL_ALLOW;
+	return 0;
+}
+
+static void
+bnode_free(struct acl_bnode *n)
+{
+	if (!n)
+		return;
+	bnode_free(n->child[0]);
+	bnode_free(n->child[1]);
+	free(n);
+}
+
+void
+acl_free(struct acl *a)
+{
+	bnode_free(a->root);
+	free(a->direct);
+	free(a->nodes);
+	free(a->leaves);
+	memset(a, 0, sizeof(*a));
+}
+
+int
+acl_add(struct acl *a, const char *cidr, int verdict)
+{
+	char buf[INET_ADDRSTRLEN];
+	const char *slash = strchr(cidr, '/');
+	struct acl_bnode **n = &a->root;
+	struct in_addr in;
+	uint32_t ip;
+	int len = 32, i;
+	char *end;
+
+	if (slash) {
+		if ((size_t)(slash - cidr) >= sizeof(buf))
+			return -1;
+		memcpy(buf, cidr, slash - cidr);
+		buf[slash - cidr] = 0;
+		len = strtol(slash + 1, &end, 10);
+		if (end == slash + 1 || *end || len < 0 || len > 32)
+			return -1;
+	}
+	else if (strlen(cidr) < sizeof(buf))
+		strcpy(buf, cidr);
+	else
+		return -1;
+	if (inet_pton(AF_INET, buf, &in) != 1)
+		return -1;
+
+	ip = ntohl(in.s_addr);
+	for (i = 0; ; i++) {
+		if (!*n && !(*n = calloc(1, sizeof(**n))))
+			return -1;
+		if (i == len)
+			break;
+		n = &(*n)->child[(ip >> (31 - i)) & 1];
+	}
+	/* the later of two same prefixes wins */
+	(*n)->value = verdict;
+	a->rules++;
+	return 0;
+}
+
+/* cut the trie 'levels' bits below n into out[i << levels...] */
+static void
+expand(struct acl_bnode *n, int inh, int levels, struct slot *out, size_t i)
+{
+	size_t k;
+
+	if (n && n->value != ACL_NONE)
+		inh = n->value;
+	if (levels == 0) {
+		out[i].n = n && (n->child[0] || n->child[1]) ? n : NULL;
+		out[i].inh = inh;
+		return;
+	}
+	if (!n) {
+		for (k = i << levels; k < (i + 1) << levels; k++) {
+			out[k].n = NULL;
+			out[k].inh = inh;
+		}
+		return;
+	}
+	expand(n->child[0], inh, levels - 1, out, i * 2);
+	expand(n->child[1], inh, levels - 1, out, i * 2 + 1);
+}
+
+static int
+grow(void **p, size_t *cap, size_t need, size_t elsize)
+{
+	size_t n = *cap ? *cap : 256;
+	void *np;
+
+	if (need <= *cap)
+		return 0;
+	while (n < need)
+		n *= 2;
+	if (!(np = realloc(*p, n * elsize)))
+		return -1;
+	*p = np;
+	*cap = n;
+	return 0;
+}
+
+/* fill node idx from the subtree, child nodes of one node are allocated
+ * together so they are found from base1 */
+static int
+build_node(struct acl *a, struct acl_bnode *bn, int inh, uint32_t idx)
+{
+	struct slot s[1 << ACL_STRIDE];
+	uint64_t vector = 0, leafvec = 0;
+	uint32_t base0 = a->nleaves, base1, k;
+	int i, nkids = 0, prev = -1;
+
+	expand(bn, inh, ACL_STRIDE, s, 0);
+	for (i = 0; i < (1 << ACL_STRIDE); i++) {
+		if (s[i].n) {
+			vector |= 1ULL << i;
+			nkids++;
+			prev = -1;
+			continue;
+		}
+		/* a run of equal leaves is stored once */
+		if (s[i].inh != prev) {
+			if (grow((void **)&a->leaves, &a->leafsize, a->nleaves + 1, 1) < 0)
+				return -1;
+			a->leaves[a->nleaves++] = s[i].inh;
+			leafvec |= 1ULL << i;
+		}
+		prev = s[i].inh;
+	}
+
+	base1 = a->nnodes;
+	if (grow((void **)&a->nodes, &a->nodesize, a->nnodes + nkids, sizeof(*a->nodes)) < 0)
+		return -1;
+	a->nnodes += nkids;
+	a->nodes[idx].vector = vector;
+	a->nodes[idx].leafvec = leafvec;
+	a->nodes[idx].base0 = base0;
+	a->nodes[idx].base1 = base1;
+
+	for (i = 0, k = base1; i < (1 << ACL_STRIDE); i++)
+		if (s[i].n && build_node(a, s[i].n, s[i].inh, k++) < 0)
+			return -1;
+	return 0;
+}
+
+int
+acl_compile(struct acl *a)
+{
+	struct slot *s;
+	uint32_t i;
+	int rc = 0;
+
+	if (!a->rules)
+		return 0;
+	s = malloc(ACL_DIRECT_SIZE * sizeof(*s));
+	a->direct = malloc(ACL_DIRECT_SIZE * sizeof(*a->direct));
+	if (!s || !a->direct) {
+		free(s);
+		return -1;
+	}
+
+	expand(a->root, ACL_NONE, ACL_DIRECT_BITS, s, 0);
+	for (i = 0; rc == 0 && i < ACL_DIRECT_SIZE; i++) {
+		if (!s[i].n) {
+			a->direct[i] = ACL_LEAF | s[i].inh;
+			continue;
+		}
+		if (grow((void **)&a->nodes, &a->nodesize, a->nnodes + 1, sizeof(*a->nodes)) < 0) {
+			rc = -1;
+			break;
+		}
+		a->direct[i] = a->nnodes++;
+		rc = build_node(a, s[i].n, s[i].inh, a->direct[i]);
+	}
+	free(s);
+	bnode_free(a->root);
+	a->root = NULL;
+	return rc;
+}
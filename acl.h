@@ -0,0 +1,85 @@
+#ifndef ACL_H
+#define ACL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <arpa/inet.h>
+
+/* verdicts, also leaf values */
+#define ACL_NONE	0	/* no rule covers the address */
+#define ACL_ALLOW	1
+#define ACL_DENY	2
+
+#define ACL_DIRECT_BITS	16
+#define ACL_STRIDE	6
+#define ACL_LEAF	0x80000000u	/* direct entry holds a verdict */
+
+/* poptrie node: 64 children by the next 6 address bits, the ones which
+ * are subtrees are marked in vector, the rest are leaves compressed into
+ * runs marked in leafvec; both are found by popcount of the lower bits */
+struct acl_node {
+	uint64_t	vector;
+	uint64_t	leafvec;
+	uint32_t	base0;		/* first leaf */
+	uint32_t	base1;		/* first child node */
+};
+
+struct acl_bnode;
+
+/* longest prefix match over IPv4 CIDR rules; the first 16 bits index a
+ * direct table, then 6 bits per level */
+struct acl {
+	uint32_t	*direct;
+	struct acl_node	*nodes;
+	size_t		nnodes, nodesize;
+	uint8_t		*leaves;
+	size_t		nleaves, leafsize;
+	int		deflt;		/* verdict for ACL_NONE */
+	size_t		rules;
+
+	struct acl_bnode *root;		/* build time binary trie */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int acl_init(struct acl *a);
+void acl_free(struct acl *a);
+
+/* "a.b.c.d[/len]", returns -1 on a bad prefix */
+int acl_add(struct acl *a, const char *cidr, int verdict);
+int acl_compile(struct acl *a);
+
+/* ACL_ALLOW or ACL_DENY for an address in network byte order */
+static inline int
+acl_check(const struct acl *a, in_addr_t addr)
+{
+	uint32_t ip = ntohl(addr), e, idx;
+	uint64_t key = (uint64_t)ip << 2;	/* 34 bits, levels end evenly */
+	int off, v;
+
+	if (!a->direct)
+		return a->deflt;
+	e = a->direct[ip >> (32 - ACL_DIRECT_BITS)];
+	if (e & ACL_LEAF)
+		v = e & 0xff;
+	else for (idx = e, off = ACL_DIRECT_BITS; ; off += ACL_STRIDE) {
+		const struct acl_node *n = &a->nodes[idx];
+		unsigned c = (key >> (34 - off - ACL_STRIDE)) & 63;
+		uint64_t m = (2ULL << c) - 1;
+
+		if (!(n->vector & (1ULL << c))) {
+			v = a->leaves[n->base0 + __builtin_popcountll(n->leafvec & m) - 1];
+			break;
+		}
+		idx = n->base1 + __builtin_popcountll(n->vector & m) - 1;
+	}
+	return v == ACL_NONE ? a->deflt : v;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ACL_H */
@@ -0,0 +1,94 @@
+#!/bin/sh
+# resolver checks against a stub DNS server on loopback, see bench/dnsstub.c
+#
+#	make dnstest
+#
+# one worker, so there is one resolver cache; what the cache kept is
+# read off the queries that reached the stub
+
+cd "$(dirname "$0")/.." || exit 1
+
+ORIGIN_PORT=${BENCH_ORIGIN_PORT:-18080}
+PROXY_PORT=${BENCH_PROXY_PORT:-18081}
+DNS_PORT=${BENCH_DNS_PORT:-18053}
+OUT=${BENCH_OUT:-$(mktemp -d /tmp/sfp-dns.XXXXXX)}
+FAILED=0
+
+mkdir -p "$OUT"
+
+cleanup() {
+	[ -n "$SFP_PID" ] && kill "$SFP_PID" 2>/dev/null
+	[ -n "$DNS_PID" ] && kill "$DNS_PID" 2>/dev/null
+	[ -n "$ORIGIN_PID" ] && kill "$ORIGIN_PID" 2>/dev/null
+	wait 2>/dev/null
+}
+trap cleanup EXIT INT TERM
+
+# wait for a line in a log
+wait_log() {
+	i=0
+	while ! grep -q "$2" "$1"; do
+		i=$((i + 1))
+		if [ $i -gt 50 ]; then
+			echo "no '$2' in $1" >&2
+			exit 1
+		fi
+		sleep 0.1
+	done
+}
+
+# status code of a request for a host through the proxy
+get() {
+	curl -s -o /dev/null -w '%{http_code}' -m 5 -x "127.0.0.1:$PROXY_PORT" \
+		"http://$1:$ORIGIN_PORT/16"
+}
+
+# queries for a name that reached the stub
+queries() {
+	grep -cx "$1" "$OUT/dnsstub.log"
+}
+
+# check what expected got
+check() {
+	if [ "$2" = "$3" ]; then
+		printf "%-40s ok\n" "$1"
+	else
+		printf "%-40s FAIL: %s, not %s\n" "$1" "$3" "$2"
+		FAILED=1
+	fi
+}
+
+bench/origin -p "$ORIGIN_PORT" 2>"$OUT/origin.log" &
+ORIGIN_PID=$!
+bench/dnsstub -p "$DNS_PORT" >"$OUT/dnsstub.log" 2>&1 &
+DNS_PID=$!
+./sfp -f -w 1 -p "$PROXY_PORT" -d "127.0.0.1:$DNS_PORT" 2>"$OUT/sfp.log" &
+SFP_PID=$!
+wait_log "$OUT/sfp.log" "Started"
+
+# DNS_MIN_TTL is 5, shorter ttls are kept that long anyway
+check "answer" "200 200" "$(get ttl5.test) $(get ttl5.test)"
+check "answer is cached" 1 "$(queries ttl5.test)"
+check "NXDOMAIN" "502 502" "$(get nx-ttl5.test) $(get nx-ttl5.test)"
+check "NXDOMAIN is cached" 1 "$(queries nx-ttl5.test)"
+check "truncated answer fails" "502 502" "$(get tc.test) $(get tc.test)"
+check "truncated answer is not cached" 2 "$(queries tc.test)"
+
+pids=
+for i in 1 2 3 4 5 6 7 8 9 10; do
+	get delay300-ttl60.test >"$OUT/coalesced.$i" &
+	pids="$pids $!"
+done
+wait $pids
+check "lookups in flight are answered" 10 \
+	"$(cat "$OUT"/coalesced.* | grep -o 200 | grep -c .)"
+check "lookups in flight share a query" 1 "$(queries delay300-ttl60.test)"
+
+sleep 6
+get ttl5.test >/dev/null
+check "answer expires with its ttl" 2 "$(queries ttl5.test)"
+get nx-ttl5.test >/dev/null
+check "NXDOMAIN expires with the SOA ttl" 2 "$(queries nx-ttl5.test)"
+
+[ $FAILED = 0 ] || echo "logs in $OUT"
+exit $FAILED
@@ -0,0 +1,269 @@
+/* stub DNS server for testing the resolver: the first label of a name
+ * says how to answer it, as dash separated words
+ *
+ *	ttl<sec>	A record with this ttl [default = 60]
+ *	nx		NXDOMAIN, with a SOA of the same ttl
+ *	tc		truncated, no records
+ *	delay<ms>	answer this much later
+ *
+ * e.g. "delay300-ttl5.test"; every query is printed to stdout, one name
+ * per line, so a test can count what reached the server */
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <ev.h>
+
+#define PKT_SIZE	512
+#define HDR_SIZE	12
+#define NAME_MAX_LEN	253
+
+#define FLAG_QR		0x8000
+#define FLAG_AA		0x0400
+#define FLAG_TC		0x0200
+#define FLAG_RD		0x0100
+#define FLAG_RA		0x0080
+#define RCODE_NXDOMAIN	3
+
+#define TYPE_A		1
+#define TYPE_SOA	6
+#define CLASS_IN	1
+
+/* an answer waiting for its delay */
+struct later {
+	ev_timer		timer;
+	struct sockaddr_in	peer;
+	size_t			len;
+	unsigned char		pkt[PKT_SIZE];
+};
+
+static int sock;
+static struct in_addr answer_addr;
+static unsigned long queries;
+
+static void
+put16(unsigned char *p, unsigned v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static void
+put32(unsigned char *p, unsigned long v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/* question name as text, offset past it or -1; no compression in queries */
+static int
+read_qname(const unsigned char *pkt, size_t len, char *name)
+{
+	size_t off = HDR_SIZE, n = 0;
+
+	while (off < len && pkt[off]) {
+		unsigned l = pkt[off++];
+
+		if (l > 63 || off + l > len || n + l + 1 > NAME_MAX_LEN)
+			return -1;
+		if (n)
+			name[n++] = '.';
+		memcpy(name + n, pkt + off, l);
+		n += l;
+		off += l;
+	}
+	if (off >= len)
+		return -1;
+	name[n] = 0;
+	return off + 1;
+}
+
+/* the answer to the query in pkt, built in place; its length or -1 */
+static int
+make_answer(unsigned char *pkt, size_t len, double *delay)
+{
+	char name[NAME_MAX_LEN + 1], *w, *end;
+	unsigned long ttl = 60;
+	int off, nx = 0, tc = 0;
+	unsigned flags;
+
+	if (len < HDR_SIZE || (pkt[2] & 0x80) || pkt[4] || pkt[5] != 1)
+		return -1;
+	if ((off = read_qname(pkt, len, name)) < 0 || off + 4 > (int)len)
+		return -1;
+	off += 4;
+
+	printf("%s\n", name);
+	fflush(stdout);
+	queries++;
+
+	*delay = 0;
+	if ((end = strchr(name, '.')))
+		*end = 0;
+	for (w = strtok(name, "-"); w; w = strtok(NULL, "-")) {
+		if (!strncmp(w, "ttl", 3))
+			ttl = strtoul(w + 3, NULL, 10);
+		else if (!strcmp(w, "nx"))
+			nx = 1;
+		else if (!strcmp(w, "tc"))
+			tc = 1;
+		else if (!strncmp(w, "delay", 5))
+			*delay = atoi(w + 5) / 1e3;
+	}
+
+	flags = FLAG_QR | FLAG_AA | FLAG_RA | (((pkt[2] << 8) | pkt[3]) & FLAG_RD);
+	if (tc)
+		flags |= FLAG_TC;
+	else if (nx)
+		flags |= RCODE_NXDOMAIN;
+	put16(pkt + 2, flags);
+	put16(pkt + 6, !tc && !nx);	/* answers */
+	put16(pkt + 8, !tc && nx);	/* authority */
+	put16(pkt + 10, 0);		/* additional */
+	if (tc)
+		return off;
+
+	/* the record owner points back at the question name */
+	put16(pkt + off, 0xc000 | HDR_SIZE);
+	if (!nx) {
+		put16(pkt + off + 2, TYPE_A);
+		put16(pkt + off + 4, CLASS_IN);
+		put32(pkt + off + 6, ttl);
+		put16(pkt + off + 10, 4);
+		memcpy(pkt + off + 12, &answer_addr, 4);
+		return off + 16;
+	}
+	/* root names for mname and rname, then serial, refresh, retry,
+	 * expire and minimum */
+	put16(pkt + off + 2, TYPE_SOA);
+	put16(pkt + off + 4, CLASS_IN);
+	put32(pkt + off + 6, ttl);
+	put16(pkt + off + 10, 22);
+	memset(pkt + off + 12, 0, 22);
+	put32(pkt + off + 14, 1);
+	put32(pkt + off + 30, ttl);
+	return off + 34;
+}
+
+static void
+later_send(EV_P_ ev_timer *w, int revents)
+{
+	struct later *l = (struct later *)w;
+
+	sendto(sock, l->pkt, l->len, 0, (struct sockaddr *)&l->peer, sizeof(l->peer));
+	free(l);
+}
+
+static void
+sock_read(EV_P_ ev_io *w, int revents)
+{
+	unsigned char pkt[PKT_SIZE];
+	struct sockaddr_in peer;
+	socklen_t plen;
+	struct later *l;
+	double delay;
+	ssize_t n;
+	int len;
+
+	for (;;) {
+		plen = sizeof(peer);
+		n = recvfrom(w->fd, pkt, sizeof(pkt), 0, (struct sockaddr *)&peer, &plen);
+		if (n < 0)
+			return;
+		/* room for the longest answer past the question */
+		if (n > PKT_SIZE - 34 || (len = make_answer(pkt, n, &delay)) < 0)
+			continue;
+		if (delay <= 0) {
+			sendto(w->fd, pkt, len, 0, (struct sockaddr *)&peer, plen);
+			continue;
+		}
+		if (!(l = malloc(sizeof(*l))))
+			continue;
+		l->peer = peer;
+		l->len = len;
+		memcpy(l->pkt, pkt, len);
+		ev_timer_init(&l->timer, later_send, delay, 0);
+		ev_timer_start(EV_A_ &l->timer);
+	}
+}
+
+static void
+sig_stop(EV_P_ ev_signal *w, int revents)
+{
+	ev_break(EV_A_ EVBREAK_ALL);
+}
+
+static void
+usage(const char *app)
+{
+	fprintf(stderr, "usage: %s [-b addr] [-p port] [-a addr]\n"
+		"\t-b : address to listen on [default = 127.0.0.1]\n"
+		"\t-p : port [default = 18053]\n"
+		"\t-a : address in the A records [default = 127.0.0.1]\n", app);
+}
+
+int
+main(int argc, char *const argv[])
+{
+	struct ev_loop *loop = EV_DEFAULT;
+	struct sockaddr_in sin;
+	const char *addr = "127.0.0.1";
+	int ch, port = 18053;
+	ev_io sockio;
+	ev_signal sigint, sigterm;
+
+	answer_addr.s_addr = htonl(INADDR_LOOPBACK);
+	while ((ch = getopt(argc, argv, "a:b:p:h")) != -1) {
+		switch (ch) {
+		case 'a':
+			if (!inet_aton(optarg, &answer_addr)) {
+				fprintf(stderr, "Bad address %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'b':
+			addr = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	if (!inet_aton(addr, &sin.sin_addr)) {
+		fprintf(stderr, "Bad address %s\n", addr);
+		return 1;
+	}
+	if ((sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0)) < 0 ||
+	    bind(sock, (struct sockaddr *)&sin, sizeof(sin)) < 0) {
+		fprintf(stderr, "Bind on %s:%d error: %s\n", addr, port, strerror(errno));
+		return 1;
+	}
+
+	ev_io_init(&sockio, sock_read, sock, EV_READ);
+	ev_io_start(EV_A_ &sockio);
+	ev_signal_init(&sigint, sig_stop, SIGINT);
+	ev_signal_start(EV_A_ &sigint);
+	ev_signal_init(&sigterm, sig_stop, SIGTERM);
+	ev_signal_start(EV_A_ &sigterm);
+	ev_run(EV_A_ 0);
+
+	fprintf(stderr, "dnsstub: %lu queries\n", queries);
+	close(sock);
+	return 0;
+}
@@ -0,0 +1,514 @@
+/* open-loop HTTP load generator for benchmarks: requests are due at a
+ * constant rate whatever the responses do, and latency is counted from
+ * the time a request was due, so a stalled proxy can't hide behind the
+ * client waiting for it (coordinated omission) */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <ev.h>
+
+#include "../queue.h"
+
+#define HEAD_MAX	8192
+#define TICK		0.001		/* sec between issuing due requests */
+#define SWEEP		0.1		/* sec between timeout checks */
+
+enum { C_CONNECT, C_SEND, C_READ, C_IDLE };
+
+struct conn {
+	ev_io		io;
+	int		state;
+	unsigned	holder:1;	/* idle keep-alive, not part of the load */
+	unsigned	keep:1;
+	unsigned	head:1;		/* response head is read */
+	double		due;		/* current request was due then */
+	size_t		sent;
+	char		in[HEAD_MAX];
+	size_t		inlen;
+	long long	left;		/* body not read yet, -1 - till EOF */
+	LIST_ENTRY(conn) link;		/* all open connections */
+	SLIST_ENTRY(conn) free;		/* idle, ready for the next request */
+};
+
+static struct {
+	struct sockaddr_in proxy;
+	const char	*url;
+	double		rate;
+	double		duration;
+	double		timeout;
+	int		maxconns;
+	int		holders;
+	int		close;		/* new connection per request */
+} opt = {
+	.rate = 1000,
+	.duration = 10,
+	.timeout = 10,
+	.maxconns = 1000,
+};
+
+static char req[1024];
+static size_t reqlen;
+
+static LIST_HEAD(, conn) conns = LIST_HEAD_INITIALIZER(conns);
+static SLIST_HEAD(, conn) idle = SLIST_HEAD_INITIALIZER(idle);
+static int nconns, nholders, held;
+
+/* requests due while all connections are busy, oldest first */
+static double *backlog;
+static size_t blhead, bltail, blsize;
+
+static double *lat;		/* of every completed request, sec */
+static size_t nlat, latsize;
+
+static double start, stopping, last;
+static unsigned long issued, errors, timeouts;
+static unsigned long long bytes;
+
+static void conn_io(EV_P_ ev_io *w, int revents);
+static void issue(EV_P_ double due);
+
+static void
+backlog_push(double due)
+{
+	if (bltail - blhead == blsize) {
+		size_t n = blsize ? blsize * 2 : 1024, i;
+		double *b = malloc(n * sizeof(*b));
+
+		if (!b) {
+			errors++;
+			return;
+		}
+		for (i = 0; i < blsize; i++)
+			b[i] = backlog[(blhead + i) % blsize];
+		free(backlog);
+		backlog = b;
+		bltail -= blhead;
+		blhead = 0;
+		blsize = n;
+	}
+	backlog[bltail++ % blsize] = due;
+}
+
+static void
+record(double sec)
+{
+	if (nlat == latsize) {
+		size_t n = latsize ? latsize * 2 : 65536;
+		double *l = realloc(lat, n * sizeof(*l));
+
+		if (!l) {
+			errors++;
+			return;
+		}
+		lat = l;
+		latsize = n;
+	}
+	lat[nlat++] = sec;
+}
+
+static void
+conn_watch(EV_P_ struct conn *c, int events)
+{
+	ev_io_stop(EV_A_ &c->io);
+	if (!events)
+		return;
+	ev_io_set(&c->io, c->io.fd, events);
+	ev_io_start(EV_A_ &c->io);
+}
+
+static void
+conn_close(EV_P_ struct conn *c)
+{
+	ev_io_stop(EV_A_ &c->io);
+	close(c->io.fd);
+	LIST_REMOVE(c, link);
+	if (c->holder)
+		nholders--;
+	else
+		nconns--;
+	free(c);
+}
+
+static struct conn *
+conn_open(EV_P_ int holder)
+{
+	struct conn *c = calloc(1, sizeof(*c));
+	int fd, one = 1;
+
+	if (!c)
+		return NULL;
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (fd < 0 || (connect(fd, (struct sockaddr *)&opt.proxy, sizeof(opt.proxy)) < 0 &&
+	    errno != EINPROGRESS)) {
+		if (fd >= 0)
+			close(fd);
+		free(c);
+		return NULL;
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	c->holder = holder;
+	c->state = C_CONNECT;
+	ev_io_init(&c->io, conn_io, fd, EV_WRITE);
+	ev_io_start(EV_A_ &c->io);
+	LIST_INSERT_HEAD(&conns, c, link);
+	if (holder)
+		nholders++;
+	else
+		nconns++;
+	return c;
+}
+
+static void
+conn_request(EV_P_ struct conn *c, double due)
+{
+	c->due = due;
+	c->sent = c->inlen = 0;
+	c->head = 0;
+	if (c->state != C_CONNECT) {
+		c->state = C_SEND;
+		conn_watch(EV_A_ c, EV_WRITE);
+	}
+}
+
+/* current request is over, the connection takes the next due one */
+static void
+conn_done(EV_P_ struct conn *c, int ok)
+{
+	if (c->holder) {
+		if (ok) {
+			held++;
+			c->state = C_IDLE;
+			conn_watch(EV_A_ c, 0);
+		}
+		else
+			conn_close(EV_A_ c);
+		return;
+	}
+	if (ok) {
+		last = ev_now(EV_A);
+		record(last - c->due);
+	}
+	else
+		errors++;
+
+	if (!ok || !c->keep || opt.close) {
+		conn_close(EV_A_ c);
+		if (blhead != bltail)
+			issue(EV_A_ backlog[blhead++ % blsize]);
+		return;
+	}
+	if (blhead != bltail) {
+		conn_request(EV_A_ c, backlog[blhead++ % blsize]);
+		return;
+	}
+	c->state = C_IDLE;
+	conn_watch(EV_A_ c, 0);
+	SLIST_INSERT_HEAD(&idle, c, free);
+}
+
+/* 1 - head parsed, 0 - need more, -1 - bad or failed response */
+static int
+parse_head(struct conn *c, size_t *used)
+{
+	char *end = memmem(c->in, c->inlen, "\r\n\r\n", 4), *p;
+
+	if (!end)
+		return c->inlen == sizeof(c->in) ? -1 : 0;
+	*end = 0;
+	*used = end + 4 - c->in;
+	if (strncmp(c->in, "HTTP/1.", 7) || c->in[9] != '2')
+		return -1;
+	c->left = -1;
+	if ((p = strcasestr(c->in, "\r\ncontent-length:")))
+		c->left = strtoll(p + 17, NULL, 10);
+	c->keep = c->in[7] == '1' && !strcasestr(c->in, "\r\nconnection: close") &&
+		c->left >= 0;
+	return 1;
+}
+
+static void
+conn_read(EV_P_ struct conn *c)
+{
+	char buf[65536];
+	size_t used;
+	ssize_t n;
+	int r;
+
+	for (;;) {
+		if (!c->head) {
+			n = recv(c->io.fd, c->in + c->inlen, sizeof(c->in) - c->inlen, 0);
+			if (n > 0) {
+				c->inlen += n;
+				if ((r = parse_head(c, &used)) < 0)
+					goto fail;
+				if (r == 0)
+					continue;
+				c->head = 1;
+				n = c->inlen - used;
+				goto body;
+			}
+		}
+		else
+			n = recv(c->io.fd, buf, sizeof(buf), 0);
+
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				return;
+			goto fail;
+		}
+		if (n == 0) {
+			if (c->head && c->left < 0) {
+				conn_done(EV_A_ c, 1);
+				return;
+			}
+			goto fail;
+		}
+body:
+		bytes += n;
+		if (c->left >= 0 && (c->left -= n) <= 0) {
+			conn_done(EV_A_ c, c->left == 0);
+			return;
+		}
+	}
+fail:
+	conn_done(EV_A_ c, 0);
+}
+
+static void
+conn_io(EV_P_ ev_io *w, int revents)
+{
+	struct conn *c = (struct conn *)w;
+	int err = 0;
+	socklen_t len = sizeof(err);
+	ssize_t n;
+
+	switch (c->state) {
+	case C_CONNECT:
+		if (getsockopt(w->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+			conn_done(EV_A_ c, 0);
+			return;
+		}
+		c->state = C_SEND;
+		/* fall through */
+	case C_SEND:
+		n = send(w->fd, req + c->sent, reqlen - c->sent, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno != EAGAIN && errno != EINTR)
+				conn_done(EV_A_ c, 0);
+			return;
+		}
+		if ((c->sent += n) < reqlen)
+			return;
+		c->state = C_READ;
+		conn_watch(EV_A_ c, EV_READ);
+		return;
+	case C_READ:
+		conn_read(EV_A_ c);
+		return;
+	}
+}
+
+static void
+issue(EV_P_ double due)
+{
+	struct conn *c;
+
+	if ((c = SLIST_FIRST(&idle))) {
+		SLIST_REMOVE_HEAD(&idle, free);
+		conn_request(EV_A_ c, due);
+	}
+	else if (nconns < opt.maxconns && (c = conn_open(EV_A_ 0)))
+		conn_request(EV_A_ c, due);
+	else if (nconns == 0)
+		errors++;
+	else
+		backlog_push(due);
+}
+
+static void
+tick(EV_P_ ev_timer *w, int revents)
+{
+	double now = ev_now(EV_A);
+	unsigned long due = (now - start) * opt.rate;
+
+	if (now - start >= opt.duration) {
+		due = opt.duration * opt.rate;
+		ev_timer_stop(EV_A_ w);
+		stopping = now;
+	}
+	while (issued < due)
+		issue(EV_A_ start + issued++ / opt.rate);
+}
+
+/* requests out for too long fail, the run ends when all are back */
+static void
+sweep(EV_P_ ev_timer *w, int revents)
+{
+	double now = ev_now(EV_A);
+	struct conn *c, *n;
+	int busy = 0;
+
+	for (c = LIST_FIRST(&conns); c; c = n) {
+		n = LIST_NEXT(c, link);
+		if (c->state == C_IDLE)
+			continue;
+		if (now - c->due > opt.timeout) {
+			timeouts++;
+			conn_done(EV_A_ c, 0);
+		}
+		else if (!c->holder)
+			busy = 1;
+	}
+	if (stopping && !busy && blhead == bltail)
+		ev_break(EV_A_ EVBREAK_ALL);
+	if (stopping && now - stopping > opt.timeout) {
+		errors += bltail - blhead;
+		ev_break(EV_A_ EVBREAK_ALL);
+	}
+}
+
+static int
+cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double
+quantile(double q)
+{
+	size_t i = q * nlat;
+
+	if (!nlat)
+		return 0;
+	return lat[i < nlat ? i : nlat - 1] * 1e3;
+}
+
+static void
+usage(const char *app)
+{
+	fprintf(stderr, "usage: %s -x proxy:port [-r rate] [-d sec] [-c conns] [-i idle] "
+		"[-t timeout] [-n] url\n"
+		"\t-x : proxy to send requests to\n"
+		"\t-r : requests per second [default = %.0f]\n"
+		"\t-d : duration, sec [default = %.0f]\n"
+		"\t-c : most connections carrying requests [default = %d]\n"
+		"\t-i : idle keep-alive connections held open meanwhile\n"
+		"\t-t : request timeout, sec [default = %.0f]\n"
+		"\t-n : new connection per request\n",
+		app, opt.rate, opt.duration, opt.maxconns, opt.timeout);
+}
+
+int
+main(int argc, char *const argv[])
+{
+	struct ev_loop *loop = EV_DEFAULT;
+	struct rlimit rl;
+	ev_timer tickw, sweepw;
+	const char *host, *path;
+	char *colon;
+	int ch;
+	double elapsed;
+
+	while ((ch = getopt(argc, argv, "x:r:d:c:i:t:nh")) != -1) {
+		switch (ch) {
+		case 'x':
+			if (!(colon = strchr(optarg, ':'))) {
+				usage(argv[0]);
+				return 1;
+			}
+			*colon = 0;
+			opt.proxy.sin_family = AF_INET;
+			opt.proxy.sin_port = htons(atoi(colon + 1));
+			if (!inet_aton(optarg, &opt.proxy.sin_addr)) {
+				fprintf(stderr, "Bad proxy address %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'r':
+			opt.rate = atof(optarg);
+			break;
+		case 'd':
+			opt.duration = atof(optarg);
+			break;
+		case 'c':
+			opt.maxconns = atoi(optarg);
+			break;
+		case 'i':
+			opt.holders = atoi(optarg);
+			break;
+		case 't':
+			opt.timeout = atof(optarg);
+			break;
+		case 'n':
+			opt.close = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc - 1 || !opt.proxy.sin_port || opt.rate <= 0 ||
+	    opt.duration <= 0 || opt.maxconns <= 0 ||
+	    strncmp(argv[optind], "http://", 7)) {
+		usage(argv[0]);
+		return 1;
+	}
+	opt.url = argv[optind];
+	host = opt.url + 7;
+	path = strchr(host, '/');
+	reqlen = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: %.*s\r\n%s\r\n",
+		opt.url, path ? (int)(path - host) : (int)strlen(host), host,
+		opt.close ? "Connection: close\r\n" : "");
+
+	signal(SIGPIPE, SIG_IGN);
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	/* idle connections are set up before the clock starts */
+	ev_timer_init(&sweepw, sweep, SWEEP, SWEEP);
+	ev_timer_start(EV_A_ &sweepw);
+	for (ch = 0; ch < opt.holders; ch++) {
+		struct conn *c = conn_open(EV_A_ 1);
+		if (c)
+			conn_request(EV_A_ c, ev_now(EV_A));
+		if (nholders - held >= 256 || ch == opt.holders - 1)
+			while (nholders > held)
+				ev_run(EV_A_ EVRUN_ONCE);
+	}
+
+	ev_now_update(EV_A);
+	start = ev_now(EV_A);
+	ev_timer_init(&tickw, tick, 0, TICK);
+	ev_timer_start(EV_A_ &tickw);
+	ev_run(EV_A_ 0);
+	/* a proxy falling behind stretches the run past its duration */
+	elapsed = last - start > opt.duration ? last - start : opt.duration;
+
+	qsort(lat, nlat, sizeof(*lat), cmp);
+	printf("requests %lu\n", issued);
+	printf("completed %zu\n", nlat);
+	printf("errors %lu\n", errors);
+	printf("timeouts %lu\n", timeouts);
+	printf("idle_held %d\n", held);
+	printf("rps %.1f\n", nlat / elapsed);
+	printf("mbytes_per_sec %.2f\n", bytes / elapsed / (1 << 20));
+	printf("p50_ms %.3f\n", quantile(0.5));
+	printf("p99_ms %.3f\n", quantile(0.99));
+	printf("p999_ms %.3f\n", quantile(0.999));
+	printf("max_ms %.3f\n", nlat ? lat[nlat - 1] * 1e3 : 0);
+	return 0;
+}
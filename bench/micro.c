@@ -0,0 +1,711 @@
+/* microbenchmarks of the hot primitives: ring buffer, request head
+ * parser, TLS hello, response cache, host/url/regex filters, client ACL
+ * and util helpers.
+ *
+ * Every benchmark is warmed up, then run in rounds of a calibrated
+ * number of iterations on one pinned CPU; the best round is reported,
+ * it is the one least disturbed by the rest of the system. Output is
+ * one tab separated line per benchmark:
+ *
+ *	name	iterations	ns_per_op	bytes_per_cycle
+ *
+ * cycles are TSC ticks where there is a TSC, elsewhere bytes_per_cycle
+ * is 0; benchmarks that don't walk over bytes report 0 too */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#include "../ringbuffer.h"
+#include "../http.h"
+#include "../hostfilter.h"
+#include "../urlfilter.h"
+#include "../rxfilter.h"
+#include "../acl.h"
+#include "../util.h"
+#include "../tls.h"
+#include "../cache.h"
+
+#define ROUNDS		5
+#define WARMUP		0.05		/* sec */
+
+FILE *logfp = NULL;
+
+/* runs n iterations, returns the bytes gone through */
+typedef size_t (*bench_fn)(void *arg, size_t n);
+
+struct bench {
+	const char	*name;
+	bench_fn	fn;
+	void		*arg;
+};
+
+static volatile size_t sink;
+static double round_time = 0.2;		/* sec */
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t
+cycles(void)
+{
+#ifdef HAVE_TSC
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static void
+run(const struct bench *b)
+{
+	double t, best = 0;
+	uint64_t c, bestc = 0;
+	size_t n = 1, bytes = 0;
+	int i;
+
+	/* warm caches and branch predictors, find n for one round */
+	for (t = now(); now() - t < WARMUP; n *= 2)
+		b->fn(b->arg, n);
+	for (;;) {
+		t = now();
+		b->fn(b->arg, n);
+		t = now() - t;
+		if (t >= round_time / 4)
+			break;
+		n *= 2;
+	}
+	n = n * (round_time / t) + 1;
+
+	for (i = 0; i < ROUNDS; i++) {
+		t = now();
+		c = cycles();
+		bytes = b->fn(b->arg, n);
+		c = cycles() - c;
+		t = now() - t;
+		if (i == 0 || t < best) {
+			best = t;
+			bestc = c;
+		}
+	}
+	printf("%s\t%zu\t%.2f\t%.3f\n", b->name, n, best * 1e9 / n,
+		bestc ? (double)bytes / bestc : 0.0);
+	fflush(stdout);
+}
+
+/* relay ring */
+
+#define RB_SIZE		16384		/* IOBUFSIZE */
+#define RB_CHUNK	5000		/* odd size, every few reads wrap */
+
+struct rbarg {
+	struct ringbuf	rb;
+	char		chunk[RB_CHUNK];
+	int		in[2], out[2];	/* socket pairs on both sides */
+};
+
+static size_t
+b_rb_iov(void *arg, size_t n)
+{
+	struct rbarg *a = arg;
+	struct iovec iov[2];
+	size_t i, len = 0;
+
+	for (i = 0; i < n; i++) {
+		a->rb.head = i * RB_CHUNK;
+		a->rb.tail = a->rb.head + RB_SIZE / 2;
+		len += rb_data_iov(&a->rb, iov);
+		len += rb_space_iov(&a->rb, iov, 0, 0);
+	}
+	sink = len;
+	return 0;
+}
+
+static int
+rb_setup(struct rbarg *a, int mirror)
+{
+	a->rb.buf = mirror ? rb_mirror_map(RB_SIZE, 0) : malloc(RB_SIZE);
+	a->rb.size = RB_SIZE;
+	a->rb.mirror = mirror;
+	memset(a->chunk, 'x', sizeof(a->chunk));
+	if (!a->rb.buf || socketpair(AF_UNIX, SOCK_STREAM, 0, a->in) < 0 ||
+	    socketpair(AF_UNIX, SOCK_STREAM, 0, a->out) < 0)
+		return -1;
+	return 0;
+}
+
+/* one relay step: readv() into the ring, sendmsg() out of it; the
+ * kernel copies are included, the socket pairs are fed and drained
+ * as it goes */
+static size_t
+b_rb_relay(void *arg, size_t n)
+{
+	struct rbarg *a = arg;
+	struct iovec iov[2];
+	char out[RB_CHUNK];
+	size_t i, bytes = 0;
+	ssize_t r;
+
+	rb_reset(&a->rb);
+	for (i = 0; i < n; i++) {
+		if (write(a->in[1], a->chunk, RB_CHUNK) != RB_CHUNK)
+			break;
+		r = readv(a->in[0], iov, rb_space_iov(&a->rb, iov, RB_CHUNK, 0));
+		if (r > 0)
+			a->rb.tail += r;
+		if ((r = rb_send(a->out[0], &a->rb, MSG_NOSIGNAL)) > 0) {
+			bytes += r;
+			if (read(a->out[1], out, r) != r)
+				break;
+		}
+	}
+	return bytes;
+}
+
+/* request head parser */
+
+static const char request[] =
+	"GET http://www.example.com/articles/2024/performance-engineering?page=2&sort=new HTTP/1.1\r\n"
+	"Host: www.example.com\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101 Firefox/120.0\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,*/*;q=0.8\r\n"
+	"Accept-Language: en-US,en;q=0.5\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Referer: http://www.example.com/articles/2024/\r\n"
+	"Connection: keep-alive\r\n"
+	"Cookie: session=5f2b8c1e9a7d4f3b; prefs=dark; consent=1; _ga=GA1.2.123456789.1700000000\r\n"
+	"Upgrade-Insecure-Requests: 1\r\n"
+	"Cache-Control: max-age=0\r\n"
+	"\r\n";
+
+static struct http_req req;
+
+static size_t
+b_parse(void *arg, size_t n)
+{
+	size_t i, len = sizeof(request) - 1;
+
+	for (i = 0; i < n; i++) {
+		http_req_init(&req);
+		sink = http_parse_request(request, len, &req);
+	}
+	return n * len;
+}
+
+/* the head arrives in three reads, as client_cbread() sees it */
+static size_t
+b_parse_split(void *arg, size_t n)
+{
+	size_t i, len = sizeof(request) - 1;
+
+	for (i = 0; i < n; i++) {
+		http_req_init(&req);
+		http_parse_request(request, len / 3, &req);
+		http_parse_request(request, 2 * len / 3, &req);
+		sink = http_parse_request(request, len, &req);
+	}
+	return n * len;
+}
+
+/* filters, over a rule set the size of real blocklists */
+
+#define NHOSTS		100000
+#define NURLS		2000
+#define NREGEX		50
+#define NACL		10000
+#define NPROBES		1024
+
+struct filters {
+	struct hostfilter hosts;
+	struct urlfilter urls;
+	struct rxprog	rx;
+	struct rxcache	rxc;
+	struct acl	acl;
+	char		host[NPROBES][64];
+	char		url[NPROBES][160];
+	in_addr_t	addr[NPROBES];
+};
+
+static size_t
+b_hostfilter(void *arg, size_t n)
+{
+	struct filters *f = arg;
+	size_t i, bytes = 0, m = 0;
+
+	for (i = 0; i < n; i++) {
+		const char *h = f->host[i % NPROBES];
+		size_t len = strlen(h);
+		m += hostfilter_match(&f->hosts, h, len);
+		bytes += len;
+	}
+	sink = m;
+	return bytes;
+}
+
+static size_t
+b_urlfilter(void *arg, size_t n)
+{
+	struct filters *f = arg;
+	size_t i, bytes = 0, m = 0;
+
+	for (i = 0; i < n; i++) {
+		const char *u = f->url[i % NPROBES];
+		size_t len = strlen(u);
+		m += urlfilter_match(&f->urls, u, len, 0);
+		bytes += len;
+	}
+	sink = m;
+	return bytes;
+}
+
+static size_t
+b_regex(void *arg, size_t n)
+{
+	struct filters *f = arg;
+	size_t i, bytes = 0, m = 0;
+
+	for (i = 0; i < n; i++) {
+		const char *u = f->url[i % NPROBES];
+		size_t len = strlen(u);
+		m += rx_match(&f->rxc, &f->rx, u, len);
+		bytes += len;
+	}
+	sink = m;
+	return bytes;
+}
+
+static size_t
+b_acl(void *arg, size_t n)
+{
+	struct filters *f = arg;
+	size_t i, m = 0;
+
+	for (i = 0; i < n; i++)
+		m += acl_check(&f->acl, f->addr[i % NPROBES]);
+	sink = m;
+	return 0;
+}
+
+static int
+filters_init(struct filters *f)
+{
+	char rule[256], err[128];
+	unsigned seed = 1;
+	int i;
+
+	if (hostfilter_init(&f->hosts) < 0 || urlfilter_init(&f->urls) < 0 ||
+	    rxprog_init(&f->rx) < 0 || acl_init(&f->acl) < 0)
+		return -1;
+	for (i = 0; i < NHOSTS; i++) {
+		snprintf(rule, sizeof(rule), "%shost%d.ads%d.example", i & 1 ? "*." : "",
+			i, i % 97);
+		if (hostfilter_add(&f->hosts, rule) < 0)
+			return -1;
+	}
+	for (i = 0; i < NURLS; i++) {
+		snprintf(rule, sizeof(rule), "/banner%d/", i);
+		if (urlfilter_add(&f->urls, rule) < 0)
+			return -1;
+	}
+	for (i = 0; i < NREGEX; i++) {
+		snprintf(rule, sizeof(rule), "/track[0-9]+/pixel%d\\.gif$", i);
+		if (rxprog_add(&f->rx, rule, err, sizeof(err)) < 0)
+			return -1;
+	}
+	for (i = 0; i < NACL; i++) {
+		snprintf(rule, sizeof(rule), "%u.%u.%u.0/%d", 10 + rand_r(&seed) % 200,
+			rand_r(&seed) % 256, rand_r(&seed) % 256, 16 + rand_r(&seed) % 9);
+		if (acl_add(&f->acl, rule, i & 1 ? ACL_ALLOW : ACL_DENY) < 0)
+			return -1;
+	}
+	if (urlfilter_compile(&f->urls, 1) < 0 || rxprog_compile(&f->rx) < 0 ||
+	    acl_compile(&f->acl) < 0)
+		return -1;
+	rxcache_init(&f->rxc);
+
+	/* one in eight probes hits */
+	for (i = 0; i < NPROBES; i++) {
+		int hit = (i & 7) == 0, k = rand_r(&seed) % NHOSTS;
+
+		if (hit)
+			snprintf(f->host[i], sizeof(f->host[i]), "%shost%d.ads%d.example",
+				k & 1 ? "cdn." : "", k & 1 ? k : k & ~1, (k & 1 ? k : k & ~1) % 97);
+		else
+			snprintf(f->host[i], sizeof(f->host[i]), "www%d.site%d.example.com",
+				k % 10, k);
+		snprintf(f->url[i], sizeof(f->url[i]),
+			"http://www%d.site%d.example.com/static/%s%d/img/photo%d.jpg?w=640&h=480&q=85",
+			k % 10, k, hit ? "banner" : "gallery", k % NURLS, k);
+		f->addr[i] = htonl((10 + rand_r(&seed) % 200) << 24 | rand_r(&seed) % (1 << 24));
+	}
+	return 0;
+}
+
+/* TLS hello the way current browsers send it: the host name comes
+ * after a post-quantum key share of over a kilobyte */
+
+#define SEGMENT		1448
+
+static char hello[2048];
+static size_t hellolen;
+
+static char *
+put16(char *p, size_t v)
+{
+	*p++ = v >> 8;
+	*p++ = v;
+	return p;
+}
+
+static void
+hello_init(void)
+{
+	static const char host[] = "update.example.com";
+	char *p = hello + 9, *ext;
+
+	p = put16(p, 0x0303);
+	memset(p, 0x5a, 32);			/* random */
+	p += 32;
+	*p++ = 32;				/* session id */
+	memset(p, 0x11, 32);
+	p += 32;
+	p = put16(p, 32);			/* cipher suites */
+	memset(p, 0x13, 32);
+	p += 32;
+	*p++ = 1;				/* compression */
+	*p++ = 0;
+	ext = p;
+	p += 2;
+	p = put16(p, 0x000a);			/* supported_groups */
+	p = put16(p, 8);
+	memset(p, 0x1d, 8);
+	p += 8;
+	p = put16(p, 0x0033);			/* key_share */
+	p = put16(p, 1260);
+	memset(p, 0x42, 1260);
+	p += 1260;
+	p = put16(p, 0x0015);			/* padding */
+	p = put16(p, 360);
+	memset(p, 0, 360);
+	p += 360;
+	p = put16(p, 0x0000);			/* server_name */
+	p = put16(p, sizeof(host) - 1 + 5);
+	p = put16(p, sizeof(host) - 1 + 3);
+	*p++ = 0;
+	p = put16(p, sizeof(host) - 1);
+	memcpy(p, host, sizeof(host) - 1);
+	p += sizeof(host) - 1;
+	p = put16(p, 0x002b);			/* supported_versions */
+	p = put16(p, 3);
+	*p++ = 2;
+	p = put16(p, 0x0304);
+	put16(ext, p - ext - 2);
+
+	hellolen = p - hello;
+	hello[0] = 22;				/* record */
+	put16(hello + 1, 0x0301);
+	put16(hello + 3, hellolen - 5);
+	hello[5] = 1;				/* client_hello */
+	hello[6] = 0;
+	put16(hello + 7, hellolen - 9);
+}
+
+static size_t
+b_tls_sni(void *arg, size_t n)
+{
+	char name[TLS_NAME_MAX + 1];
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		sink = tls_sni(hello, hellolen, name);
+	return n * hellolen;
+}
+
+/* the hello arrives in TCP segments, each read looks at it all again */
+static size_t
+b_tls_sni_split(void *arg, size_t n)
+{
+	char name[TLS_NAME_MAX + 1];
+	size_t i, len;
+
+	for (i = 0; i < n; i++)
+		for (len = SEGMENT; ; len += SEGMENT) {
+			if (len >= hellolen) {
+				sink = tls_sni(hello, hellolen, name);
+				break;
+			}
+			sink = tls_sni(hello, len, name);
+		}
+	return n * hellolen;
+}
+
+/* response cache, a worker's share of it full of small objects */
+
+#define CACHE_MEM	(64 << 20)
+#define NOBJS		8192
+#define OBJSIZE		4096
+
+static const char cached_resp[] =
+	"HTTP/1.1 200 OK\r\n"
+	"Content-Type: application/javascript\r\n"
+	"Cache-Control: public, max-age=3600\r\n"
+	"Vary: Accept-Encoding\r\n"
+	"Content-Length: 4096\r\n"
+	"\r\n";
+
+struct cachearg {
+	struct cache	cache;
+	struct cache	churn;		/* small, every store evicts */
+	struct http_resp resp;
+	char		body[OBJSIZE];
+	char		head[NPROBES][256];
+	size_t		len[NPROBES];
+	struct http_req	req[NPROBES];
+	size_t		seq;
+};
+
+static size_t
+cache_head(char *head, size_t size, int i)
+{
+	return snprintf(head, size, "GET http://cdn%d.example.com/static/%d/app.js HTTP/1.1\r\n"
+		"Host: cdn%d.example.com\r\n"
+		"Accept-Encoding: gzip, deflate, br\r\n"
+		"Accept: */*\r\n"
+		"\r\n", i % 64, i, i % 64);
+}
+
+/* store the response to request head as cache_fill_start() and the
+ * relay do it */
+static int
+cache_store(struct cache *c, struct cachearg *a, const char *key, size_t keylen,
+		const char *head, size_t len)
+{
+	struct cache_req *cr = cache_req_new(key, keylen, head, len);
+	struct cache_obj *o;
+
+	if (!cr)
+		return -1;
+	o = cache_fill_start(c, cr, &a->resp, cached_resp, time(NULL));
+	free(cr);
+	if (!o)
+		return -1;
+	cache_fill(o, a->body, OBJSIZE);
+	cache_fill_done(o);
+	return 0;
+}
+
+static int
+cache_setup(struct cachearg *a)
+{
+	char head[256], key[CACHE_KEY_MAX];
+	struct http_req req;
+	size_t len;
+	ssize_t n;
+	int i, p;
+
+	if (cache_init(&a->cache, CACHE_MEM) < 0 || cache_init(&a->churn, CACHE_MEM / 16) < 0)
+		return -1;
+	http_parse_response(cached_resp, sizeof(cached_resp) - 1, &a->resp);
+	memset(a->body, 'x', OBJSIZE);
+	for (i = 0; i < NOBJS; i++) {
+		len = cache_head(head, sizeof(head), i);
+		http_req_init(&req);
+		if (http_parse_request(head, len, &req) <= 0 ||
+		    (n = cache_key(head, &req, key, sizeof(key))) < 0 ||
+		    cache_store(&a->cache, a, key, n, head, len) < 0)
+			return -1;
+		if (i % (NOBJS / NPROBES) == 0) {
+			p = i / (NOBJS / NPROBES);
+			memcpy(a->head[p], head, len);
+			a->len[p] = len;
+			http_req_init(&a->req[p]);
+			http_parse_request(a->head[p], len, &a->req[p]);
+		}
+	}
+	return 0;
+}
+
+/* everything client_cache() does for a hit: request check, key, lookup
+ * with the Vary match */
+static size_t
+b_cache_hit(void *arg, size_t n)
+{
+	struct cachearg *a = arg;
+	char key[CACHE_KEY_MAX];
+	struct cache_obj *o;
+	size_t i, bytes = 0, hits = 0;
+	time_t now = time(NULL);
+	ssize_t k;
+	int p;
+
+	for (i = 0; i < n; i++) {
+		p = i % NPROBES;
+		if (cache_request(a->head[p], &a->req[p]) != CACHE_LOOKUP)
+			continue;
+		k = cache_key(a->head[p], &a->req[p], key, sizeof(key));
+		if ((o = cache_lookup(&a->cache, key, k, a->head[p], a->len[p], now))) {
+			hits++;
+			cache_put(o);
+		}
+		bytes += a->len[p];
+	}
+	sink = hits;
+	return bytes;
+}
+
+/* a new object on each iteration, each pushing out the coldest one */
+static size_t
+b_cache_store(void *arg, size_t n)
+{
+	struct cachearg *a = arg;
+	char key[64];
+	size_t i, m = 0;
+	int len;
+
+	for (i = 0; i < n; i++) {
+		len = snprintf(key, sizeof(key), "cdn.example.com:80/obj/%zu", a->seq++);
+		m += cache_store(&a->churn, a, key, len, a->head[0], a->len[0]) == 0;
+	}
+	sink = m;
+	return n * OBJSIZE;
+}
+
+/* util */
+
+static size_t
+b_get_peerip(void *arg, size_t n)
+{
+	int fd = *(int *)arg;
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		sink = (size_t)get_peerip(fd);
+	return 0;
+}
+
+/* a connected loopback TCP socket, the one get_peerip() gets in sfp */
+static int
+tcp_pair(int fd[2])
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	int l = socket(AF_INET, SOCK_STREAM, 0);
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (l < 0 || bind(l, (struct sockaddr *)&sin, sizeof(sin)) < 0 || listen(l, 1) < 0 ||
+	    getsockname(l, (struct sockaddr *)&sin, &len) < 0 ||
+	    (fd[1] = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+	    connect(fd[1], (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+	    (fd[0] = accept(l, NULL, NULL)) < 0) {
+		perror("loopback socket");
+		return -1;
+	}
+	close(l);
+	return 0;
+}
+
+static void
+usage(const char *app)
+{
+	fprintf(stderr, "usage: %s [-c cpu] [-t sec] [name...]\n"
+		"\t-c : CPU to pin to [default = the one we start on]\n"
+		"\t-t : time of one round, sec [default = %.1f]\n"
+		"\tname : run only benchmarks whose name starts with it\n",
+		app, round_time);
+}
+
+int
+main(int argc, char *const argv[])
+{
+	static struct rbarg rb, mrb;
+	static struct filters f;
+	static struct cachearg ca;
+	int tcp[2], ch, cpu = sched_getcpu();
+	cpu_set_t set;
+	size_t i;
+	int j;
+
+	while ((ch = getopt(argc, argv, "c:t:h")) != -1) {
+		switch (ch) {
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 't':
+			round_time = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) < 0)
+		fprintf(stderr, "CPU %d pin error: %s\n", cpu, strerror(errno));
+
+	if (rb_setup(&rb, 0) < 0 || rb_setup(&mrb, 1) < 0 || tcp_pair(tcp) < 0) {
+		fprintf(stderr, "Setup error: %s\n", strerror(errno));
+		return 1;
+	}
+	hello_init();
+	if (filters_init(&f) < 0) {
+		fprintf(stderr, "Filter setup error\n");
+		return 1;
+	}
+	if (cache_setup(&ca) < 0) {
+		fprintf(stderr, "Cache setup error\n");
+		return 1;
+	}
+
+	const struct bench benches[] = {
+		{ "rb_iov",		b_rb_iov,	&rb },
+		{ "rb_relay",		b_rb_relay,	&rb },
+		{ "rb_iov_mirror",	b_rb_iov,	&mrb },
+		{ "rb_relay_mirror",	b_rb_relay,	&mrb },
+		{ "http_parse",		b_parse,	NULL },
+		{ "http_parse_split",	b_parse_split,	NULL },
+		{ "tls_sni",		b_tls_sni,	NULL },
+		{ "tls_sni_split",	b_tls_sni_split, NULL },
+		{ "cache_hit",		b_cache_hit,	&ca },
+		{ "cache_store",	b_cache_store,	&ca },
+		{ "hostfilter_match",	b_hostfilter,	&f },
+		{ "urlfilter_match",	b_urlfilter,	&f },
+		{ "rx_match",		b_regex,	&f },
+		{ "acl_check",		b_acl,		&f },
+		{ "get_peerip",		b_get_peerip,	&tcp[0] },
+	};
+
+	printf("# cpu %d, %d rounds of %.2fs, best round\n", cpu, ROUNDS, round_time);
+	printf("# name\titerations\tns_per_op\tbytes_per_cycle\n");
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		if (optind < argc) {
+			for (j = optind; j < argc; j++)
+				if (!strncmp(benches[i].name, argv[j], strlen(argv[j])))
+					break;
+			if (j == argc)
+				continue;
+		}
+		run(&benches[i]);
+	}
+	return 0;
+}
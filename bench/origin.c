@@ -0,0 +1,287 @@
+/* origin stub for benchmarks: "GET /<size>[?delay=<ms>]" is answered
+ * with a body of size bytes (k and m suffixes) after the delay, keep-alive
+ * is honoured and requests on a connection are served in order */
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <ev.h>
+
+#define HEAD_MAX	8192
+#define BODY_CHUNK	(256 * 1024)
+
+struct conn {
+	ev_io		io;
+	ev_timer	delay;
+	char		in[HEAD_MAX];
+	size_t		inlen;
+	char		hdr[128];
+	size_t		hdrlen, hdroff;
+	unsigned long long left;	/* body not sent yet */
+	int		keep;
+};
+
+static char body[BODY_CHUNK];
+static unsigned long served, conns;
+
+static void
+conn_close(EV_P_ struct conn *c)
+{
+	ev_io_stop(EV_A_ &c->io);
+	ev_timer_stop(EV_A_ &c->delay);
+	close(c->io.fd);
+	free(c);
+	conns--;
+}
+
+static void
+conn_watch(EV_P_ struct conn *c, int events)
+{
+	if (ev_is_active(&c->io) && (c->io.events & (EV_READ | EV_WRITE)) == events)
+		return;
+	ev_io_stop(EV_A_ &c->io);
+	ev_io_set(&c->io, c->io.fd, events);
+	ev_io_start(EV_A_ &c->io);
+}
+
+static unsigned long long
+parse_size(const char *s, const char **end)
+{
+	char *e;
+	unsigned long long n = strtoull(s, &e, 10);
+
+	if (*e == 'k' || *e == 'K')
+		n <<= 10, e++;
+	else if (*e == 'm' || *e == 'M')
+		n <<= 20, e++;
+	*end = e;
+	return n;
+}
+
+/* 1 - a response is set up, 0 - head not complete, -1 - bad request */
+static int
+parse_request(struct conn *c, double *delay)
+{
+	char *end = memmem(c->in, c->inlen, "\r\n\r\n", 4);
+	const char *p;
+	size_t used;
+
+	if (!end)
+		return c->inlen == sizeof(c->in) ? -1 : 0;
+	*end = 0;
+	used = end + 4 - c->in;
+
+	if (strncmp(c->in, "GET /", 5))
+		return -1;
+	c->left = parse_size(c->in + 5, &p);
+	*delay = 0;
+	if (!strncmp(p, "?delay=", 7))
+		*delay = atoi(p + 7) / 1e3;
+	c->keep = !strcasestr(c->in, "\r\nconnection: close") &&
+		!strstr(c->in, " HTTP/1.0\r\n");
+
+	c->hdrlen = snprintf(c->hdr, sizeof(c->hdr), "HTTP/1.1 200 OK\r\n"
+		"Content-Length: %llu\r\n%s\r\n", c->left,
+		c->keep ? "" : "Connection: close\r\n");
+	c->hdroff = 0;
+	memmove(c->in, c->in + used, c->inlen - used);
+	c->inlen -= used;
+	return 1;
+}
+
+/* 1 - response done, 0 - socket is full, -1 - error */
+static int
+send_response(struct conn *c)
+{
+	struct iovec iov[2];
+	ssize_t n;
+	size_t h;
+
+	while (c->hdroff < c->hdrlen || c->left) {
+		h = c->hdrlen - c->hdroff;
+		iov[0].iov_base = c->hdr + c->hdroff;
+		iov[0].iov_len = h;
+		iov[1].iov_base = body;
+		iov[1].iov_len = c->left < BODY_CHUNK ? c->left : BODY_CHUNK;
+		n = writev(c->io.fd, iov, 2);
+		if (n < 0)
+			return errno == EAGAIN || errno == EINTR ? 0 : -1;
+		if ((size_t)n < h) {
+			c->hdroff += n;
+			continue;
+		}
+		c->hdroff = c->hdrlen;
+		c->left -= n - h;
+	}
+	served++;
+	return 1;
+}
+
+/* serve whatever is buffered, then wait for more */
+static void
+conn_serve(EV_P_ struct conn *c)
+{
+	double delay;
+	int r;
+
+	for (;;) {
+		if (c->hdrlen) {
+			if ((r = send_response(c)) < 0)
+				goto close;
+			if (r == 0) {
+				conn_watch(EV_A_ c, EV_WRITE);
+				return;
+			}
+			c->hdrlen = 0;
+			if (!c->keep)
+				goto close;
+		}
+		if ((r = parse_request(c, &delay)) < 0)
+			goto close;
+		if (r == 0) {
+			conn_watch(EV_A_ c, EV_READ);
+			return;
+		}
+		if (delay > 0) {
+			ev_io_stop(EV_A_ &c->io);
+			ev_timer_set(&c->delay, delay, 0);
+			ev_timer_start(EV_A_ &c->delay);
+			return;
+		}
+	}
+close:
+	conn_close(EV_A_ c);
+}
+
+static void
+conn_delayed(EV_P_ ev_timer *w, int revents)
+{
+	struct conn *c = (struct conn *)((char *)w - offsetof(struct conn, delay));
+
+	conn_serve(EV_A_ c);
+}
+
+static void
+conn_io(EV_P_ ev_io *w, int revents)
+{
+	struct conn *c = (struct conn *)w;
+	ssize_t n;
+
+	if (revents & EV_READ) {
+		n = recv(w->fd, c->in + c->inlen, sizeof(c->in) - c->inlen, 0);
+		if (n < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+		if (n <= 0) {
+			conn_close(EV_A_ c);
+			return;
+		}
+		c->inlen += n;
+	}
+	conn_serve(EV_A_ c);
+}
+
+static void
+server_accept(EV_P_ ev_io *w, int revents)
+{
+	struct conn *c;
+	int fd, n;
+
+	for (n = 0; n < 64; n++) {
+		if ((fd = accept4(w->fd, NULL, NULL, SOCK_NONBLOCK)) < 0)
+			return;
+		if (!(c = calloc(1, sizeof(*c)))) {
+			close(fd);
+			return;
+		}
+		conns++;
+		ev_io_init(&c->io, conn_io, fd, EV_READ);
+		ev_io_start(EV_A_ &c->io);
+		ev_timer_init(&c->delay, conn_delayed, 0, 0);
+	}
+}
+
+static void
+sig_stop(EV_P_ ev_signal *w, int revents)
+{
+	ev_break(EV_A_ EVBREAK_ALL);
+}
+
+static void
+usage(const char *app)
+{
+	fprintf(stderr, "usage: %s [-b addr] [-p port]\n"
+		"\t-b : address to listen on [default = 127.0.0.1]\n"
+		"\t-p : port [default = 18080]\n", app);
+}
+
+int
+main(int argc, char *const argv[])
+{
+	struct ev_loop *loop = EV_DEFAULT;
+	struct sockaddr_in sin;
+	struct rlimit rl;
+	const char *addr = "127.0.0.1";
+	int ch, fd, one = 1, port = 18080;
+	ev_io acceptio;
+	ev_signal sigint, sigterm;
+
+	while ((ch = getopt(argc, argv, "b:p:h")) != -1) {
+		switch (ch) {
+		case 'b':
+			addr = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+	memset(body, 'x', sizeof(body));
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	if (!inet_aton(addr, &sin.sin_addr)) {
+		fprintf(stderr, "Bad address %s\n", addr);
+		return 1;
+	}
+	if ((fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0 ||
+	    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+	    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0 ||
+	    bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+	    listen(fd, 4096) < 0) {
+		fprintf(stderr, "Listen on %s:%d error: %s\n", addr, port, strerror(errno));
+		return 1;
+	}
+
+	ev_io_init(&acceptio, server_accept, fd, EV_READ);
+	ev_io_start(EV_A_ &acceptio);
+	ev_signal_init(&sigint, sig_stop, SIGINT);
+	ev_signal_start(EV_A_ &sigint);
+	ev_signal_init(&sigterm, sig_stop, SIGTERM);
+	ev_signal_start(EV_A_ &sigterm);
+	ev_run(EV_A_ 0);
+
+	fprintf(stderr, "origin: %lu responses, %lu connections open\n", served, conns);
+	close(fd);
+	return 0;
+}
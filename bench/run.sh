@@ -0,0 +1,120 @@
+#!/bin/sh
+# end-to-end load scenarios, all on loopback: origin stub <- sfp <- loadgen
+#
+#	make bench			default scenarios
+#	make OPT=-O2 bench		the same against an optimized build
+#	BENCH_DURATION=30 BENCH_RATE=50000 BENCH_SFP_ARGS="-w 4" make bench
+#
+# every scenario starts a fresh sfp and prints one line: throughput,
+# latency quantiles counted from the time each request was due, and the
+# proxy's resident memory at the end and at its peak; the full loadgen
+# output is kept in $BENCH_OUT
+
+cd "$(dirname "$0")/.." || exit 1
+
+DURATION=${BENCH_DURATION:-5}
+SFP_ARGS=${BENCH_SFP_ARGS:-}
+RATE=${BENCH_RATE:-10000}	# of the small request scenarios
+ORIGIN_PORT=${BENCH_ORIGIN_PORT:-18080}
+PROXY_PORT=${BENCH_PROXY_PORT:-18081}
+OUT=${BENCH_OUT:-$(mktemp -d /tmp/sfp-bench.XXXXXX)}
+ORIGIN=http://127.0.0.1:$ORIGIN_PORT
+PROXY=127.0.0.1:$PROXY_PORT
+
+mkdir -p "$OUT"
+ulimit -n "$(ulimit -Hn)" 2>/dev/null
+
+cleanup() {
+	[ -n "$SFP_PID" ] && kill "$SFP_PID" 2>/dev/null
+	[ -n "$ORIGIN_PID" ] && kill "$ORIGIN_PID" 2>/dev/null
+	wait 2>/dev/null
+}
+trap cleanup EXIT INT TERM
+
+# wait for a listening socket on a port
+wait_port() {
+	hex=$(printf ':%04X' "$1")
+	i=0
+	while ! awk -v p="$hex" '$4 == "0A" && substr($2, length($2) - 4) == p { f = 1 }
+			END { exit !f }' \
+			/proc/net/tcp; do
+		i=$((i + 1))
+		if [ $i -gt 50 ]; then
+			echo "port $1 did not open" >&2
+			exit 1
+		fi
+		sleep 0.1
+	done
+}
+
+# sfp listens before it loads its config, it is ready once it says so
+wait_started() {
+	i=0
+	while ! grep -q "Started" "$1"; do
+		i=$((i + 1))
+		if [ $i -gt 300 ]; then
+			echo "sfp did not start, see $1" >&2
+			exit 1
+		fi
+		sleep 0.1
+	done
+}
+
+# a blocklist of the size real ones have, none of it matching the load
+filter_config() {
+	cfg=$OUT/filter.cfg
+	awk 'BEGIN {
+		for (i = 0; i < 100000; i++)
+			printf "block host%d.blocked.example\n", i
+		for (i = 0; i < 2000; i++)
+			printf "url /ads/banner%d/\n", i
+		for (i = 0; i < 50; i++)
+			printf "regex-url /track[0-9]+/pixel%d\\.gif$\n", i
+		for (i = 0; i < 10; i++)
+			printf "regex-header ^User-Agent:\\s*badbot%d\n", i
+	}' > "$cfg"
+	echo "$cfg"
+}
+
+# scenario name "sfp args" loadgen args...
+scenario() {
+	name=$1
+	args=$2
+	shift 2
+	./sfp -f -v 2 -p "$PROXY_PORT" $SFP_ARGS $args 2>"$OUT/$name.sfp.log" &
+	SFP_PID=$!
+	wait_started "$OUT/$name.sfp.log"
+	bench/loadgen -x "$PROXY" -d "$DURATION" "$@" > "$OUT/$name.txt"
+	rss=$(awk '/^VmRSS/ { print $2 }' /proc/$SFP_PID/status)
+	hwm=$(awk '/^VmHWM/ { print $2 }' /proc/$SFP_PID/status)
+	kill "$SFP_PID"
+	wait "$SFP_PID" 2>/dev/null
+	SFP_PID=
+	awk -v name="$name" -v rss="$rss" -v hwm="$hwm" '
+		{ v[$1] = $2 }
+		END {
+			printf "%-10s %9.0f %9.2f %9.3f %9.3f %9.3f %7d %7.1f %7.1f\n",
+				name, v["rps"], v["mbytes_per_sec"], v["p50_ms"],
+				v["p99_ms"], v["p999_ms"], v["errors"],
+				rss / 1024, hwm / 1024
+		}' "$OUT/$name.txt"
+}
+
+bench/origin -p "$ORIGIN_PORT" 2>"$OUT/origin.log" &
+ORIGIN_PID=$!
+wait_port "$ORIGIN_PORT"
+
+echo "sfp${SFP_ARGS:+ $SFP_ARGS}, ${DURATION}s per scenario, results in $OUT"
+printf "%-10s %9s %9s %9s %9s %9s %7s %7s %7s\n" scenario rps MB/s \
+	p50_ms p99_ms p999_ms errors rss_mb hwm_mb
+
+# new connection for every request
+scenario storm "" -n -r 2000 -c 2000 $ORIGIN/128
+# small responses over keep-alive connections
+scenario rps "" -r "$RATE" -c 256 $ORIGIN/1k
+# big downloads, relayed with splice
+scenario large "" -r 10 -c 64 $ORIGIN/16m
+# small load next to many idle keep-alive clients
+scenario idle "" -i 10000 -r 2000 -c 256 $ORIGIN/1k
+# small responses through a big rule set
+scenario filter "-c $(filter_config)" -r "$RATE" -c 256 $ORIGIN/1k
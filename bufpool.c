@@ -0,0 +1,181 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bufpool.h"
+
+static const size_t class_size[BUF_CLASSES] = { BUF_SMALL, BUF_MEDIUM };
+
+/* free buffers are chained through their first bytes */
+struct freebuf {
+	struct freebuf *next;
+};
+
+/* global lists are touched only when a worker cache runs dry or
+ * overflows, and then half a cache is moved at once */
+static struct {
+	pthread_mutex_t	lock;
+	struct freebuf	*free[BUF_CLASSES];
+	size_t		nfree[BUF_CLASSES];
+	size_t		cap;
+	size_t		allocated;
+	unsigned long	fails;
+} pool = { PTHREAD_MUTEX_INITIALIZER };
+
+static int
+class_of(size_t size)
+{
+	int i;
+	for (i = 0; i < BUF_CLASSES; i++)
+		if (size <= class_size[i])
+			return i;
+	return -1;
+}
+
+int
+bufpool_init(size_t cap)
+{
+	pool.cap = cap;
+	return 0;
+}
+
+void
+bufpool_destroy(void)
+{
+	int i;
+	struct freebuf *f;
+
+	pthread_mutex_lock(&pool.lock);
+	for (i = 0; i < BUF_CLASSES; i++) {
+		while ((f = pool.free[i]) != NULL) {
+			pool.free[i] = f->next;
+			pool.allocated -= class_size[i];
+			free(f);
+		}
+		pool.nfree[i] = 0;
+	}
+	pthread_mutex_unlock(&pool.lock);
+}
+
+void
+bufcache_init(struct bufcache *bc)
+{
+	memset(bc, 0, sizeof(*bc));
+}
+
+void
+bufcache_flush(struct bufcache *bc)
+{
+	int i;
+
+	pthread_mutex_lock(&pool.lock);
+	for (i = 0; i < BUF_CLASSES; i++) {
+		while (bc->nfree[i] > 0) {
+			struct freebuf *f = bc->free[i][--bc->nfree[i]];
+			f->next = pool.free[i];
+			pool.free[i] = f;
+			pool.nfree[i]++;
+		}
+	}
+	pthread_mutex_unlock(&pool.lock);
+}
+
+static void *
+cache_get(struct bufcache *bc, int cls)
+{
+	void *b;
+
+	bc->gets++;
+	if (bc->nfree[cls] > 0)
+		return bc->free[cls][--bc->nfree[cls]];
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.free[cls] && bc->nfree[cls] < BUFCACHE_SIZE / 2) {
+		struct freebuf *f = pool.free[cls];
+		pool.free[cls] = f->next;
+		pool.nfree[cls]--;
+		bc->free[cls][bc->nfree[cls]++] = f;
+	}
+	if (bc->nfree[cls] > 0) {
+		pthread_mutex_unlock(&pool.lock);
+		return bc->free[cls][--bc->nfree[cls]];
+	}
+
+	if (pool.cap && pool.allocated + class_size[cls] > pool.cap) {
+		pool.fails++;
+		pthread_mutex_unlock(&pool.lock);
+		bc->fails++;
+		return NULL;
+	}
+	pool.allocated += class_size[cls];
+	pthread_mutex_unlock(&pool.lock);
+
+	b = malloc(class_size[cls]);
+	if (!b) {
+		pthread_mutex_lock(&pool.lock);
+		pool.allocated -= class_size[cls];
+		pool.fails++;
+		pthread_mutex_unlock(&pool.lock);
+		bc->fails++;
+	}
+	return b;
+}
+
+static void
+cache_put(struct bufcache *bc, int cls, void *b)
+{
+	int i, half = BUFCACHE_SIZE / 2;
+
+	if (bc->nfree[cls] == BUFCACHE_SIZE) {
+		/* the coldest half goes back */
+		pthread_mutex_lock(&pool.lock);
+		for (i = 0; i < half; i++) {
+			struct freebuf *f = bc->free[cls][i];
+			f->next = pool.free[cls];
+			pool.free[cls] = f;
+			pool.nfree[cls]++;
+		}
+		pthread_mutex_unlock(&pool.lock);
+		memmove(bc->free[cls], bc->free[cls] + half, half * sizeof(void *));
+		bc->nfree[cls] = BUFCACHE_SIZE - half;
+	}
+	bc->free[cls][bc->nfree[cls]++] = b;
+}
+
+int
+buf_acquire(struct bufcache *bc, char **buf, size_t *size,
+		size_t want, size_t keep)
+{
+	int cls = class_of(want);
+	char *nb;
+
+	if (cls < 0)
+		return -1;
+	if (*buf && *size >= want)
+		return 0;
+
+	nb = cache_get(bc, cls);
+	if (!nb)
+		return -1;
+
+	if (*buf) {
+		assert(keep <= *size);
+		if (keep)
+			memcpy(nb, *buf, keep);
+		cache_put(bc, class_of(*size), *buf);
+	}
+	*buf = nb;
+	*size = class_size[cls];
+	return 0;
+}
+
+void
+buf_release(struct bufcache *bc, char **buf, size_t *size)
+{
+	if (!*buf)
+		return;
+	cache_put(bc, class_of(*size), *buf);
+	*buf = NULL;
+	*size = 0;
+}
@@ -0,0 +1,44 @@
+#ifndef BUFPOOL_H
+#define BUFPOOL_H
+
+#include <stddef.h>
+
+/* buffer size classes */
+#define BUF_CLASSES	2
+#define BUF_SMALL	4096		/* fits most request headers */
+#define BUF_MEDIUM	16384		/* IOBUFSIZE, relay and big headers */
+
+/* buffers a worker keeps per class before giving them back */
+#define BUFCACHE_SIZE	32
+
+/* per-worker magazine in front of the global pool */
+struct bufcache {
+	void		*free[BUF_CLASSES][BUFCACHE_SIZE];
+	int		nfree[BUF_CLASSES];
+	unsigned long	gets;
+	unsigned long	fails;		/* pool was at its memory cap */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* cap is a limit for all buffers of all workers, 0 for none */
+int bufpool_init(size_t cap);
+void bufpool_destroy(void);
+
+void bufcache_init(struct bufcache *bc);
+/* return cached buffers to the global pool */
+void bufcache_flush(struct bufcache *bc);
+
+/* make *buf at least want bytes, keeping the first keep bytes;
+ * returns -1 when the pool is exhausted, *buf is untouched then */
+int buf_acquire(struct bufcache *bc, char **buf, size_t *size,
+		size_t want, size_t keep);
+void buf_release(struct bufcache *bc, char **buf, size_t *size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BUFPOOL_H */
@@ -0,0 +1,696 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "util.h"
+
+#define FNV_OFFSET	0xcbf29ce484222325ULL
+#define FNV_PRIME	0x100000001b3ULL
+
+/* the table gets a bucket per this much memory, at least CACHE_MIN_BUCKETS */
+#define CACHE_BUCKET_BYTES	8192
+#define CACHE_MIN_BUCKETS	256
+
+/* longest field name in Vary */
+#define CACHE_NAME_MAX		128
+
+static uint64_t
+key_hash(const char *key, size_t len)
+{
+	uint64_t h = FNV_OFFSET;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ (unsigned char)key[i]) * FNV_PRIME;
+	return h;
+}
+
+static struct cache_obj *
+obj_find(struct cache *c, uint64_t h, const char *key, size_t keylen)
+{
+	struct cache_obj *o;
+
+	LIST_FOREACH(o, &c->table[h & c->mask], hlink)
+		if (o->hash == h && o->keylen == keylen && 0 == memcmp(o->key, key, keylen))
+			return o;
+	return NULL;
+}
+
+/* to the MRU end of a segment */
+static void
+seg_link(struct cache *c, struct cache_obj *o, int seg)
+{
+	o->seg = seg;
+	TAILQ_INSERT_HEAD(&c->lru[seg], o, lru);
+	c->segsize[seg] += o->size;
+}
+
+static void
+seg_unlink(struct cache *c, struct cache_obj *o)
+{
+	TAILQ_REMOVE(&c->lru[o->seg], o, lru);
+	c->segsize[o->seg] -= o->size;
+	o->seg = CACHE_UNLINKED;
+}
+
+/* a rewrite that is freed lets go of its original */
+static void
+obj_put(struct cache_obj *o)
+{
+	struct cache_obj *orig;
+
+	while (o && --o->refs == 0) {
+		o->cache->used -= o->size;
+		orig = o->orig;
+		free(o);
+		o = orig;
+	}
+}
+
+/* a reader of a body on disk holds its slab as well */
+void
+cache_put(struct cache_obj *o)
+{
+	if (o->slab)
+		o->slab->refs--;
+	obj_put(o);
+}
+
+/* out of the table and the LRU or the slab list, memory goes with the
+ * last sender */
+static void
+obj_unlink(struct cache *c, struct cache_obj *o)
+{
+	LIST_REMOVE(o, hlink);
+	if (o->seg == CACHE_DISK) {
+		TAILQ_REMOVE(&o->slab->objs, o, lru);
+		o->seg = CACHE_UNLINKED;
+		c->ndisk--;
+	}
+	else {
+		seg_unlink(c, o);
+		c->nobjs--;
+	}
+	obj_put(o);
+}
+
+/* a hit is protected, protected overflow goes back on probation at its
+ * hot end and gets one more chance there */
+static void
+obj_touch(struct cache *c, struct cache_obj *o)
+{
+	size_t cap = c->budget / 100 * CACHE_PROTECTED_PCT;
+	struct cache_obj *d;
+
+	seg_unlink(c, o);
+	seg_link(c, o, CACHE_PROTECTED);
+	while (c->segsize[CACHE_PROTECTED] > cap &&
+	       (d = TAILQ_LAST(&c->lru[CACHE_PROTECTED], cache_lru)) != o) {
+		seg_unlink(c, d);
+		seg_link(c, d, CACHE_PROBATION);
+	}
+}
+
+/* evict from the cold end of probation, then of protected, until size
+ * fits; memory held by fills and by objects being sent is not ours */
+static int
+cache_room(struct cache *c, size_t size)
+{
+	size_t held = c->used - c->segsize[CACHE_PROBATION] - c->segsize[CACHE_PROTECTED];
+	struct cache_obj *o;
+
+	if (held + size > c->budget)
+		return -1;
+	while (c->used + size > c->budget) {
+		if (!(o = TAILQ_LAST(&c->lru[CACHE_PROBATION], cache_lru)) &&
+		    !(o = TAILQ_LAST(&c->lru[CACHE_PROTECTED], cache_lru)))
+			return -1;
+		obj_unlink(c, o);
+		c->stats.evictions++;
+	}
+	return 0;
+}
+
+/* field names of a Vary value, lowercase one per line; -1 if too long */
+static ssize_t
+vary_names(const char *v, size_t len, char *out, size_t size)
+{
+	const char *end = v + len, *next, *f, *fe;
+	size_t n = 0;
+
+	for (; v < end; v = next + 1) {
+		if (!(next = memchr(v, ',', end - v)))
+			next = end;
+		for (f = v, fe = next; f < fe && (*f == ' ' || *f == '\t'); f++)
+			;
+		while (fe > f && (*(fe - 1) == ' ' || *(fe - 1) == '\t'))
+			fe--;
+		if (f == fe)
+			continue;
+		if (fe - f >= CACHE_NAME_MAX || n + (fe - f) + 1 > size)
+			return -1;
+		while (f < fe)
+			out[n++] = tolower((unsigned char)*f++);
+		out[n++] = '\n';
+	}
+	return n;
+}
+
+/* request values of the varied fields, a line each; a missing field is
+ * a lone CR so it differs from an empty one */
+static ssize_t
+variant_make(const char *names, size_t len, const char *buf, size_t hdrlen,
+		char *out, size_t size)
+{
+	const char *end = names + len, *nl, *v;
+	char name[CACHE_NAME_MAX];
+	size_t n = 0, vlen;
+
+	for (; names < end; names = nl + 1) {
+		nl = memchr(names, '\n', end - names);
+		memcpy(name, names, nl - names);
+		name[nl - names] = 0;
+		if (!(v = http_header(buf, hdrlen, name, &vlen))) {
+			v = "\r";
+			vlen = 1;
+		}
+		if (n + vlen + 1 > size)
+			return -1;
+		memcpy(out + n, v, vlen);
+		n += vlen;
+		out[n++] = '\n';
+	}
+	return n;
+}
+
+/* copy of a body on disk to be written elsewhere, with the reference
+ * of its link and of the job */
+static struct cache_obj *
+obj_clone(struct cache_obj *o)
+{
+	size_t len = o->keylen + o->varylen + o->variantlen + o->headlen;
+	struct cache_obj *n = malloc(sizeof(*n) + len);
+
+	if (!n)
+		return NULL;
+	memcpy(n, o, sizeof(*n) + len);
+	n->key = n->data;
+	n->vary = n->key + n->keylen;
+	n->variant = n->vary + n->varylen;
+	n->head = n->variant + n->variantlen;
+	n->refs = 2;
+	n->seg = CACHE_UNLINKED;
+	n->job = NULL;
+	n->writes = 1;
+	n->hits = 0;
+	n->failed = 0;
+	n->written = 1;
+	return n;
+}
+
+/* body written, the object goes to the table and the list of its slab;
+ * a rewrite stands in for its original only, if that is still there */
+static void
+disk_link(struct cache *c, struct cache_obj *o)
+{
+	struct cache_obj *old = obj_find(c, o->hash, o->key, o->keylen);
+
+	if (o->orig) {
+		if (old != o->orig) {
+			obj_put(o);
+			return;
+		}
+		obj_unlink(c, old);
+		obj_put(o->orig);
+		o->orig = NULL;
+		c->stats.rescued++;
+	}
+	else {
+		if (old) {
+			obj_unlink(c, old);
+			c->stats.replaced++;
+		}
+		c->stats.disk_stores++;
+	}
+	LIST_INSERT_HEAD(&c->table[o->hash & c->mask], o, hlink);
+	o->seg = CACHE_DISK;
+	TAILQ_INSERT_TAIL(&o->slab->objs, o, lru);
+	c->ndisk++;
+}
+
+/* a job is back from the writer, the last one of a complete object links it */
+static void
+disk_done(struct dstore *s, struct dwrite *w)
+{
+	struct cache_obj *o = w->obj;
+
+	o->writes--;
+	if (w->err || s->quit)
+		o->failed = 1;
+	if (o->written && !o->writes) {
+		o->written = 0;
+		if (o->failed)
+			obj_put(o);
+		else
+			disk_link(s->data, o);
+	}
+	obj_put(o);
+}
+
+/* slab is emptied, nobody reads it */
+static void
+disk_recycle(struct dstore *s, struct dslab *slab)
+{
+	struct cache *c = s->data;
+	struct cache_obj *o;
+
+	while ((o = TAILQ_FIRST(&slab->objs))) {
+		obj_unlink(c, o);
+		c->stats.disk_evictions++;
+	}
+}
+
+/* objects of the slab to be emptied next that were hit since they were
+ * stored are copied to the current one, up to a share of it */
+static void
+disk_rescue(struct cache *c, struct dslab *victim, time_t now)
+{
+	struct dstore *s = c->disk;
+	size_t room = s->slabsize / CACHE_RESCUE_SHARE;
+	struct cache_obj *o, *n;
+	struct dwrite *w;
+
+	TAILQ_FOREACH(o, &victim->objs, lru) {
+		if (!o->hits || o->expires <= now || o->bodylen > room ||
+		    s->slabs[s->cur].used + o->bodylen > s->slabsize)
+			continue;
+		if (!(w = dstore_job(s, 0)))
+			break;
+		if (!(n = obj_clone(o))) {
+			dstore_drop(s, w);
+			break;
+		}
+		/* fits the current slab, so it doesn't move on */
+		dstore_alloc(s, o->bodylen, &n->slab, &n->off);
+		room -= o->bodylen;
+		n->orig = o;
+		o->refs++;
+		w->slab = n->slab;
+		w->off = n->off;
+		w->len = o->bodylen;
+		w->src = o->slab;
+		w->srcoff = o->off;
+		w->obj = n;
+		dstore_submit(s, w);
+	}
+}
+
+/* the bytes up to a whole job go to the writer */
+static void
+disk_queue(struct cache *c, struct cache_obj *o)
+{
+	o->refs++;
+	o->writes++;
+	dstore_submit(c->disk, o->job);
+	o->job = NULL;
+}
+
+static void
+disk_fill(struct cache_obj *o, const char *p, size_t len)
+{
+	struct cache *c = o->cache;
+	struct dwrite *w;
+	size_t k;
+
+	while (len > 0 && !o->failed) {
+		if (!(w = o->job)) {
+			k = o->bodylen - o->filled;
+			if (!(w = dstore_job(c->disk, k < DSTORE_CHUNK ? k : DSTORE_CHUNK))) {
+				o->failed = 1;
+				break;
+			}
+			w->slab = o->slab;
+			w->off = o->off + o->filled;
+			w->obj = o;
+			o->job = w;
+		}
+		k = w->size - w->len < len ? w->size - w->len : len;
+		memcpy(w->data + w->len, p, k);
+		w->len += k;
+		o->filled += k;
+		p += k;
+		len -= k;
+		if (w->len == w->size)
+			disk_queue(c, o);
+	}
+}
+
+/* the fill held the slab, its writes hold it from now on */
+static void
+disk_fill_done(struct cache *c, struct cache_obj *o)
+{
+	o->slab->refs--;
+	if (o->job) {
+		dstore_drop(c->disk, o->job);
+		o->job = NULL;
+	}
+	if (o->failed || o->filled < o->bodylen) {
+		if (o->failed)
+			c->stats.disk_skipped++;
+		obj_put(o);
+		return;
+	}
+	o->written = 1;
+	if (!o->writes) {
+		o->written = 0;
+		disk_link(c, o);
+	}
+}
+
+static int
+table_init(struct cache *c, size_t nobjs)
+{
+	size_t n = CACHE_MIN_BUCKETS, i;
+
+	while (n < nobjs)
+		n <<= 1;
+	if (!(c->table = malloc(n * sizeof(*c->table))))
+		return -1;
+	for (i = 0; i < n; i++)
+		LIST_INIT(&c->table[i]);
+	c->mask = n - 1;
+	return 0;
+}
+
+int
+cache_init(struct cache *c, size_t budget)
+{
+	int i;
+
+	memset(c, 0, sizeof(*c));
+	for (i = 0; i < CACHE_SEGMENTS; i++)
+		TAILQ_INIT(&c->lru[i]);
+	if (!budget)
+		return 0;
+	if (table_init(c, budget / CACHE_BUCKET_BYTES) < 0)
+		return -1;
+	c->budget = budget;
+	c->objmax = budget / CACHE_OBJ_SHARE;
+	return 0;
+}
+
+int
+cache_disk_init(EV_P_ struct cache *c, const struct cache_diskconf *conf,
+		int id, int nworkers)
+{
+	size_t size = conf->size / nworkers;
+	int nslabs = size / conf->slab;
+
+	if (!conf->dir)
+		return 0;
+	if (nslabs < 2) {
+		wrlog(L_CRITICAL, "Cache disk size %zu MB is under 2 slabs a worker",
+			conf->size >> 20);
+		return -1;
+	}
+	if (!c->table && table_init(c, size / conf->minobj) < 0)
+		return -1;
+	if (!(c->disk = malloc(sizeof(*c->disk))))
+		return -1;
+	if (dstore_init(EV_A_ c->disk, conf->dir, id, nslabs, conf->slab) < 0) {
+		free(c->disk);
+		c->disk = NULL;
+		return -1;
+	}
+	c->disk->complete = disk_done;
+	c->disk->recycle = disk_recycle;
+	c->disk->data = c;
+	c->diskmin = conf->minobj;
+	c->diskmax = conf->maxobj;
+	c->evict = conf->evict;
+	return 0;
+}
+
+/* disk objects go first, the writes still out come back failed */
+void
+cache_destroy(struct cache *c)
+{
+	struct cache_obj *o;
+	int i;
+
+	if (c->disk) {
+		for (i = 0; i < c->disk->nslabs; i++)
+			disk_recycle(c->disk, &c->disk->slabs[i]);
+		dstore_destroy(c->disk);
+		free(c->disk);
+		c->disk = NULL;
+	}
+	for (i = 0; i < CACHE_SEGMENTS; i++)
+		while ((o = TAILQ_FIRST(&c->lru[i])))
+			obj_unlink(c, o);
+	free(c->table);
+	c->table = NULL;
+	c->budget = 0;
+}
+
+void
+cache_diskconf_init(struct cache_diskconf *conf)
+{
+	memset(conf, 0, sizeof(*conf));
+	conf->size = (size_t)CACHE_DISK_SIZE << 20;
+	conf->slab = (size_t)CACHE_SLAB_SIZE << 20;
+	conf->minobj = (size_t)CACHE_DISK_MIN << 10;
+	conf->evict = CACHE_EVICT_HOT;
+}
+
+int
+cache_diskconf_same(const struct cache_diskconf *a, const struct cache_diskconf *b)
+{
+	if (!a->dir != !b->dir || (a->dir && strcmp(a->dir, b->dir)))
+		return 0;
+	return !a->dir || (a->size == b->size && a->slab == b->slab &&
+		a->minobj == b->minobj && a->maxobj == b->maxobj && a->evict == b->evict);
+}
+
+int
+cache_request(const char *buf, const struct http_req *req)
+{
+	struct http_cache ci;
+
+	if (!req->is_head &&
+	    (req->method.len != 3 || memcmp(buf + req->method.off, "GET", 3)))
+		return CACHE_BYPASS;
+	http_cache_info(buf, req->hdrlen, &ci);
+	if (ci.flags & (HTTP_CC_NO_STORE | HTTP_CC_AUTH))
+		return CACHE_BYPASS;
+	if ((ci.flags & HTTP_CC_NO_CACHE) || ci.maxage == 0)
+		return CACHE_STORE;
+	return CACHE_LOOKUP;
+}
+
+ssize_t
+cache_key(const char *buf, const struct http_req *req, char *key, size_t size)
+{
+	const char *path = req->path.len ? buf + req->path.off : "/";
+	size_t plen = req->path.len ? req->path.len : 1, i;
+	int n;
+
+	/* host, colon, port and the path */
+	if (req->host.len + 7 + plen > size)
+		return -1;
+	for (i = 0; i < req->host.len; i++)
+		key[i] = tolower((unsigned char)buf[req->host.off + i]);
+	n = i + sprintf(key + i, ":%d", req->port);
+	memcpy(key + n, path, plen);
+	return n + plen;
+}
+
+struct cache_obj *
+cache_lookup(struct cache *c, const char *key, size_t keylen,
+		const char *buf, size_t hdrlen, time_t now)
+{
+	char variant[CACHE_VARIANT_MAX];
+	struct cache_obj *o;
+	ssize_t n;
+
+	if (!(o = obj_find(c, key_hash(key, keylen), key, keylen)))
+		return NULL;
+	if (now >= o->expires) {
+		obj_unlink(c, o);
+		c->stats.expired++;
+		return NULL;
+	}
+	if (o->varylen) {
+		n = variant_make(o->vary, o->varylen, buf, hdrlen, variant, sizeof(variant));
+		if (n < 0 || (size_t)n != o->variantlen || memcmp(variant, o->variant, n))
+			return NULL;
+	}
+	if (o->seg == CACHE_DISK) {
+		o->hits++;
+		o->slab->refs++;
+		c->stats.disk_hits++;
+	}
+	else
+		obj_touch(c, o);
+	o->refs++;
+	return o;
+}
+
+struct cache_req *
+cache_req_new(const char *key, size_t keylen, const char *buf, size_t hdrlen)
+{
+	struct cache_req *cr = malloc(sizeof(*cr) + keylen + hdrlen);
+
+	if (!cr)
+		return NULL;
+	cr->hash = key_hash(key, keylen);
+	cr->keylen = keylen;
+	cr->headlen = hdrlen;
+	memcpy(cr->data, key, keylen);
+	memcpy(cr->data + keylen, buf, hdrlen);
+	return cr;
+}
+
+struct cache_obj *
+cache_fill_start(struct cache *c, const struct cache_req *cr,
+		const struct http_resp *resp, const char *buf, time_t now)
+{
+	char vary[CACHE_VARIANT_MAX], variant[CACHE_VARIANT_MAX];
+	ssize_t varylen = 0, variantlen = 0;
+	struct http_cache ci;
+	struct dslab *slab = NULL;
+	struct cache_obj *o;
+	int64_t lifetime, age;
+	size_t size;
+	off_t off = 0;
+	char *p;
+	int r;
+
+	if (resp->status != 200 || resp->clen < 0 || (resp->flags & HTTP_F_TE))
+		return NULL;
+	http_cache_info(buf, resp->hdrlen, &ci);
+	if (ci.flags & (HTTP_CC_NO_STORE | HTTP_CC_NO_CACHE | HTTP_CC_PRIVATE |
+			HTTP_CC_VARY_ANY | HTTP_CC_COOKIE))
+		return NULL;
+
+	/* explicit freshness only, none is guessed from Last-Modified */
+	if (ci.maxage >= 0)
+		lifetime = ci.maxage;
+	else if (ci.expires >= 0)
+		lifetime = ci.expires - (ci.date >= 0 ? ci.date : now);
+	else
+		return NULL;
+	age = ci.age;
+	if (ci.date >= 0 && now - ci.date > age)
+		age = now - ci.date;
+	if (lifetime <= age)
+		return NULL;
+
+	if (ci.vary) {
+		varylen = vary_names(ci.vary, ci.varylen, vary, sizeof(vary));
+		if (varylen < 0)
+			return NULL;
+		variantlen = variant_make(vary, varylen, cr->data + cr->keylen, cr->headlen,
+			variant, sizeof(variant));
+		if (variantlen < 0)
+			return NULL;
+	}
+
+	size = sizeof(*o) + cr->keylen + varylen + variantlen + resp->hdrlen;
+	if (c->disk && (size_t)resp->clen >= c->diskmin && (size_t)resp->clen <= c->diskmax) {
+		/* a body on disk is not charged against the memory */
+		r = dstore_alloc(c->disk, resp->clen, &slab, &off);
+		if (r == 1 && c->evict == CACHE_EVICT_HOT)
+			disk_rescue(c, dstore_next(c->disk), now);
+		if (r < 0 || !(o = malloc(size))) {
+			c->stats.disk_skipped++;
+			return NULL;
+		}
+		slab->refs++;
+		size = 0;
+	}
+	else {
+		size += resp->clen;
+		if (size > c->objmax || cache_room(c, size) < 0 || !(o = malloc(size))) {
+			c->stats.skipped++;
+			return NULL;
+		}
+	}
+	c->used += size;
+	o->cache = c;
+	o->hash = cr->hash;
+	o->stored = now;
+	o->expires = now + lifetime - age;
+	o->age = age;
+	o->size = size;
+	o->refs = 1;
+	o->seg = CACHE_UNLINKED;
+
+	p = o->data;
+	o->key = p;
+	o->keylen = cr->keylen;
+	memcpy(p, cr->data, cr->keylen);
+	p += cr->keylen;
+	o->vary = p;
+	o->varylen = varylen;
+	memcpy(p, vary, varylen);
+	p += varylen;
+	o->variant = p;
+	o->variantlen = variantlen;
+	memcpy(p, variant, variantlen);
+	p += variantlen;
+	o->head = p;
+	o->headlen = http_copy_head(buf, resp->hdrlen, p);
+	o->body = slab ? NULL : p + resp->hdrlen;
+	o->bodylen = resp->clen;
+	o->filled = 0;
+	o->slab = slab;
+	o->off = off;
+	o->job = NULL;
+	o->writes = 0;
+	o->hits = 0;
+	o->failed = 0;
+	o->written = 0;
+	o->orig = NULL;
+	return o;
+}
+
+void
+cache_fill(struct cache_obj *o, const char *p, size_t len)
+{
+	if (len > o->bodylen - o->filled)
+		len = o->bodylen - o->filled;
+	if (o->slab) {
+		disk_fill(o, p, len);
+		return;
+	}
+	memcpy(o->body + o->filled, p, len);
+	o->filled += len;
+}
+
+void
+cache_fill_done(struct cache_obj *o)
+{
+	struct cache *c = o->cache;
+	struct cache_obj *old;
+
+	if (o->slab) {
+		disk_fill_done(c, o);
+		return;
+	}
+	if (o->filled < o->bodylen) {
+		obj_put(o);
+		return;
+	}
+	/* one variant per key, the newest */
+	if ((old = obj_find(c, o->hash, o->key, o->keylen))) {
+		obj_unlink(c, old);
+		c->stats.replaced++;
+	}
+	LIST_INSERT_HEAD(&c->table[o->hash & c->mask], o, hlink);
+	seg_link(c, o, CACHE_PROBATION);
+	c->nobjs++;
+	c->stats.stores++;
+}
@@ -0,0 +1,192 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "queue.h"
+#include "http.h"
+#include "dstore.h"
+
+/* longest key, host:port and the path */
+#define CACHE_KEY_MAX		2048
+/* longest set of request header values a response varies on */
+#define CACHE_VARIANT_MAX	1024
+/* share of the memory for objects hit more than once */
+#define CACHE_PROTECTED_PCT	80
+/* biggest object is this part of the memory of a worker */
+#define CACHE_OBJ_SHARE		8
+
+/* disk tier defaults */
+#define CACHE_DISK_SIZE		1024	/* MB, all workers */
+#define CACHE_SLAB_SIZE		64	/* MB */
+#define CACHE_DISK_MIN		256	/* KB */
+/* hot objects rewritten ahead of their slab being emptied, at most
+ * this part of the slab they go to */
+#define CACHE_RESCUE_SHARE	4
+
+/* what happens to the objects of a slab being emptied */
+#define CACHE_EVICT_FIFO	0	/* all go */
+#define CACHE_EVICT_HOT		1	/* those hit since stored move on first */
+
+/* disk tier as the config file sets it, read at start only */
+struct cache_diskconf {
+	char		*dir;		/* NULL - memory only */
+	size_t		size;		/* of all workers */
+	size_t		slab;
+	size_t		minobj;		/* smaller ones stay in memory */
+	size_t		maxobj;
+	int		evict;
+};
+
+/* what a request may do with the cache */
+#define CACHE_BYPASS	0	/* neither look up nor store */
+#define CACHE_STORE	1	/* asked for a fresh response, store it */
+#define CACHE_LOOKUP	2
+
+/* segments of the LRU: objects come in on probation and are protected
+ * once hit, so a run of objects asked for once only churns probation
+ * and never pushes out the hot ones */
+enum {
+	CACHE_PROBATION,
+	CACHE_PROTECTED,
+	CACHE_SEGMENTS,
+	CACHE_UNLINKED = CACHE_SEGMENTS,	/* filling, or evicted and still sent */
+	CACHE_DISK			/* listed by its slab instead */
+};
+
+struct cache;
+
+/* response in memory: head as received minus hop-by-hop headers, Age
+ * and the empty line, then the body; sent as it is, the connection
+ * adds the rest of the head.  Held by the cache while linked, by every
+ * connection sending it and by its disk writes, freed with the last
+ * reference.  A large body is in a slab file instead, the object is
+ * linked only once all of it is written */
+struct cache_obj {
+	LIST_ENTRY(cache_obj) hlink;
+	TAILQ_ENTRY(cache_obj) lru;
+	struct cache	*cache;
+	uint64_t	hash;
+	time_t		stored;
+	time_t		expires;
+	int64_t		age;		/* when stored */
+	size_t		size;		/* charged against the memory */
+	int		refs;
+	int		seg;
+	char		*key;
+	size_t		keylen;
+	char		*vary;		/* field names, lowercase, one per line */
+	size_t		varylen;
+	char		*variant;	/* request values of them */
+	size_t		variantlen;
+	char		*head;
+	size_t		headlen;
+	char		*body;
+	size_t		bodylen;
+	size_t		filled;		/* body bytes in so far */
+	struct dslab	*slab;		/* body is in it, NULL - in memory */
+	off_t		off;
+	struct dwrite	*job;		/* body bytes not queued yet */
+	int		writes;		/* jobs in flight */
+	unsigned	hits;		/* since stored */
+	unsigned	failed:1;	/* a write failed or was refused */
+	unsigned	written:1;	/* complete, waits for its writes */
+	struct cache_obj *orig;		/* rewritten from it */
+	char		data[];
+};
+
+/* request of a miss, kept until the response head is in */
+struct cache_req {
+	uint64_t	hash;
+	size_t		keylen;
+	size_t		headlen;	/* request head for Vary */
+	char		data[];		/* key, then head */
+};
+
+struct cache_stats {
+	unsigned long	stores;
+	unsigned long	evictions;	/* to make room */
+	unsigned long	expired;
+	unsigned long	replaced;	/* by a newer response */
+	unsigned long	skipped;	/* too big, or all memory in use */
+	unsigned long	disk_hits;
+	unsigned long	disk_stores;
+	unsigned long	disk_evictions;	/* with their slab */
+	unsigned long	rescued;	/* rewritten ahead of it */
+	unsigned long	disk_skipped;	/* no room, or the writer behind */
+};
+
+/* per-worker response cache, nothing is shared between workers */
+struct cache {
+	LIST_HEAD(cache_bucket, cache_obj) *table;
+	size_t		mask;
+	TAILQ_HEAD(cache_lru, cache_obj) lru[CACHE_SEGMENTS];	/* MRU first */
+	size_t		segsize[CACHE_SEGMENTS];
+	size_t		nobjs;
+	size_t		budget;		/* 0 - off */
+	size_t		used;		/* objects alive, linked or not */
+	size_t		objmax;
+	struct dstore	*disk;		/* large objects, NULL - none */
+	size_t		diskmin;
+	size_t		diskmax;
+	int		evict;
+	size_t		ndisk;		/* objects linked in it */
+	struct cache_stats stats;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* budget 0 leaves the memory tier off */
+int cache_init(struct cache *c, size_t budget);
+void cache_destroy(struct cache *c);
+
+/* slab files of the worker id out of nworkers in conf->dir */
+int cache_disk_init(EV_P_ struct cache *c, const struct cache_diskconf *conf,
+		int id, int nworkers);
+
+/* whether a worker has a cache at all */
+static inline int
+cache_enabled(const struct cache *c)
+{
+	return c->table != NULL;
+}
+
+void cache_diskconf_init(struct cache_diskconf *conf);
+int cache_diskconf_same(const struct cache_diskconf *a, const struct cache_diskconf *b);
+
+/* CACHE_* for a GET or HEAD by its head, whose body framing is already
+ * known to be empty */
+int cache_request(const char *buf, const struct http_req *req);
+
+/* key of the request into key, its length or -1 if it doesn't fit */
+ssize_t cache_key(const char *buf, const struct http_req *req, char *key, size_t size);
+
+/* fresh response to the request with head buf, referenced, or NULL;
+ * an expired one is dropped on the way */
+struct cache_obj *cache_lookup(struct cache *c, const char *key, size_t keylen,
+		const char *buf, size_t hdrlen, time_t now);
+
+/* key and request head of a miss, NULL on no memory */
+struct cache_req *cache_req_new(const char *key, size_t keylen,
+		const char *buf, size_t hdrlen);
+
+/* object for the response head in buf to the request, NULL if it may not
+ * or can't be stored; the body is then passed to cache_fill() and the
+ * object goes to the cache with cache_fill_done() if it is complete */
+struct cache_obj *cache_fill_start(struct cache *c, const struct cache_req *cr,
+		const struct http_resp *resp, const char *buf, time_t now);
+void cache_fill(struct cache_obj *o, const char *p, size_t len);
+void cache_fill_done(struct cache_obj *o);
+
+/* drop a reference from cache_lookup() */
+void cache_put(struct cache_obj *o);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CACHE_H */
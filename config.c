@@ -0,0 +1,465 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#include "util.h"
+#include "config.h"
+
+/* config file is line based: "directive arg...", '#' starts a comment
+ *
+ *	block example.com		the name only
+ *	block *.example.com		names below it
+ *	block .example.com		both
+ *	block-file /path/to/list	one rule per line, hosts file format
+ *					("0.0.0.0 name") is accepted too
+ *	url /ads/			request target substring
+ *	url-file /path/to/list		one substring per line
+ *	regex-url \.exe$		regular expression on the request target
+ *	regex-header ^User-Agent:\s*evil	and on every "Name: value" line
+ *	regex-cache 1024		lazy DFA cache per worker and rule kind, KB
+ *	allow 10.0.0.0/8		clients, the longest matching prefix wins
+ *	deny 10.1.2.3
+ *	allow-file, deny-file <path>	one prefix per line
+ *	acl-default allow|deny		for clients no prefix covers
+ *	cache-dir /var/cache/sfp	slab files of large cached objects
+ *	cache-disk-size 1024		of all workers, MB
+ *	cache-slab-size 64		MB, the unit the disk is emptied in
+ *	cache-disk-min 256		smaller objects stay in memory, KB
+ *	cache-disk-max 64		bigger ones aren't cached, MB [= slab]
+ *	cache-evict fifo|hot		a slab being emptied drops all its
+ *					objects, or moves those hit on first
+ *
+ * the cache-* ones are read at start only, -R sets the memory for the
+ * smaller objects
+ *
+ * arguments can't have spaces, \s or \x20 do in expressions; '#' starts
+ * a comment only at the beginning of a word
+ */
+
+typedef int (*directive_fn)(struct config *cfg, char **argv, const char *file, int line);
+
+struct directive {
+	const char	*name;
+	int		nargs;
+	directive_fn	fn;
+};
+
+/* split line into whitespace separated words, returns their number or
+ * -1 if there are too many */
+static int
+split(char *s, char **argv, int max)
+{
+	int n = 0;
+	char *p;
+
+	for (p = s; *p; p++)
+		if (*p == '#' && (p == s || p[-1] == ' ' || p[-1] == '\t')) {
+			*p = 0;
+			break;
+		}
+	for (p = strtok(s, " \t\r\n"); p; p = strtok(NULL, " \t\r\n")) {
+		if (n == max)
+			return -1;
+		argv[n++] = p;
+	}
+	return n;
+}
+
+static int
+cf_block(struct config *cfg, char **argv, const char *file, int line)
+{
+	if (hostfilter_add(&cfg->hosts, argv[1]) < 0) {
+		wrlog(L_ERROR, "%s:%d: bad host rule '%s'", file, line, argv[1]);
+		return -1;
+	}
+	return 0;
+}
+
+/* big third party lists often have junk, it is skipped with a warning */
+static int
+cf_block_file(struct config *cfg, char **argv, const char *file, int line)
+{
+	FILE *fp = fopen(argv[1], "r");
+	char *buf = NULL, *words[2];
+	size_t size = 0;
+	unsigned long bad = 0, n = 0;
+	struct in_addr ip;
+	int nw;
+
+	if (!fp) {
+		wrlog(L_ERROR, "%s:%d: can't open '%s': %s", file, line,
+			argv[1], strerror(errno));
+		return -1;
+	}
+	while (getline(&buf, &size, fp) > 0) {
+		nw = split(buf, words, 2);
+		if (nw == 0)
+			continue;
+		if (nw == 2 && inet_aton(words[0], &ip))
+			words[0] = words[1];
+		else if (nw != 1) {
+			bad++;
+			continue;
+		}
+		if (hostfilter_add(&cfg->hosts, words[0]) < 0)
+			bad++;
+		else
+			n++;
+	}
+	free(buf);
+	fclose(fp);
+	if (bad)
+		wrlog(L_WARNING, "%s: %lu bad lines skipped", argv[1], bad);
+	wrlog(L_NOTICE, "%s: %lu host rules", argv[1], n);
+	return 0;
+}
+
+static int
+cf_url(struct config *cfg, char **argv, const char *file, int line)
+{
+	if (urlfilter_add(&cfg->urls, argv[1]) < 0) {
+		wrlog(L_ERROR, "%s:%d: can't add url rule '%s'", file, line, argv[1]);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+cf_url_file(struct config *cfg, char **argv, const char *file, int line)
+{
+	FILE *fp = fopen(argv[1], "r");
+	char *buf = NULL, *words[1];
+	size_t size = 0;
+	int rc = 0;
+
+	if (!fp) {
+		wrlog(L_ERROR, "%s:%d: can't open '%s': %s", file, line,
+			argv[1], strerror(errno));
+		return -1;
+	}
+	while (rc == 0 && getline(&buf, &size, fp) > 0) {
+		if (split(buf, words, 1) != 1)
+			continue;
+		if ((rc = urlfilter_add(&cfg->urls, words[0])) < 0)
+			wrlog(L_ERROR, "%s: can't add url rule '%s'", argv[1], words[0]);
+	}
+	free(buf);
+	fclose(fp);
+	return rc;
+}
+
+static int
+cf_regex(struct rxprog *p, const char *re, const char *file, int line)
+{
+	char err[64];
+
+	if (rxprog_add(p, re, err, sizeof(err)) < 0) {
+		wrlog(L_ERROR, "%s:%d: bad regex '%s': %s", file, line, re, err);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+cf_regex_url(struct config *cfg, char **argv, const char *file, int line)
+{
+	return cf_regex(&cfg->rxurl, argv[1], file, line);
+}
+
+static int
+cf_regex_header(struct config *cfg, char **argv, const char *file, int line)
+{
+	return cf_regex(&cfg->rxhdr, argv[1], file, line);
+}
+
+static int
+cf_regex_cache(struct config *cfg, char **argv, const char *file, int line)
+{
+	int kb = atoi(argv[1]);
+
+	if (kb <= 0) {
+		wrlog(L_ERROR, "%s:%d: bad regex cache size '%s'", file, line, argv[1]);
+		return -1;
+	}
+	cfg->rxurl.cachemax = cfg->rxhdr.cachemax = (size_t)kb << 10;
+	return 0;
+}
+
+static int
+cf_acl(struct config *cfg, const char *cidr, int verdict, const char *file, int line)
+{
+	if (acl_add(&cfg->acl, cidr, verdict) < 0) {
+		wrlog(L_ERROR, "%s:%d: bad address prefix '%s'", file, line, cidr);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+cf_acl_file(struct config *cfg, const char *path, int verdict, const char *file, int line)
+{
+	FILE *fp = fopen(path, "r");
+	char *buf = NULL, *words[1];
+	size_t size = 0;
+	int rc = 0, n = 0;
+
+	if (!fp) {
+		wrlog(L_ERROR, "%s:%d: can't open '%s': %s", file, line, path, strerror(errno));
+		return -1;
+	}
+	while (rc == 0 && getline(&buf, &size, fp) > 0) {
+		n++;
+		if (split(buf, words, 1) == 1)
+			rc = cf_acl(cfg, words[0], verdict, path, n);
+	}
+	free(buf);
+	fclose(fp);
+	return rc;
+}
+
+static int
+cf_allow(struct config *cfg, char **argv, const char *file, int line)
+{
+	return cf_acl(cfg, argv[1], ACL_ALLOW, file, line);
+}
+
+static int
+cf_deny(struct config *cfg, char **argv, const char *file, int line)
+{
+	return cf_acl(cfg, argv[1], ACL_DENY, file, line);
+}
+
+static int
+cf_allow_file(struct config *cfg, char **argv, const char *file, int line)
+{
+	return cf_acl_file(cfg, argv[1], ACL_ALLOW, file, line);
+}
+
+static int
+cf_deny_file(struct config *cfg, char **argv, const char *file, int line)
+{
+	return cf_acl_file(cfg, argv[1], ACL_DENY, file, line);
+}
+
+static int
+cf_acl_default(struct config *cfg, char **argv, const char *file, int line)
+{
+	if (strcmp(argv[1], "allow") == 0)
+		cfg->acl.deflt = ACL_ALLOW;
+	else if (strcmp(argv[1], "deny") == 0)
+		cfg->acl.deflt = ACL_DENY;
+	else {
+		wrlog(L_ERROR, "%s:%d: acl-default is allow or deny", file, line);
+		return -1;
+	}
+	return 0;
+}
+
+static int
+cf_cache_dir(struct config *cfg, char **argv, const char *file, int line)
+{
+	free(cfg->disk.dir);
+	if (!(cfg->disk.dir = strdup(argv[1]))) {
+		wrlog(L_ERROR, "%s:%d: out of memory", file, line);
+		return -1;
+	}
+	return 0;
+}
+
+/* positive size in units of 1 << shift */
+static int
+cf_size(size_t *size, int shift, char **argv, const char *file, int line)
+{
+	long n = atol(argv[1]);
+
+	if (n <= 0) {
+		wrlog(L_ERROR, "%s:%d: bad %s '%s'", file, line, argv[0], argv[1]);
+		return -1;
+	}
+	*size = (size_t)n << shift;
+	return 0;
+}
+
+static int
+cf_cache_disk_size(struct config *cfg, char **argv, const char *file, int line)
+{
+	return cf_size(&cfg->disk.size, 20, argv, file, line);
+}
+
+static int
+cf_cache_slab_size(struct config *cfg, char **argv, const char *file, int line)
+{
+	return cf_size(&cfg->disk.slab, 20, argv, file, line);
+}
+
+static int
+cf_cache_disk_min(struct config *cfg, char **argv, const char *file, int line)
+{
+	return cf_size(&cfg->disk.minobj, 10, argv, file, line);
+}
+
+static int
+cf_cache_disk_max(struct config *cfg, char **argv, const char *file, int line)
+{
+	return cf_size(&cfg->disk.maxobj, 20, argv, file, line);
+}
+
+static int
+cf_cache_evict(struct config *cfg, char **argv, const char *file, int line)
+{
+	if (strcmp(argv[1], "fifo") == 0)
+		cfg->disk.evict = CACHE_EVICT_FIFO;
+	else if (strcmp(argv[1], "hot") == 0)
+		cfg->disk.evict = CACHE_EVICT_HOT;
+	else {
+		wrlog(L_ERROR, "%s:%d: cache-evict is fifo or hot", file, line);
+		return -1;
+	}
+	return 0;
+}
+
+/* an object is never bigger than a slab */
+static int
+cache_check(struct config *cfg)
+{
+	struct cache_diskconf *d = &cfg->disk;
+
+	if (!d->dir)
+		return 0;
+	if (!d->maxobj)
+		d->maxobj = d->slab;
+	if (d->minobj > d->maxobj || d->maxobj > d->slab) {
+		wrlog(L_ERROR, "%s: cache-disk-min <= cache-disk-max <= cache-slab-size",
+			cfg->path);
+		return -1;
+	}
+	return 0;
+}
+
+static const struct directive directives[] = {
+	{ "block",	1,	cf_block },
+	{ "block-file",	1,	cf_block_file },
+	{ "url",	1,	cf_url },
+	{ "url-file",	1,	cf_url_file },
+	{ "regex-url",	1,	cf_regex_url },
+	{ "regex-header", 1,	cf_regex_header },
+	{ "regex-cache", 1,	cf_regex_cache },
+	{ "allow",	1,	cf_allow },
+	{ "deny",	1,	cf_deny },
+	{ "allow-file",	1,	cf_allow_file },
+	{ "deny-file",	1,	cf_deny_file },
+	{ "acl-default", 1,	cf_acl_default },
+	{ "cache-dir",	1,	cf_cache_dir },
+	{ "cache-disk-size", 1,	cf_cache_disk_size },
+	{ "cache-slab-size", 1,	cf_cache_slab_size },
+	{ "cache-disk-min", 1,	cf_cache_disk_min },
+	{ "cache-disk-max", 1,	cf_cache_disk_max },
+	{ "cache-evict", 1,	cf_cache_evict },
+	{ NULL,		0,	NULL }
+};
+
+static int
+config_line(struct config *cfg, char *s, const char *file, int line)
+{
+	const struct directive *d;
+	char *argv[CONFIG_MAX_ARGS];
+	int argc = split(s, argv, CONFIG_MAX_ARGS);
+
+	if (argc == 0)
+		return 0;
+	if (argc < 0) {
+		wrlog(L_ERROR, "%s:%d: too many arguments", file, line);
+		return -1;
+	}
+	for (d = directives; d->name; d++) {
+		if (strcmp(d->name, argv[0]) != 0)
+			continue;
+		if (argc - 1 != d->nargs) {
+			wrlog(L_ERROR, "%s:%d: '%s' needs %d argument(s)", file, line,
+				d->name, d->nargs);
+			return -1;
+		}
+		return d->fn(cfg, argv, file, line);
+	}
+	wrlog(L_ERROR, "%s:%d: unknown directive '%s'", file, line, argv[0]);
+	return -1;
+}
+
+static void config_free(struct config *cfg);
+
+struct config *
+config_load(const char *path, int nworkers)
+{
+	struct config *cfg;
+	FILE *fp;
+	char *buf = NULL;
+	size_t size = 0;
+	int line = 0, rc = 0;
+
+	if (!(fp = fopen(path, "r"))) {
+		wrlog(L_ERROR, "Can't open config '%s': %s", path, strerror(errno));
+		return NULL;
+	}
+	cfg = calloc(1, sizeof(*cfg));
+	if (!cfg || !(cfg->path = strdup(path)) || acl_init(&cfg->acl) < 0 ||
+	    hostfilter_init(&cfg->hosts) < 0 ||
+	    urlfilter_init(&cfg->urls) < 0 || rxprog_init(&cfg->rxurl) < 0 ||
+	    rxprog_init(&cfg->rxhdr) < 0) {
+		wrlog(L_ERROR, "Config alloc error");
+		config_free(cfg);
+		fclose(fp);
+		return NULL;
+	}
+	cache_diskconf_init(&cfg->disk);
+
+	while (rc == 0 && getline(&buf, &size, fp) > 0)
+		rc = config_line(cfg, buf, path, ++line);
+	free(buf);
+	fclose(fp);
+
+	if (rc == 0)
+		rc = cache_check(cfg);
+	if (rc == 0 && (acl_compile(&cfg->acl) < 0 || urlfilter_compile(&cfg->urls, nworkers) < 0 ||
+	    rxprog_compile(&cfg->rxurl) < 0 || rxprog_compile(&cfg->rxhdr) < 0)) {
+		wrlog(L_ERROR, "Can't compile rules, out of memory");
+		rc = -1;
+	}
+	if (rc < 0) {
+		config_free(cfg);
+		return NULL;
+	}
+	cfg->refs = 1;
+	return cfg;
+}
+
+static void
+config_free(struct config *cfg)
+{
+	if (!cfg)
+		return;
+	acl_free(&cfg->acl);
+	hostfilter_free(&cfg->hosts);
+	urlfilter_free(&cfg->urls);
+	rxprog_free(&cfg->rxurl);
+	rxprog_free(&cfg->rxhdr);
+	free(cfg->disk.dir);
+	free(cfg->path);
+	free(cfg);
+}
+
+struct config *
+config_ref(struct config *cfg)
+{
+	if (cfg)
+		__atomic_add_fetch(&cfg->refs, 1, __ATOMIC_RELAXED);
+	return cfg;
+}
+
+void
+config_unref(struct config *cfg)
+{
+	if (cfg && __atomic_sub_fetch(&cfg->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		config_free(cfg);
+}
@@ -0,0 +1,42 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "hostfilter.h"
+#include "urlfilter.h"
+#include "rxfilter.h"
+#include "acl.h"
+#include "cache.h"
+
+#define CONFIG_MAX_ARGS	8
+
+/* everything read from the config file, built before it is used and
+ * read-only afterwards, hit counters aside; a reload builds a new one
+ * and the old one lives on until the last reference is dropped */
+struct config {
+	char		*path;
+	int		refs;
+	struct acl	acl;		/* client addresses */
+	struct hostfilter hosts;	/* blocked hosts */
+	struct urlfilter urls;		/* blocked request target substrings */
+	struct rxprog	rxurl;		/* regex rules for the request target */
+	struct rxprog	rxhdr;		/* and for every header line */
+	struct cache_diskconf disk;	/* cache of large objects, at start only */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* NULL on error, reason is logged; the caller holds the only reference;
+ * rule hits are counted apart for each of nworkers */
+struct config *config_load(const char *path, int nworkers);
+
+/* references may be taken and dropped by any thread, the last one frees */
+struct config *config_ref(struct config *cfg);
+void config_unref(struct config *cfg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONFIG_H */
@@ -0,0 +1,82 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sfp.h"
+#include "connpool.h"
+
+struct connslab {
+	struct connslab	*next;
+	struct connect	conns[CONNPOOL_SLAB_SIZE];
+};
+
+/* malloc'ed, not zeroed: a connect is cleared when handed out */
+static int
+connpool_grow(struct connpool *p)
+{
+	struct connslab *s = malloc(sizeof(*s));
+	int i;
+
+	if (!s)
+		return -1;
+
+	s->next = p->slabs;
+	p->slabs = s;
+	STAT_INC(p->stats->pool_slabs);
+	for (i = CONNPOOL_SLAB_SIZE - 1; i >= 0; i--)
+		LIST_INSERT_HEAD(&p->free, &s->conns[i], link);
+	return 0;
+}
+
+int
+connpool_init(struct connpool *p, size_t prealloc, struct stats *stats)
+{
+	assert(p);
+	memset(p, 0, sizeof(*p));
+	p->stats = stats;
+	LIST_INIT(&p->free);
+	while (prealloc--)
+		if (connpool_grow(p) < 0)
+			return -1;
+	return 0;
+}
+
+void
+connpool_destroy(struct connpool *p)
+{
+	struct connslab *s;
+
+	while ((s = p->slabs) != NULL) {
+		p->slabs = s->next;
+		free(s);
+	}
+	LIST_INIT(&p->free);
+}
+
+struct connect *
+connpool_get(struct connpool *p)
+{
+	struct connect *c;
+
+	if (LIST_EMPTY(&p->free)) {
+		STAT_INC(p->stats->pool_misses);
+		if (connpool_grow(p) < 0)
+			return NULL;
+	}
+
+	c = LIST_FIRST(&p->free);
+	LIST_REMOVE(c, link);
+	memset(c, 0, sizeof(*c));
+
+	if (++p->used > p->stats->pool_hiwat)
+		STAT_ADD(p->stats->pool_hiwat, 1);
+	return c;
+}
+
+void
+connpool_put(struct connpool *p, struct connect *c)
+{
+	assert(p->used > 0);
+	p->used--;
+	LIST_INSERT_HEAD(&p->free, c, link);
+}
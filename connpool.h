@@ -0,0 +1,39 @@
+#ifndef CONNPOOL_H
+#define CONNPOOL_H
+
+#include "sfp.h"
+#include "stats.h"
+
+/* connects carved from one slab */
+#define CONNPOOL_SLAB_SIZE	256
+/* slabs allocated when the pool is created */
+#define CONNPOOL_PREALLOC	1
+
+struct connslab;
+
+/* per-worker pool of connection objects, free ones are chained
+ * through their own 'link' field; slabs, high-water and misses are
+ * counted in the worker's stats */
+struct connpool {
+	LIST_HEAD(, connect) free;
+	struct connslab	*slabs;
+	size_t		used;		/* connects handed out */
+	struct stats	*stats;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int connpool_init(struct connpool *p, size_t prealloc, struct stats *stats);
+void connpool_destroy(struct connpool *p);
+
+/* zeroed connect */
+struct connect *connpool_get(struct connpool *p);
+void connpool_put(struct connpool *p, struct connect *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CONNPOOL_H */
@@ -0,0 +1,567 @@
+#include <assert.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+
+#include "sfp.h"
+#include "dns.h"
+
+#define DNS_HDR_SIZE	12
+#define DNS_PKT_SIZE	4096
+#define DNS_TYPE_A	1
+#define DNS_TYPE_SOA	6
+#define DNS_CLASS_IN	1
+#define DNS_FLAG_QR	0x8000
+#define DNS_FLAG_TC	0x0200
+#define DNS_FLAG_RD	0x0100
+#define DNS_RCODE_NXDOMAIN 3
+
+static const char RESOLV_CONF[] = "/etc/resolv.conf";
+static const char HOSTS_FILE[] = "/etc/hosts";
+
+/* cache entry, also stands for the query while one is in flight */
+struct dns_entry {
+	struct dns_entry *next;		/* hash chain */
+	TAILQ_ENTRY(dns_entry) lru;
+	uint32_t	hash;
+	int		status;
+	struct in_addr	addr;
+	ev_tstamp	expires;
+	unsigned	pending:1;
+	unsigned	pinned:1;	/* from hosts file, never expires */
+	uint16_t	qid;
+	int		tries;
+	ev_timer	timer;
+	struct resolver	*r;
+	LIST_HEAD(, dns_waiter) waiters;
+	char		name[DNS_NAME_MAX + 1];
+};
+
+static uint32_t
+name_hash(const char *s)
+{
+	uint32_t h = 2166136261u;
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+	return h;
+}
+
+static uint16_t
+next_qid(struct resolver *r)
+{
+	/* xorshift32 */
+	r->rnd ^= r->rnd << 13;
+	r->rnd ^= r->rnd >> 17;
+	r->rnd ^= r->rnd << 5;
+	return (uint16_t)r->rnd;
+}
+
+static struct dns_entry *
+cache_find(struct resolver *r, const char *name, uint32_t h)
+{
+	struct dns_entry *e;
+	for (e = r->table[h % DNS_CACHE_BUCKETS]; e; e = e->next)
+		if (e->hash == h && 0 == strcmp(e->name, name))
+			return e;
+	return NULL;
+}
+
+static void
+cache_unlink(struct resolver *r, struct dns_entry *e)
+{
+	struct dns_entry **pp = &r->table[e->hash % DNS_CACHE_BUCKETS];
+	while (*pp != e)
+		pp = &(*pp)->next;
+	*pp = e->next;
+	r->nentries--;
+}
+
+static struct dns_entry *
+cache_add(struct resolver *r, const char *name, uint32_t h)
+{
+	struct dns_entry *e;
+
+	/* least recently used completed entry makes room */
+	if (r->nentries >= DNS_CACHE_SIZE && (e = TAILQ_FIRST(&r->lru)) != NULL) {
+		TAILQ_REMOVE(&r->lru, e, lru);
+		cache_unlink(r, e);
+		free(e);
+		r->stats.evicted++;
+	}
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return NULL;
+	strcpy(e->name, name);
+	e->hash = h;
+	e->r = r;
+	LIST_INIT(&e->waiters);
+	e->next = r->table[h % DNS_CACHE_BUCKETS];
+	r->table[h % DNS_CACHE_BUCKETS] = e;
+	r->nentries++;
+	return e;
+}
+
+/* lower case copy, returns -1 for names which can't be looked up */
+static int
+name_normalize(const char *host, char *name)
+{
+	size_t len = strlen(host), i, label = 0;
+
+	if (len == 0 || len > DNS_NAME_MAX)
+		return -1;
+	if (host[len - 1] == '.')
+		len--;
+	for (i = 0; i < len; i++) {
+		if (host[i] == '.') {
+			if (label == 0)
+				return -1;
+			label = 0;
+		}
+		else if (++label > 63)
+			return -1;
+		name[i] = tolower((unsigned char)host[i]);
+	}
+	name[len] = 0;
+	return len > 0 ? 0 : -1;
+}
+
+static int
+query_send(struct resolver *r, struct dns_entry *e)
+{
+	unsigned char pkt[DNS_HDR_SIZE + DNS_NAME_MAX + 2 + 4];
+	unsigned char *p = pkt + DNS_HDR_SIZE;
+	const char *s = e->name, *dot;
+
+	memset(pkt, 0, DNS_HDR_SIZE);
+	pkt[0] = e->qid >> 8;
+	pkt[1] = e->qid & 0xff;
+	pkt[2] = DNS_FLAG_RD >> 8;
+	pkt[5] = 1;			/* qdcount */
+
+	do {
+		size_t l;
+		dot = strchr(s, '.');
+		l = dot ? (size_t)(dot - s) : strlen(s);
+		*p++ = l;
+		memcpy(p, s, l);
+		p += l;
+		s = dot + 1;
+	} while (dot);
+	*p++ = 0;
+	*p++ = 0; *p++ = DNS_TYPE_A;
+	*p++ = 0; *p++ = DNS_CLASS_IN;
+
+	r->stats.queries++;
+	if (send(r->fd, pkt, p - pkt, 0) < 0) {
+		wrlog(L_WARNING, "DNS query for %s send error: %s", e->name, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/* finish the query and hand the result to everyone waiting */
+static void
+query_done(EV_P_ struct resolver *r, struct dns_entry *e, int status,
+		struct in_addr addr, uint32_t ttl)
+{
+	struct dns_waiter *w;
+
+	ev_timer_stop(EV_A_ &e->timer);
+	e->pending = 0;
+	e->status = status;
+	e->addr = addr;
+	e->expires = ev_now(EV_A) + ttl;
+	TAILQ_INSERT_TAIL(&r->lru, e, lru);
+
+	while ((w = LIST_FIRST(&e->waiters)) != NULL) {
+		LIST_REMOVE(w, link);
+		w->entry = NULL;
+		w->cb(EV_A_ w, status, addr);
+	}
+}
+
+static void
+query_timeout(EV_P_ ev_timer *t, int revents)
+{
+	struct dns_entry *e = (struct dns_entry *)((char *)t - offsetof(struct dns_entry, timer));
+	struct resolver *r = e->r;
+	struct in_addr none = { INADDR_NONE };
+
+	/* the timer repeats until the query is done */
+	if (++e->tries < DNS_TRIES) {
+		query_send(r, e);
+		return;
+	}
+	r->stats.timeouts++;
+	wrlog(L_WARNING, "DNS query for %s timed out", e->name);
+	query_done(EV_A_ r, e, DNS_EFAIL, none, DNS_FAIL_TTL);
+}
+
+/* read possibly compressed name at off into name,
+ * returns offset past it or -1 */
+static int
+read_name(const unsigned char *pkt, size_t len, size_t off, char *name, size_t size)
+{
+	size_t n = 0, end = 0;
+	int jumps = 0;
+
+	for (;;) {
+		unsigned l;
+		if (off >= len)
+			return -1;
+		l = pkt[off];
+		if ((l & 0xc0) == 0xc0) {
+			if (off + 1 >= len || ++jumps > 16)
+				return -1;
+			if (!end)
+				end = off + 2;
+			off = ((l & 0x3f) << 8) | pkt[off + 1];
+			continue;
+		}
+		if (l & 0xc0)
+			return -1;
+		off++;
+		if (l == 0)
+			break;
+		if (off + l > len || n + l + 1 >= size)
+			return -1;
+		if (n)
+			name[n++] = '.';
+		while (l--)
+			name[n++] = tolower(pkt[off++]);
+	}
+	name[n] = 0;
+	return end ? (int)end : (int)off;
+}
+
+static inline unsigned
+get16(const unsigned char *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t
+get32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint32_t
+clamp_ttl(uint32_t ttl)
+{
+	if (ttl < DNS_MIN_TTL)
+		return DNS_MIN_TTL;
+	if (ttl > DNS_MAX_TTL)
+		return DNS_MAX_TTL;
+	return ttl;
+}
+
+static void
+response(EV_P_ struct resolver *r, const unsigned char *pkt, size_t len)
+{
+	char name[DNS_NAME_MAX + 2];
+	struct dns_entry *e;
+	struct in_addr addr = { INADDR_NONE };
+	unsigned id, flags, qd, an, ns, i;
+	uint32_t ttl = UINT32_MAX, negttl = DNS_NEG_TTL;
+	int off, found = 0, status;
+
+	if (len < DNS_HDR_SIZE)
+		goto stray;
+	id = get16(pkt);
+	flags = get16(pkt + 2);
+	qd = get16(pkt + 4);
+	an = get16(pkt + 6);
+	ns = get16(pkt + 8);
+	if (!(flags & DNS_FLAG_QR) || qd != 1)
+		goto stray;
+
+	off = read_name(pkt, len, DNS_HDR_SIZE, name, sizeof(name));
+	if (off < 0 || off + 4 > len ||
+	    get16(pkt + off) != DNS_TYPE_A || get16(pkt + off + 2) != DNS_CLASS_IN)
+		goto stray;
+	off += 4;
+
+	e = cache_find(r, name, name_hash(name));
+	if (!e || !e->pending || e->qid != id)
+		goto stray;
+
+	/* a cut answer says nothing about what is missing from it; there
+	 * is no TCP fallback, so it fails now and is not remembered */
+	if (flags & DNS_FLAG_TC) {
+		query_done(EV_A_ r, e, DNS_EFAIL, addr, 0);
+		return;
+	}
+
+	for (i = 0; i < an + ns; i++) {
+		unsigned type, class, rdlen;
+		uint32_t rttl;
+
+		off = read_name(pkt, len, off, name, sizeof(name));
+		if (off < 0 || off + 10 > len)
+			break;
+		type = get16(pkt + off);
+		class = get16(pkt + off + 2);
+		rttl = get32(pkt + off + 4);
+		rdlen = get16(pkt + off + 8);
+		off += 10;
+		if (off + rdlen > len)
+			break;
+
+		if (i < an) {
+			/* CNAME chain ttl counts too */
+			if (rttl < ttl)
+				ttl = rttl;
+			if (type == DNS_TYPE_A && class == DNS_CLASS_IN && rdlen == 4 && !found) {
+				memcpy(&addr, pkt + off, 4);
+				found = 1;
+			}
+		}
+		else if (type == DNS_TYPE_SOA && rdlen >= 20) {
+			/* RFC 2308: min of SOA ttl and its MINIMUM field */
+			uint32_t min = get32(pkt + off + rdlen - 4);
+			negttl = rttl < min ? rttl : min;
+		}
+		off += rdlen;
+	}
+
+	if (found)
+		status = DNS_OK;
+	else if ((flags & 0xf) == 0 || (flags & 0xf) == DNS_RCODE_NXDOMAIN)
+		status = DNS_ENOTFOUND;
+	else
+		status = DNS_EFAIL;
+
+	if (status == DNS_OK)
+		ttl = clamp_ttl(ttl);
+	else if (status == DNS_ENOTFOUND)
+		ttl = clamp_ttl(negttl);
+	else
+		ttl = DNS_FAIL_TTL;
+	query_done(EV_A_ r, e, status, addr, ttl);
+	return;
+
+stray:
+	r->stats.stray++;
+}
+
+static void
+resolver_cbread(EV_P_ ev_io *w, int revents)
+{
+	struct resolver *r = (struct resolver *)((char *)w - offsetof(struct resolver, io));
+	unsigned char pkt[DNS_PKT_SIZE];
+	ssize_t n;
+
+	while ((n = recv(w->fd, pkt, sizeof(pkt), 0)) >= 0)
+		response(EV_A_ r, pkt, n);
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		wrlog(L_WARNING, "DNS receive error: %s", strerror(errno));
+}
+
+static int
+parse_ns(const char *s, struct sockaddr_in *sin)
+{
+	char ip[IPADDR_STR_SIZE];
+	const char *colon = strchr(s, ':');
+	size_t len = colon ? (size_t)(colon - s) : strlen(s);
+
+	if (len >= sizeof(ip))
+		return -1;
+	memcpy(ip, s, len);
+	ip[len] = 0;
+
+	memset(sin, 0, sizeof(*sin));
+	sin->sin_family = AF_INET;
+	sin->sin_port = htons(colon ? atoi(colon + 1) : DNS_PORT);
+	if (0 == inet_aton(ip, &sin->sin_addr) || 0 == sin->sin_port)
+		return -1;
+	return 0;
+}
+
+/* first IPv4 nameserver from resolv.conf, localhost if there is none */
+static void
+default_ns(struct sockaddr_in *sin)
+{
+	char line[256], ip[64];
+	FILE *fp = fopen(RESOLV_CONF, "r");
+
+	if (fp) {
+		while (fgets(line, sizeof(line), fp))
+			if (1 == sscanf(line, " nameserver %63s", ip) && 0 == parse_ns(ip, sin)) {
+				fclose(fp);
+				return;
+			}
+		fclose(fp);
+	}
+	parse_ns("127.0.0.1", sin);
+}
+
+/* hosts file entries are pinned in the cache */
+static void
+load_hosts(struct resolver *r)
+{
+	char line[512], name[DNS_NAME_MAX + 2];
+	FILE *fp = fopen(HOSTS_FILE, "r");
+
+	if (!fp)
+		return;
+	while (fgets(line, sizeof(line), fp)) {
+		char *tok, *save = NULL, *hash = strchr(line, '#');
+		struct in_addr addr;
+
+		if (hash)
+			*hash = 0;
+		tok = strtok_r(line, " \t\r\n", &save);
+		if (!tok || 0 == inet_aton(tok, &addr))
+			continue;
+		while ((tok = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+			struct dns_entry *e;
+			uint32_t h;
+			if (name_normalize(tok, name) < 0)
+				continue;
+			h = name_hash(name);
+			if (cache_find(r, name, h) || !(e = cache_add(r, name, h)))
+				continue;
+			e->addr = addr;
+			e->pinned = 1;
+		}
+	}
+	fclose(fp);
+}
+
+int
+resolver_init(EV_P_ struct resolver *r, const char *nameserver)
+{
+	memset(r, 0, sizeof(*r));
+	TAILQ_INIT(&r->lru);
+	r->fd = -1;
+
+	if (nameserver && nameserver[0]) {
+		if (parse_ns(nameserver, &r->ns) < 0) {
+			wrlog(L_ERROR, "Bad nameserver address %s", nameserver);
+			return -1;
+		}
+	}
+	else
+		default_ns(&r->ns);
+
+	r->table = calloc(DNS_CACHE_BUCKETS, sizeof(*r->table));
+	if (!r->table)
+		return -1;
+
+	if (getrandom(&r->rnd, sizeof(r->rnd), 0) != sizeof(r->rnd) || r->rnd == 0)
+		r->rnd = (uint32_t)ev_time() ^ (uint32_t)getpid() ^ 0x9e3779b9;
+
+	/* connected socket: kernel drops datagrams from anyone else */
+	r->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (r->fd < 0 || connect(r->fd, (struct sockaddr *)&r->ns, sizeof(r->ns)) < 0) {
+		wrlog(L_ERROR, "DNS socket error: %s", strerror(errno));
+		resolver_destroy(EV_A_ r);
+		return -1;
+	}
+
+	load_hosts(r);
+	ev_io_init(&r->io, resolver_cbread, r->fd, EV_READ);
+	ev_io_start(EV_A_ &r->io);
+	return 0;
+}
+
+void
+resolver_destroy(EV_P_ struct resolver *r)
+{
+	size_t i;
+
+	if (r->fd >= 0) {
+		ev_io_stop(EV_A_ &r->io);
+		close(r->fd);
+		r->fd = -1;
+	}
+	if (!r->table)
+		return;
+	for (i = 0; i < DNS_CACHE_BUCKETS; i++) {
+		struct dns_entry *e;
+		while ((e = r->table[i]) != NULL) {
+			struct dns_waiter *w;
+			r->table[i] = e->next;
+			ev_timer_stop(EV_A_ &e->timer);
+			while ((w = LIST_FIRST(&e->waiters)) != NULL) {
+				LIST_REMOVE(w, link);
+				w->entry = NULL;
+			}
+			free(e);
+		}
+	}
+	free(r->table);
+	r->table = NULL;
+	r->nentries = 0;
+	TAILQ_INIT(&r->lru);
+}
+
+int
+resolver_lookup(EV_P_ struct resolver *r, const char *host,
+		struct dns_waiter *w, struct in_addr *addr)
+{
+	char name[DNS_NAME_MAX + 2];
+	struct dns_entry *e;
+	uint32_t h;
+
+	r->stats.lookups++;
+	if (inet_aton(host, addr))
+		return DNS_OK;
+	if (name_normalize(host, name) < 0)
+		return DNS_EFAIL;
+
+	h = name_hash(name);
+	e = cache_find(r, name, h);
+	if (e && !e->pending) {
+		if (e->pinned) {
+			r->stats.hits++;
+			*addr = e->addr;
+			return DNS_OK;
+		}
+		if (e->expires > ev_now(EV_A)) {
+			TAILQ_REMOVE(&r->lru, e, lru);
+			TAILQ_INSERT_TAIL(&r->lru, e, lru);
+			if (e->status != DNS_OK) {
+				r->stats.neghits++;
+				return e->status;
+			}
+			r->stats.hits++;
+			*addr = e->addr;
+			return DNS_OK;
+		}
+		/* expired, the entry turns into a query again */
+		TAILQ_REMOVE(&r->lru, e, lru);
+	}
+	else if (e) {
+		r->stats.coalesced++;
+		goto wait;
+	}
+	else if (!(e = cache_add(r, name, h)))
+		return DNS_EFAIL;
+
+	e->pending = 1;
+	e->tries = 0;
+	e->qid = next_qid(r);
+	ev_timer_init(&e->timer, query_timeout, DNS_TIMEOUT, DNS_TIMEOUT);
+	ev_timer_start(EV_A_ &e->timer);
+	/* a failed send is retried by the timer */
+	query_send(r, e);
+
+wait:
+	w->entry = e;
+	LIST_INSERT_HEAD(&e->waiters, w, link);
+	return DNS_PENDING;
+}
+
+void
+resolver_cancel(struct dns_waiter *w)
+{
+	if (!w->entry)
+		return;
+	LIST_REMOVE(w, link);
+	w->entry = NULL;
+}
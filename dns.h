@@ -0,0 +1,83 @@
+#ifndef DNS_H
+#define DNS_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include <ev.h>
+
+#include "queue.h"
+
+#define DNS_NAME_MAX	253
+
+/* lookup results */
+#define DNS_OK		0
+#define DNS_PENDING	1
+#define DNS_ENOTFOUND	(-1)	/* NXDOMAIN or no A record */
+#define DNS_EFAIL	(-2)	/* server failure, timeout or bad name */
+
+#define DNS_PORT	53
+#define DNS_TIMEOUT	1.0	/* sec before a query is resent */
+#define DNS_TRIES	3
+#define DNS_MIN_TTL	5
+#define DNS_MAX_TTL	3600
+#define DNS_NEG_TTL	60	/* NXDOMAIN without SOA */
+#define DNS_FAIL_TTL	5	/* SERVFAIL and timeouts */
+#define DNS_CACHE_SIZE	8192	/* entries */
+#define DNS_CACHE_BUCKETS 4096
+
+struct dns_entry;
+struct dns_waiter;
+
+typedef void (*dns_cb)(EV_P_ struct dns_waiter *w, int status, struct in_addr addr);
+
+/* embedded in whoever waits for an answer */
+struct dns_waiter {
+	dns_cb			cb;
+	struct dns_entry	*entry;
+	LIST_ENTRY(dns_waiter)	link;
+};
+
+struct dns_stats {
+	unsigned long	lookups;
+	unsigned long	hits;		/* answered from cache, positive */
+	unsigned long	neghits;	/* answered from cache, negative */
+	unsigned long	coalesced;	/* joined a query already in flight */
+	unsigned long	queries;	/* packets sent */
+	unsigned long	timeouts;
+	unsigned long	stray;		/* answers nobody waits for */
+	unsigned long	evicted;
+};
+
+/* per-worker stub resolver with its own socket and cache */
+struct resolver {
+	int		fd;
+	ev_io		io;
+	struct sockaddr_in ns;
+	struct dns_entry **table;
+	size_t		nentries;
+	TAILQ_HEAD(, dns_entry) lru;	/* completed, unpinned entries */
+	uint32_t	rnd;
+	struct dns_stats stats;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* nameserver is "ip[:port]", NULL or empty to use /etc/resolv.conf */
+int resolver_init(EV_P_ struct resolver *r, const char *nameserver);
+void resolver_destroy(EV_P_ struct resolver *r);
+
+/* DNS_OK with *addr filled, DNS_PENDING if w->cb will be called later,
+ * or a cached/immediate error */
+int resolver_lookup(EV_P_ struct resolver *r, const char *host,
+		struct dns_waiter *w, struct in_addr *addr);
+
+/* forget a pending lookup, callback won't be called */
+void resolver_cancel(struct dns_waiter *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DNS_H */
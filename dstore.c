@@ -0,0 +1,294 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dstore.h"
+#include "util.h"
+
+/* copy through user space when the kernel won't copy between the files */
+#define COPY_BUF	(256 * 1024)
+
+static int
+job_write(struct dwrite *w)
+{
+	size_t done = 0;
+	ssize_t r;
+
+	while (done < w->len) {
+		r = pwrite(w->slab->fd, w->data + done, w->len - done, w->off + done);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+			return r < 0 ? errno : EIO;
+		done += r;
+	}
+	return 0;
+}
+
+static int
+copy_slow(struct dwrite *w, size_t done)
+{
+	char *buf = malloc(COPY_BUF);
+	ssize_t n, r;
+	size_t k, len;
+	int err = 0;
+
+	if (!buf)
+		return ENOMEM;
+	while (!err && done < w->len) {
+		len = w->len - done < COPY_BUF ? w->len - done : COPY_BUF;
+		n = pread(w->src->fd, buf, len, w->srcoff + done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			err = n < 0 ? errno : EIO;
+			break;
+		}
+		for (k = 0; k < (size_t)n; k += r) {
+			r = pwrite(w->slab->fd, buf + k, n - k, w->off + done + k);
+			if (r < 0 && errno == EINTR)
+				r = 0;
+			else if (r <= 0) {
+				err = r < 0 ? errno : EIO;
+				break;
+			}
+		}
+		done += n;
+	}
+	free(buf);
+	return err;
+}
+
+static int
+job_copy(struct dwrite *w)
+{
+	loff_t from = w->srcoff, to = w->off;
+	size_t done = 0;
+	ssize_t r;
+
+	while (done < w->len) {
+		r = copy_file_range(w->src->fd, &from, w->slab->fd, &to, w->len - done, 0);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+		    errno == EOPNOTSUPP))
+			return copy_slow(w, done);
+		if (r <= 0)
+			return r < 0 ? errno : EIO;
+		done += r;
+	}
+	return 0;
+}
+
+static void *
+writer_run(void *arg)
+{
+	struct dstore *s = arg;
+	struct dwrite *w;
+
+	pthread_mutex_lock(&s->lock);
+	for (;;) {
+		while (!s->quit && STAILQ_EMPTY(&s->todo))
+			pthread_cond_wait(&s->wake, &s->lock);
+		if (s->quit)
+			break;
+		w = STAILQ_FIRST(&s->todo);
+		STAILQ_REMOVE_HEAD(&s->todo, link);
+		pthread_mutex_unlock(&s->lock);
+
+		w->err = w->src ? job_copy(w) : job_write(w);
+
+		pthread_mutex_lock(&s->lock);
+		STAILQ_INSERT_TAIL(&s->done, w, link);
+		ev_async_send(s->loop, &s->donew);
+	}
+	pthread_mutex_unlock(&s->lock);
+	return NULL;
+}
+
+static void
+job_done(struct dstore *s, struct dwrite *w)
+{
+	s->pending -= w->size;
+	w->slab->refs--;
+	if (w->src) {
+		w->src->refs--;
+		s->stats.copies++;
+	}
+	else
+		s->stats.writes++;
+	if (w->err) {
+		if (w->err != ECANCELED && s->stats.errors++ == 0)
+			wrlog(L_ERROR, "Cache slab %d write error: %s", w->slab->id,
+				strerror(w->err));
+	}
+	else
+		s->stats.bytes += w->len;
+	s->complete(s, w);
+	free(w);
+}
+
+static void
+done_cb(EV_P_ ev_async *a, int revents)
+{
+	struct dstore *s = a->data;
+	STAILQ_HEAD(, dwrite) done;
+	struct dwrite *w;
+
+	pthread_mutex_lock(&s->lock);
+	STAILQ_INIT(&done);
+	STAILQ_CONCAT(&done, &s->done);
+	pthread_mutex_unlock(&s->lock);
+
+	while ((w = STAILQ_FIRST(&done))) {
+		STAILQ_REMOVE_HEAD(&done, link);
+		job_done(s, w);
+	}
+}
+
+int
+dstore_init(EV_P_ struct dstore *s, const char *dir, int id, int nslabs, size_t slabsize)
+{
+	char path[4096];
+	int i;
+
+	memset(s, 0, sizeof(*s));
+	STAILQ_INIT(&s->todo);
+	STAILQ_INIT(&s->done);
+	if (!(s->slabs = calloc(nslabs, sizeof(*s->slabs))))
+		return -1;
+	s->nslabs = nslabs;
+	s->slabsize = slabsize;
+	s->loop = EV_A;
+	for (i = 0; i < nslabs; i++) {
+		struct dslab *sl = &s->slabs[i];
+
+		sl->id = i;
+		TAILQ_INIT(&sl->objs);
+		/* nothing is kept over a restart, the index lives in memory */
+		snprintf(path, sizeof(path), "%s/w%d-%d.slab", dir, id, i);
+		sl->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+		if (sl->fd < 0) {
+			wrlog(L_CRITICAL, "Cache slab %s open error: %s", path, strerror(errno));
+			goto fail;
+		}
+	}
+
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->wake, NULL);
+	ev_async_init(&s->donew, done_cb);
+	s->donew.data = s;
+	ev_async_start(EV_A_ &s->donew);
+	if (pthread_create(&s->writer, NULL, writer_run, s) != 0) {
+		wrlog(L_CRITICAL, "Cache writer thread create error");
+		ev_async_stop(EV_A_ &s->donew);
+		pthread_cond_destroy(&s->wake);
+		pthread_mutex_destroy(&s->lock);
+		goto fail;
+	}
+	snprintf(path, sizeof(path), "sfp-d%d", id);
+	pthread_setname_np(s->writer, path);
+	return 0;
+fail:
+	while (i-- > 0)
+		close(s->slabs[i].fd);
+	free(s->slabs);
+	s->slabs = NULL;
+	return -1;
+}
+
+void
+dstore_destroy(struct dstore *s)
+{
+	struct dwrite *w;
+	int i;
+
+	if (!s->slabs)
+		return;
+	pthread_mutex_lock(&s->lock);
+	s->quit = 1;
+	pthread_cond_signal(&s->wake);
+	pthread_mutex_unlock(&s->lock);
+	pthread_join(s->writer, NULL);
+
+	while ((w = STAILQ_FIRST(&s->todo))) {
+		STAILQ_REMOVE_HEAD(&s->todo, link);
+		w->err = ECANCELED;
+		STAILQ_INSERT_TAIL(&s->done, w, link);
+	}
+	done_cb(s->loop, &s->donew, 0);
+	ev_async_stop(s->loop, &s->donew);
+	pthread_cond_destroy(&s->wake);
+	pthread_mutex_destroy(&s->lock);
+	for (i = 0; i < s->nslabs; i++)
+		close(s->slabs[i].fd);
+	free(s->slabs);
+	s->slabs = NULL;
+}
+
+int
+dstore_alloc(struct dstore *s, size_t len, struct dslab **slab, off_t *off)
+{
+	struct dslab *sl = &s->slabs[s->cur];
+	int moved = 0;
+
+	if (len > s->slabsize)
+		return -1;
+	if (sl->used + len > s->slabsize) {
+		sl = dstore_next(s);
+		if (sl->refs > 0) {
+			s->stats.refused++;
+			return -1;
+		}
+		if (sl->used) {
+			s->recycle(s, sl);
+			s->stats.recycled++;
+		}
+		sl->used = 0;
+		s->cur = sl->id;
+		moved = 1;
+	}
+	*slab = sl;
+	*off = sl->used;
+	sl->used += len;
+	return moved;
+}
+
+struct dwrite *
+dstore_job(struct dstore *s, size_t len)
+{
+	struct dwrite *w;
+
+	if (s->pending + len > DSTORE_MAX_PENDING) {
+		s->stats.refused++;
+		return NULL;
+	}
+	if (!(w = malloc(sizeof(*w) + len)))
+		return NULL;
+	memset(w, 0, sizeof(*w));
+	s->pending += len;
+	w->size = len;
+	return w;
+}
+
+void
+dstore_drop(struct dstore *s, struct dwrite *w)
+{
+	s->pending -= w->size;
+	free(w);
+}
+
+void
+dstore_submit(struct dstore *s, struct dwrite *w)
+{
+	w->slab->refs++;
+	if (w->src)
+		w->src->refs++;
+	pthread_mutex_lock(&s->lock);
+	STAILQ_INSERT_TAIL(&s->todo, w, link);
+	pthread_cond_signal(&s->wake);
+	pthread_mutex_unlock(&s->lock);
+}
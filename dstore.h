@@ -0,0 +1,109 @@
+#ifndef DSTORE_H
+#define DSTORE_H
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#define EV_MULTIPLICITY 1
+#include <ev.h>
+
+#include "queue.h"
+
+/* body bytes handed to the writer in one job */
+#define DSTORE_CHUNK		(256 * 1024)
+/* bytes queued for the writer, more are refused rather than waited for */
+#define DSTORE_MAX_PENDING	(32 << 20)
+
+struct cache_obj;
+
+/* append-only file of a fixed size: given out front to back, then
+ * emptied as a whole when its turn comes round again */
+struct dslab {
+	int		fd;
+	int		id;
+	size_t		used;		/* bytes given out */
+	int		refs;		/* jobs and reads in progress */
+	TAILQ_HEAD(dslab_objs, cache_obj) objs;	/* of the cache, in it */
+};
+
+/* job of the writer thread: data to write, or a copy from another slab */
+struct dwrite {
+	STAILQ_ENTRY(dwrite) link;
+	struct dslab	*slab;
+	off_t		off;
+	size_t		len;
+	size_t		size;		/* room for data */
+	struct dslab	*src;		/* NULL - write data */
+	off_t		srcoff;
+	int		err;		/* errno of the job */
+	struct cache_obj *obj;
+	char		data[];
+};
+
+struct dstore_stats {
+	unsigned long	writes;
+	unsigned long	copies;
+	unsigned long	bytes;
+	unsigned long	errors;
+	unsigned long	recycled;	/* slabs emptied for reuse */
+	unsigned long	refused;	/* writer behind, or next slab busy */
+};
+
+/* slab files of a worker, written by a thread of their own so the loop
+ * never waits for the disk; jobs come back to the loop when done */
+struct dstore {
+	struct dslab	*slabs;
+	int		nslabs;
+	int		cur;		/* appended to */
+	size_t		slabsize;
+	size_t		pending;	/* data bytes queued */
+	pthread_t	writer;
+	pthread_mutex_t	lock;
+	pthread_cond_t	wake;
+	STAILQ_HEAD(, dwrite) todo;
+	STAILQ_HEAD(, dwrite) done;
+	int		quit;
+	struct ev_loop	*loop;
+	ev_async	donew;
+	/* set by the user: job is done, slab is about to be emptied */
+	void		(*complete)(struct dstore *s, struct dwrite *w);
+	void		(*recycle)(struct dstore *s, struct dslab *slab);
+	void		*data;
+	struct dstore_stats stats;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* nslabs files of slabsize named <dir>/w<id>-<n>.slab, emptied */
+int dstore_init(EV_P_ struct dstore *s, const char *dir, int id, int nslabs,
+		size_t slabsize);
+
+/* waits for the job in progress, the rest come back with ECANCELED */
+void dstore_destroy(struct dstore *s);
+
+/* len bytes at the end of the current slab; when it is full the next one
+ * is emptied and becomes current, unless it is still in use.  Returns
+ * -1 if there is no room, 1 if it moved on to another slab, 0 else */
+int dstore_alloc(struct dstore *s, size_t len, struct dslab **slab, off_t *off);
+
+/* job with room for len data bytes, NULL if the writer is too far
+ * behind to take them */
+struct dwrite *dstore_job(struct dstore *s, size_t len);
+void dstore_submit(struct dstore *s, struct dwrite *w);
+/* job that won't be submitted after all */
+void dstore_drop(struct dstore *s, struct dwrite *w);
+
+/* slab to be emptied next */
+static inline struct dslab *
+dstore_next(struct dstore *s)
+{
+	return &s->slabs[(s->cur + 1) % s->nslabs];
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DSTORE_H */
@@ -0,0 +1,186 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "hostfilter.h"
+
+#define HF_INIT_SLOTS	1024
+#define FNV_OFFSET	0xcbf29ce484222325ULL
+#define FNV_PRIME	0x100000001b3ULL
+
+static inline unsigned char
+lc(unsigned char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c | 0x20 : c;
+}
+
+/* hash of the path extended by one more label to the left */
+static inline uint64_t
+path_step(uint64_t h, const char *label, size_t n)
+{
+	size_t i;
+
+	h = (h ^ '.') * FNV_PRIME;
+	for (i = 0; i < n; i++)
+		h = (h ^ lc(label[i])) * FNV_PRIME;
+	return h ? h : 1;
+}
+
+static inline const struct hf_slot *
+slot_find(const struct hostfilter *hf, uint64_t key)
+{
+	size_t i = key & hf->mask;
+
+	for (; hf->slots[i].key; i = (i + 1) & hf->mask)
+		if (hf->slots[i].key == key)
+			return &hf->slots[i];
+	return NULL;
+}
+
+static int
+grow(struct hostfilter *hf)
+{
+	size_t n = (hf->mask + 1) * 2, i, j;
+	struct hf_slot *s = calloc(n, sizeof(*s));
+
+	if (!s)
+		return -1;
+	for (i = 0; i <= hf->mask; i++) {
+		if (!hf->slots[i].key)
+			continue;
+		for (j = hf->slots[i].key & (n - 1); s[j].key; j = (j + 1) & (n - 1))
+			;
+		s[j] = hf->slots[i];
+	}
+	free(hf->slots);
+	hf->slots = s;
+	hf->mask = n - 1;
+	return 0;
+}
+
+static struct hf_slot *
+slot_get(struct hostfilter *hf, uint64_t key)
+{
+	size_t i;
+
+	/* keep load under a half so misses stop early */
+	if ((hf->used + 1) * 2 > hf->mask + 1 && grow(hf) < 0)
+		return NULL;
+	for (i = key & hf->mask; hf->slots[i].key; i = (i + 1) & hf->mask)
+		if (hf->slots[i].key == key)
+			return &hf->slots[i];
+	hf->slots[i].key = key;
+	hf->used++;
+	return &hf->slots[i];
+}
+
+int
+hostfilter_init(struct hostfilter *hf)
+{
+	memset(hf, 0, sizeof(*hf));
+	hf->slots = calloc(HF_INIT_SLOTS, sizeof(*hf->slots));
+	if (!hf->slots)
+		return -1;
+	hf->mask = HF_INIT_SLOTS - 1;
+	return 0;
+}
+
+void
+hostfilter_free(struct hostfilter *hf)
+{
+	free(hf->slots);
+	hf->slots = NULL;
+	hf->mask = hf->used = hf->rules = 0;
+}
+
+static int
+valid_name(const char *s, size_t n)
+{
+	size_t i, label = 0;
+
+	if (n == 0 || n > 253)
+		return 0;
+	for (i = 0; i < n; i++) {
+		unsigned char c = s[i];
+		if (c == '.') {
+			if (label == 0)
+				return 0;
+			label = 0;
+		}
+		else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+			 (c >= '0' && c <= '9') || c == '-' || c == '_') {
+			if (++label > 63)
+				return 0;
+		}
+		else
+			return 0;
+	}
+	return label > 0;
+}
+
+int
+hostfilter_add(struct hostfilter *hf, const char *rule)
+{
+	unsigned kind = HF_EXACT;
+	size_t n, end, start;
+	uint64_t h = FNV_OFFSET;
+	struct hf_slot *s;
+
+	if (rule[0] == '*' && rule[1] == '.') {
+		kind = HF_SUBDOMAINS;
+		rule += 2;
+	}
+	else if (rule[0] == '.') {
+		kind = HF_EXACT | HF_SUBDOMAINS;
+		rule++;
+	}
+	n = strlen(rule);
+	if (n > 0 && rule[n - 1] == '.')
+		n--;
+	if (!valid_name(rule, n))
+		return -1;
+
+	/* every path on the way gets marked so lookups can stop early */
+	for (end = n; ; end = start - 1) {
+		for (start = end; start > 0 && rule[start - 1] != '.'; start--)
+			;
+		h = path_step(h, rule + start, end - start);
+		if (!(s = slot_get(hf, h)))
+			return -1;
+		if (start == 0) {
+			s->flags |= kind;
+			break;
+		}
+		s->flags |= HF_INNER;
+	}
+	hf->rules++;
+	return 0;
+}
+
+int
+hostfilter_match(const struct hostfilter *hf, const char *host, size_t len)
+{
+	size_t end, start;
+	uint64_t h = FNV_OFFSET;
+	const struct hf_slot *s;
+
+	if (!hf->rules)
+		return 0;
+	if (len > 0 && host[len - 1] == '.')
+		len--;
+	if (len == 0)
+		return 0;
+
+	for (end = len; ; end = start - 1) {
+		for (start = end; start > 0 && host[start - 1] != '.'; start--)
+			;
+		h = path_step(h, host + start, end - start);
+		if (!(s = slot_find(hf, h)))
+			return 0;
+		if (start == 0)
+			return s->flags & HF_EXACT;
+		if (s->flags & HF_SUBDOMAINS)
+			return 1;
+		if (!(s->flags & HF_INNER))
+			return 0;
+	}
+}
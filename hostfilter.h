@@ -0,0 +1,47 @@
+#ifndef HOSTFILTER_H
+#define HOSTFILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* rule kinds, also node flags */
+#define HF_EXACT	0x01	/* "example.com" - the name itself */
+#define HF_SUBDOMAINS	0x02	/* "*.example.com" - any name below it */
+#define HF_INNER	0x04	/* some longer rule passes through */
+
+/* one slot per reversed label path ("com", "com.example", ...), keyed by
+ * its 64-bit hash; paths are not stored, a false match needs a full
+ * 64-bit collision */
+struct hf_slot {
+	uint64_t	key;		/* 0 - empty */
+	uint32_t	flags;
+	uint32_t	pad;
+};
+
+/* open addressing, linear probing, power of two size */
+struct hostfilter {
+	struct hf_slot	*slots;
+	size_t		mask;
+	size_t		used;
+	size_t		rules;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int hostfilter_init(struct hostfilter *hf);
+void hostfilter_free(struct hostfilter *hf);
+
+/* "name", "*.name" or ".name" (both), returns -1 on a bad rule */
+int hostfilter_add(struct hostfilter *hf, const char *rule);
+
+/* non zero if host matches any rule, host is case insensitive and may
+ * have a trailing dot */
+int hostfilter_match(const struct hostfilter *hf, const char *host, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOSTFILTER_H */
@@ -0,0 +1,789 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_SIMD_SCAN 1
+#endif
+
+#include "http.h"
+
+#define HTTP_DEFAULT_PORT 80
+
+static const char HTTP_SCHEME[] = "http://";
+
+/* headers which must not be forwarded by a proxy */
+static const char *hop_headers[] = {
+	"Connection",
+	"Proxy-Connection",
+	"Keep-Alive",
+	"Expect",		/* 100-continue is answered by the proxy */
+	NULL
+};
+
+/* chunk parser states */
+enum {
+	CK_SIZE,
+	CK_EXT,
+	CK_SIZE_LF,
+	CK_DATA,
+	CK_DATA_CR,
+	CK_DATA_LF,
+	CK_TRAILER,
+	CK_TRAILER_LINE,
+	CK_TRAILER_LF,
+	CK_DONE
+};
+
+/* first a or b in [p, end), end if none */
+static const char *
+scan_scalar(const char *p, const char *end, char a, char b)
+{
+	for (; p < end; p++)
+		if (*p == a || *p == b)
+			break;
+	return p;
+}
+
+#ifdef HAVE_SIMD_SCAN
+__attribute__((target("sse2")))
+static const char *
+scan_sse2(const char *p, const char *end, char a, char b)
+{
+	const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+
+	for (; end - p >= 16; p += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		unsigned m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va),
+			_mm_cmpeq_epi8(v, vb)));
+		if (m)
+			return p + __builtin_ctz(m);
+	}
+	return scan_scalar(p, end, a, b);
+}
+
+__attribute__((target("avx2")))
+static const char *
+scan_avx2(const char *p, const char *end, char a, char b)
+{
+	const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+
+	for (; end - p >= 32; p += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)p);
+		unsigned m = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va),
+			_mm256_cmpeq_epi8(v, vb)));
+		if (m)
+			return p + __builtin_ctz(m);
+	}
+	return scan_sse2(p, end, a, b);
+}
+#endif
+
+static const char *(*scan)(const char *, const char *, char, char) = scan_scalar;
+
+/* picked before main, workers only read it */
+__attribute__((constructor))
+static void
+scan_select(void)
+{
+#ifdef HAVE_SIMD_SCAN
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		scan = scan_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		scan = scan_sse2;
+#endif
+}
+
+static struct http_slice
+mkslice(const char *buf, const char *from, const char *to)
+{
+	struct http_slice s;
+	s.off = from - buf;
+	s.len = to - from;
+	return s;
+}
+
+static int
+slice_is(const char *buf, struct http_slice s, const char *str)
+{
+	return s.len == strlen(str) && 0 == strncasecmp(buf + s.off, str, s.len);
+}
+
+static int
+is_hop_header(const char *name, size_t len)
+{
+	const char **h;
+	for (h = hop_headers; *h; h++)
+		if (len == strlen(*h) && 0 == strncasecmp(name, *h, len))
+			return 1;
+	return 0;
+}
+
+/* split "host[:port]" into host slice and port */
+static int
+parse_authority(const char *buf, const char *from, const char *to,
+		struct http_req *req, int defport)
+{
+	const char *at = memchr(from, '@', to - from);
+	const char *colon;
+
+	if (at)
+		from = at + 1;
+	colon = memchr(from, ':', to - from);
+	req->port = defport;
+	if (colon) {
+		const char *p;
+		int port = 0;
+		for (p = colon + 1; p < to; p++) {
+			if (*p < '0' || *p > '9')
+				return -1;
+			port = port * 10 + (*p - '0');
+			if (port > 65535)
+				return -1;
+		}
+		if (port > 0)
+			req->port = port;
+		to = colon;
+	}
+	if (from == to || req->port <= 0)
+		return -1;
+	req->host = mkslice(buf, from, to);
+	return 0;
+}
+
+static int
+parse_target(const char *buf, struct http_req *req)
+{
+	const char *t = buf + req->target.off;
+	const char *end = t + req->target.len;
+	size_t slen = sizeof(HTTP_SCHEME) - 1;
+
+	if (slice_is(buf, req->method, "CONNECT")) {
+		req->is_connect = 1;
+		return parse_authority(buf, t, end, req, -1);
+	}
+
+	if (req->target.len > slen && 0 == strncasecmp(t, HTTP_SCHEME, slen)) {
+		const char *a = t + slen;
+		const char *slash = memchr(a, '/', end - a);
+		if (!slash)
+			slash = end;
+		req->path = mkslice(buf, slash, end);
+		return parse_authority(buf, a, slash, req, HTTP_DEFAULT_PORT);
+	}
+
+	if (*t != '/')
+		return -1;
+	req->path = req->target;
+	return 1;
+}
+
+/* does comma separated list v contain token tok */
+static int
+has_token(const char *v, const char *end, const char *tok)
+{
+	size_t tl = strlen(tok);
+
+	while (v < end) {
+		const char *comma = memchr(v, ',', end - v), *te;
+		if (!comma)
+			comma = end;
+		while (v < comma && (*v == ' ' || *v == '\t'))
+			v++;
+		te = comma;
+		while (te > v && (*(te - 1) == ' ' || *(te - 1) == '\t'))
+			te--;
+		if ((size_t)(te - v) == tl && 0 == strncasecmp(v, tok, tl))
+			return 1;
+		v = comma + 1;
+	}
+	return 0;
+}
+
+/* last token of the list, for Transfer-Encoding */
+static int
+last_token_is(const char *v, const char *end, const char *tok)
+{
+	const char *p = end;
+	while (p > v && *(p - 1) != ',')
+		p--;
+	return has_token(p, end, tok);
+}
+
+#define HDR_IS(name, nlen, str) \
+	((nlen) == sizeof(str) - 1 && 0 == strncasecmp((name), (str), (nlen)))
+
+/* headers which matter for framing in both directions */
+static int
+header_common(const char *name, size_t nlen, const char *v, const char *ve,
+		int64_t *clen, unsigned *flags)
+{
+	if (HDR_IS(name, nlen, "Content-Length")) {
+		int64_t n = 0;
+		const char *p;
+		if (v == ve)
+			return -1;
+		for (p = v; p < ve; p++) {
+			if (*p < '0' || *p > '9' || n > INT64_MAX / 10 - 10)
+				return -1;
+			n = n * 10 + (*p - '0');
+		}
+		if (*clen >= 0 && *clen != n)
+			return -1;
+		*clen = n;
+	}
+	else if (HDR_IS(name, nlen, "Transfer-Encoding")) {
+		*flags |= HTTP_F_TE;
+		if (last_token_is(v, ve, "chunked"))
+			*flags |= HTTP_F_CHUNKED;
+		else
+			*flags &= ~HTTP_F_CHUNKED;
+	}
+	else if (HDR_IS(name, nlen, "Connection") || HDR_IS(name, nlen, "Proxy-Connection")) {
+		if (has_token(v, ve, "close"))
+			*flags |= HTTP_F_CLOSE;
+		if (has_token(v, ve, "keep-alive"))
+			*flags |= HTTP_F_KEEPALIVE;
+	}
+	return 0;
+}
+
+/* HTTP/1.x minor version, -1 if it is not 1.x */
+static int
+version_minor(const char *v, size_t len)
+{
+	if (len != 8 || strncmp(v, "HTTP/1.", 7) || v[7] < '0' || v[7] > '9')
+		return -1;
+	return v[7] - '0';
+}
+
+static void
+trim(const char **v, const char **ve)
+{
+	while (*v < *ve && (**v == ' ' || **v == '\t'))
+		(*v)++;
+	while (*ve > *v && (*(*ve - 1) == ' ' || *(*ve - 1) == '\t'))
+		(*ve)--;
+}
+
+void
+http_req_init(struct http_req *req)
+{
+	memset(req, 0, offsetof(struct http_req, hdrs));
+	req->clen = -1;
+}
+
+static int
+request_line(const char *buf, const char *p, const char *le, struct http_req *req)
+{
+	const char *sp;
+
+	/* METHOD SP target SP HTTP/x.y */
+	if (!(sp = memchr(p, ' ', le - p)))
+		return -1;
+	req->method = mkslice(buf, p, sp);
+	p = sp + 1;
+	if (!(sp = memchr(p, ' ', le - p)))
+		return -1;
+	req->target = mkslice(buf, p, sp);
+	req->version = mkslice(buf, sp + 1, le);
+	req->minor = version_minor(sp + 1, le - sp - 1);
+	if (req->method.len == 0 || req->target.len == 0 || req->minor < 0)
+		return -1;
+	return 0;
+}
+
+static int
+header_line(const char *buf, const char *p, const char *le, struct http_req *req)
+{
+	const char *colon = buf + req->colon, *v, *ve = le;
+	struct http_hdr *h;
+
+	/* folded lines are obsolete and rejected */
+	if (!req->colon || colon == p || *p == ' ' || *p == '\t')
+		return -1;
+	if (req->nhdrs == HTTP_MAX_HEADERS)
+		return -1;
+	v = colon + 1;
+	trim(&v, &ve);
+	h = &req->hdrs[req->nhdrs++];
+	h->name = mkslice(buf, p, colon);
+	h->value = mkslice(buf, v, ve);
+
+	if (HDR_IS(p, colon - p, "Host")) {
+		req->hostval = h->value;
+		req->has_host = 1;
+	}
+	else if (HDR_IS(p, colon - p, "Expect")) {
+		if (has_token(v, ve, "100-continue"))
+			req->flags |= HTTP_F_EXPECT;
+	}
+	else if (header_common(p, colon - p, v, ve, &req->clen, &req->flags) < 0)
+		return -1;
+	return 0;
+}
+
+int
+http_parse_request(const char *buf, size_t len, struct http_req *req)
+{
+	const char *end = buf + len, *p, *q, *le;
+	int rc;
+
+	assert(buf && req && len >= req->seen);
+	if (req->hdrlen)
+		return req->hdrlen;
+	if (len > UINT16_MAX)
+		return -1;
+
+	for (;;) {
+		p = buf + req->scan;
+		q = buf + req->seen;
+		/* header name ends before the line does */
+		if (req->lines && !req->colon) {
+			q = scan(q, end, ':', '\n');
+			if (q < end && *q == ':')
+				req->colon = q++ - buf;
+		}
+		if (q < end && *q != '\n')
+			q = scan(q, end, '\n', '\n');
+		if (q == end) {
+			req->seen = len;
+			return 0;
+		}
+
+		le = (q > p && *(q - 1) == '\r') ? q - 1 : q;
+		if (req->lines++ == 0)
+			rc = request_line(buf, p, le, req);
+		else if (le == p)
+			break;
+		else
+			rc = header_line(buf, p, le, req);
+		if (rc < 0)
+			return -1;
+		req->scan = req->seen = q + 1 - buf;
+		req->colon = 0;
+	}
+	req->hdrlen = q + 1 - buf;
+
+	req->is_head = slice_is(buf, req->method, "HEAD");
+	rc = parse_target(buf, req);
+	if (rc < 0)
+		return -1;
+	if (rc > 0) {
+		/* origin-form, host comes from the header */
+		const char *h = buf + req->hostval.off;
+		if (!req->has_host ||
+		    parse_authority(buf, h, h + req->hostval.len, req, HTTP_DEFAULT_PORT) < 0)
+			return -1;
+	}
+	return req->hdrlen;
+}
+
+int
+http_parse_response(const char *buf, size_t len, struct http_resp *resp)
+{
+	const char *p = buf, *end = buf + len, *eol, *le;
+	int line = 0;
+
+	memset(resp, 0, sizeof(*resp));
+	resp->clen = -1;
+
+	while ((eol = memchr(p, '\n', end - p)) != NULL) {
+		le = (eol > p && *(eol - 1) == '\r') ? eol - 1 : eol;
+
+		if (line++ == 0) {
+			/* HTTP/1.x SP 3DIGIT SP reason */
+			if (le - p < 12 || p[8] != ' ')
+				return -1;
+			resp->minor = version_minor(p, 8);
+			if (resp->minor < 0 || p[9] < '1' || p[9] > '5' ||
+			    p[10] < '0' || p[10] > '9' || p[11] < '0' || p[11] > '9')
+				return -1;
+			resp->status = (p[9] - '0') * 100 + (p[10] - '0') * 10 + (p[11] - '0');
+		}
+		else if (le == p) {
+			resp->hdrlen = eol + 1 - buf;
+			return resp->hdrlen;
+		}
+		else {
+			const char *colon = memchr(p, ':', le - p);
+			const char *v, *ve = le;
+			if (!colon || colon == p)
+				return -1;
+			v = colon + 1;
+			trim(&v, &ve);
+			if (header_common(p, colon - p, v, ve, &resp->clen, &resp->flags) < 0)
+				return -1;
+		}
+		p = eol + 1;
+	}
+	return 0;
+}
+
+static char *
+put(char *o, const char *oend, const void *s, size_t len)
+{
+	if (!o || o + len > oend)
+		return NULL;
+	memcpy(o, s, len);
+	return o + len;
+}
+
+ssize_t
+http_build_request(const char *buf, const struct http_req *req,
+		int keepalive, char *out, size_t outlen)
+{
+	const char *oend = out + outlen;
+	char *o = out;
+	char port[8];
+	int i;
+
+	o = put(o, oend, buf + req->method.off, req->method.len);
+	o = put(o, oend, " ", 1);
+	if (req->path.len)
+		o = put(o, oend, buf + req->path.off, req->path.len);
+	else
+		o = put(o, oend, "/", 1);
+	o = put(o, oend, " ", 1);
+	o = put(o, oend, buf + req->version.off, req->version.len);
+	o = put(o, oend, "\r\n", 2);
+
+	/* Host is made from the authority the request is routed, filtered
+	 * and cached by; one the client sent along an absolute-form target
+	 * is ignored (RFC 7230 5.4) */
+	o = put(o, oend, "Host: ", 6);
+	o = put(o, oend, buf + req->host.off, req->host.len);
+	if (req->port != HTTP_DEFAULT_PORT) {
+		int n = snprintf(port, sizeof(port), ":%d", req->port);
+		o = put(o, oend, port, n);
+	}
+	o = put(o, oend, "\r\n", 2);
+
+	for (i = 0; i < req->nhdrs; i++) {
+		const struct http_hdr *h = &req->hdrs[i];
+		if (is_hop_header(buf + h->name.off, h->name.len) ||
+		    HDR_IS(buf + h->name.off, h->name.len, "Host"))
+			continue;
+		o = put(o, oend, buf + h->name.off, h->value.off + h->value.len - h->name.off);
+		o = put(o, oend, "\r\n", 2);
+	}
+
+	if (keepalive)
+		o = put(o, oend, "Connection: keep-alive\r\n\r\n", 26);
+	else
+		o = put(o, oend, "Connection: close\r\n\r\n", 21);
+	if (!o)
+		return -1;
+	return o - out;
+}
+
+/* next header of a complete head, p starts past the first line and is
+ * left at the next one; lines without a colon are skipped, 0 at the end */
+static int
+head_next(const char **p, const char *end, const char **name, size_t *nlen,
+		const char **v, const char **ve)
+{
+	const char *eol, *le, *colon;
+
+	while (*p < end && (eol = memchr(*p, '\n', end - *p))) {
+		le = (eol > *p && *(eol - 1) == '\r') ? eol - 1 : eol;
+		if (le == *p)
+			return 0;
+		*name = *p;
+		*p = eol + 1;
+		if (!(colon = memchr(*name, ':', le - *name)))
+			continue;
+		*nlen = colon - *name;
+		*v = colon + 1;
+		*ve = le;
+		trim(v, ve);
+		return 1;
+	}
+	return 0;
+}
+
+/* delta-seconds, capped as RFC 9111 1.2.2 allows, -1 if not a number */
+static int64_t
+delta_seconds(const char *v, const char *ve)
+{
+	int64_t n = 0;
+
+	if (v < ve && *v == '"' && *(ve - 1) == '"' && ve - v >= 2) {
+		v++;
+		ve--;
+	}
+	if (v == ve)
+		return -1;
+	for (; v < ve; v++) {
+		if (*v < '0' || *v > '9')
+			return -1;
+		if (n <= INT32_MAX)
+			n = n * 10 + (*v - '0');
+	}
+	return n > INT32_MAX ? INT32_MAX : n;
+}
+
+/* IMF-fixdate, the only form senders may use; -1 for anything else */
+static time_t
+http_date(const char *v, const char *ve)
+{
+	struct tm tm;
+	char s[64];
+	const char *e;
+
+	if ((size_t)(ve - v) >= sizeof(s))
+		return -1;
+	memcpy(s, v, ve - v);
+	s[ve - v] = 0;
+	memset(&tm, 0, sizeof(tm));
+	if (!(e = strptime(s, "%a, %d %b %Y %H:%M:%S GMT", &tm)) || *e)
+		return -1;
+	return timegm(&tm);
+}
+
+/* directives of one Cache-Control line, commas inside quoted
+ * arguments don't split them */
+static void
+cache_control(const char *p, const char *end, struct http_cache *ci, int64_t *smaxage)
+{
+	const char *d, *de, *eq, *a;
+	int64_t n;
+	int q;
+
+	while (p < end) {
+		for (d = p, q = 0; p < end && (q || *p != ','); p++)
+			if (*p == '"')
+				q = !q;
+		de = p;
+		if (p < end)
+			p++;
+		trim(&d, &de);
+		eq = memchr(d, '=', de - d);
+		a = eq ? eq + 1 : de;
+		if (!eq)
+			eq = de;
+		if (HDR_IS(d, eq - d, "no-store"))
+			ci->flags |= HTTP_CC_NO_STORE;
+		else if (HDR_IS(d, eq - d, "no-cache"))
+			ci->flags |= HTTP_CC_NO_CACHE;
+		else if (HDR_IS(d, eq - d, "private"))
+			ci->flags |= HTTP_CC_PRIVATE;
+		else if (HDR_IS(d, eq - d, "max-age")) {
+			/* a bad one makes the response stale */
+			n = delta_seconds(a, de);
+			ci->maxage = n < 0 ? 0 : n;
+		}
+		else if (HDR_IS(d, eq - d, "s-maxage")) {
+			n = delta_seconds(a, de);
+			*smaxage = n < 0 ? 0 : n;
+		}
+	}
+}
+
+void
+http_cache_info(const char *buf, size_t hdrlen, struct http_cache *ci)
+{
+	const char *end = buf + hdrlen, *p, *name, *v, *ve;
+	int64_t smaxage = -1;
+	size_t nlen;
+
+	memset(ci, 0, sizeof(*ci));
+	ci->maxage = -1;
+	ci->expires = ci->date = -1;
+	if (!(p = memchr(buf, '\n', hdrlen)))
+		return;
+	for (p++; head_next(&p, end, &name, &nlen, &v, &ve); ) {
+		if (HDR_IS(name, nlen, "Cache-Control"))
+			cache_control(v, ve, ci, &smaxage);
+		else if (HDR_IS(name, nlen, "Pragma")) {
+			if (has_token(v, ve, "no-cache"))
+				ci->flags |= HTTP_CC_NO_CACHE;
+		}
+		else if (HDR_IS(name, nlen, "Expires")) {
+			/* an invalid date means already expired */
+			ci->expires = http_date(v, ve);
+			if (ci->expires < 0)
+				ci->expires = 0;
+		}
+		else if (HDR_IS(name, nlen, "Date"))
+			ci->date = http_date(v, ve);
+		else if (HDR_IS(name, nlen, "Age")) {
+			int64_t n = delta_seconds(v, ve);
+			ci->age = n < 0 ? 0 : n;
+		}
+		else if (HDR_IS(name, nlen, "Vary")) {
+			if (ci->vary || has_token(v, ve, "*"))
+				ci->flags |= HTTP_CC_VARY_ANY;
+			ci->vary = v;
+			ci->varylen = ve - v;
+		}
+		else if (HDR_IS(name, nlen, "Authorization"))
+			ci->flags |= HTTP_CC_AUTH;
+		else if (HDR_IS(name, nlen, "Set-Cookie"))
+			ci->flags |= HTTP_CC_COOKIE;
+	}
+	if (smaxage >= 0)
+		ci->maxage = smaxage;
+}
+
+const char *
+http_header(const char *buf, size_t hdrlen, const char *name, size_t *vlen)
+{
+	const char *end = buf + hdrlen, *p, *n, *v, *ve;
+	size_t nlen, len = strlen(name);
+
+	if (!(p = memchr(buf, '\n', hdrlen)))
+		return NULL;
+	for (p++; head_next(&p, end, &n, &nlen, &v, &ve); )
+		if (nlen == len && 0 == strncasecmp(n, name, len)) {
+			*vlen = ve - v;
+			return v;
+		}
+	return NULL;
+}
+
+size_t
+http_copy_head(const char *buf, size_t hdrlen, char *out)
+{
+	const char *end = buf + hdrlen, *p, *n, *v, *ve;
+	char *o = out;
+	size_t nlen;
+
+	if (!(p = memchr(buf, '\n', hdrlen)))
+		return 0;
+	p++;
+	memcpy(o, buf, p - buf);
+	o += p - buf;
+	while (head_next(&p, end, &n, &nlen, &v, &ve)) {
+		if (is_hop_header(n, nlen) || HDR_IS(n, nlen, "Age"))
+			continue;
+		memcpy(o, n, p - n);
+		o += p - n;
+	}
+	return o - out;
+}
+
+void
+http_chunk_init(struct http_chunk *ck)
+{
+	memset(ck, 0, sizeof(*ck));
+	ck->state = CK_SIZE;
+}
+
+static int
+hexval(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+ssize_t
+http_chunk_scan(struct http_chunk *ck, const char *p, size_t len)
+{
+	size_t i = 0;
+	int h;
+
+	while (i < len && ck->state != CK_DONE) {
+		char c = p[i];
+
+		switch (ck->state) {
+		case CK_SIZE:
+			if ((h = hexval(c)) >= 0) {
+				if (ck->left >> 56)
+					return -1;
+				ck->left = (ck->left << 4) | h;
+			}
+			else if (c == ';' || c == ' ' || c == '\t')
+				ck->state = CK_EXT;
+			else if (c == '\r')
+				ck->state = CK_SIZE_LF;
+			else if (c == '\n')
+				ck->state = ck->left ? CK_DATA : CK_TRAILER;
+			else
+				return -1;
+			i++;
+			break;
+		case CK_EXT:
+			if (c == '\r')
+				ck->state = CK_SIZE_LF;
+			else if (c == '\n')
+				ck->state = ck->left ? CK_DATA : CK_TRAILER;
+			i++;
+			break;
+		case CK_SIZE_LF:
+			if (c != '\n')
+				return -1;
+			ck->state = ck->left ? CK_DATA : CK_TRAILER;
+			i++;
+			break;
+		case CK_DATA: {
+			size_t n = len - i;
+			if (n > ck->left)
+				n = ck->left;
+			ck->left -= n;
+			i += n;
+			if (ck->left == 0)
+				ck->state = CK_DATA_CR;
+			break;
+		}
+		case CK_DATA_CR:
+			if (c == '\r')
+				ck->state = CK_DATA_LF;
+			else if (c == '\n')
+				ck->state = CK_SIZE;
+			else
+				return -1;
+			i++;
+			break;
+		case CK_DATA_LF:
+			if (c != '\n')
+				return -1;
+			ck->state = CK_SIZE;
+			i++;
+			break;
+		case CK_TRAILER:
+			/* start of a trailer line, empty one ends the body */
+			if (c == '\r')
+				ck->state = CK_TRAILER_LF;
+			else if (c == '\n')
+				ck->state = CK_DONE;
+			else
+				ck->state = CK_TRAILER_LINE;
+			i++;
+			break;
+		case CK_TRAILER_LINE:
+			if (c == '\n')
+				ck->state = CK_TRAILER;
+			i++;
+			break;
+		case CK_TRAILER_LF:
+			if (c != '\n')
+				return -1;
+			ck->state = CK_DONE;
+			i++;
+			break;
+		}
+	}
+	if (ck->state == CK_DONE)
+		ck->done = 1;
+	return i;
+}
+
+char *
+http_slice_str(const char *buf, struct http_slice s, char *to, size_t size)
+{
+	size_t len = s.len < size - 1 ? s.len : size - 1;
+	memcpy(to, buf + s.off, len);
+	to[len] = 0;
+	return to;
+}
@@ -0,0 +1,140 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+/* message flags from framing related headers */
+#define HTTP_F_CHUNKED		0x01	/* Transfer-Encoding ends with chunked */
+#define HTTP_F_TE		0x02	/* Transfer-Encoding present */
+#define HTTP_F_CLOSE		0x04	/* Connection: close */
+#define HTTP_F_KEEPALIVE	0x08	/* Connection: keep-alive */
+#define HTTP_F_EXPECT		0x10	/* Expect: 100-continue */
+
+/* cache related directives of a head */
+#define HTTP_CC_NO_STORE	0x01
+#define HTTP_CC_NO_CACHE	0x02	/* also Pragma: no-cache */
+#define HTTP_CC_PRIVATE		0x04
+#define HTTP_CC_VARY_ANY	0x08	/* Vary: *, or more than one Vary */
+#define HTTP_CC_AUTH		0x10	/* Authorization */
+#define HTTP_CC_COOKIE		0x20	/* Set-Cookie */
+
+/* piece of the request buffer, offsets are relative to its start */
+struct http_slice {
+	uint16_t off;
+	uint16_t len;
+};
+
+#define HTTP_MAX_HEADERS	100
+
+/* header line split at the first colon, value without surrounding blanks */
+struct http_hdr {
+	struct http_slice name;
+	struct http_slice value;
+};
+
+/* request head, filled in as bytes arrive: scan state lets the next call
+ * go on from the last byte looked at, buffer may move between calls */
+struct http_req {
+	struct http_slice method;
+	struct http_slice target;
+	struct http_slice version;
+	struct http_slice host;		/* host name without port */
+	struct http_slice path;		/* origin-form target */
+	int		port;
+	int		hdrlen;		/* request line + headers + empty line */
+	int		minor;		/* HTTP/1.x */
+	int64_t		clen;		/* Content-Length, -1 if none */
+	unsigned	flags;
+	unsigned	is_connect:1;
+	unsigned	is_head:1;
+	unsigned	has_host:1;	/* Host: header present */
+	struct http_slice hostval;	/* its value */
+
+	uint16_t	scan;		/* start of the line being parsed */
+	uint16_t	seen;		/* its bytes before this are looked at */
+	uint16_t	colon;		/* its first colon, 0 - not found yet */
+	int		lines;		/* complete lines */
+	int		nhdrs;
+	struct http_hdr	hdrs[HTTP_MAX_HEADERS];	/* not cleared by init */
+};
+
+struct http_resp {
+	int		status;
+	int		minor;
+	int		hdrlen;
+	int64_t		clen;
+	unsigned	flags;
+};
+
+/* freshness of a message as its headers tell it */
+struct http_cache {
+	unsigned	flags;
+	int64_t		maxage;		/* s-maxage, else max-age, -1 if none */
+	int64_t		age;		/* Age, 0 if none */
+	time_t		expires;	/* -1 if none, 0 if not a date */
+	time_t		date;		/* -1 if none or not a date */
+	const char	*vary;		/* Vary field names, NULL if none */
+	size_t		varylen;
+};
+
+/* chunked body framing, tracked without decoding */
+struct http_chunk {
+	int		state;
+	uint64_t	left;		/* data bytes of current chunk */
+	unsigned	done:1;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void http_req_init(struct http_req *req);
+
+/* parse request headers in buf, which holds everything passed to the
+ * previous calls since init and maybe more; returns header length, 0 if
+ * incomplete, -1 on malformed request */
+int http_parse_request(const char *buf, size_t len, struct http_req *req);
+
+/* same for the response status line and headers */
+int http_parse_response(const char *buf, size_t len, struct http_resp *resp);
+
+/* write request for the origin server into out: origin-form target,
+ * Host from the parsed authority, hop-by-hop headers and Expect dropped,
+ * Connection set to keep-alive or close; returns length or -1 if out is
+ * too small */
+ssize_t http_build_request(const char *buf, const struct http_req *req,
+		int keepalive, char *out, size_t outlen);
+
+/* caching headers of the complete head in buf */
+void http_cache_info(const char *buf, size_t hdrlen, struct http_cache *ci);
+
+/* value of the first header called name in the complete head in buf,
+ * blanks trimmed, NULL if there is none */
+const char *http_header(const char *buf, size_t hdrlen, const char *name, size_t *vlen);
+
+/* copy response head without hop-by-hop headers, Age and the empty
+ * line, to be completed with fresh ones; out takes hdrlen bytes */
+size_t http_copy_head(const char *buf, size_t hdrlen, char *out);
+
+/* whether the peer keeps the connection open after the message */
+static inline int
+http_keepalive(int minor, unsigned flags)
+{
+	return minor >= 1 ? !(flags & HTTP_F_CLOSE) : !!(flags & HTTP_F_KEEPALIVE);
+}
+
+void http_chunk_init(struct http_chunk *ck);
+/* feed body bytes, returns bytes belonging to the body (less than len
+ * only when the last chunk ends inside) or -1 on bad framing */
+ssize_t http_chunk_scan(struct http_chunk *ck, const char *p, size_t len);
+
+/* copy slice into a nul terminated string, truncating if needed */
+char *http_slice_str(const char *buf, struct http_slice s, char *to, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HTTP_H */
@@ -0,0 +1,276 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+
+#include "log.h"
+
+/* bounded MPSC queue: a slot is free for the producer at position pos
+ * when its seq is pos, holds a line when it is pos + 1, and is given
+ * back by the writer as pos + LOG_SLOTS */
+struct slot {
+	unsigned long	seq;
+	unsigned	len;
+	char		data[LOG_LINE - 16];
+} __attribute__((aligned(64)));
+
+static struct slot ring[LOG_SLOTS];
+
+/* written by every producer, kept off the other lines */
+static struct {
+	unsigned long	tail;
+} __attribute__((aligned(64))) prod;
+
+static struct {
+	unsigned long	dropped;
+	int		sleeping;	/* writer waits for the cond */
+} __attribute__((aligned(64))) shared;
+
+static unsigned long head;		/* writer only */
+static int logfd = STDERR_FILENO;
+static loglevel log_level = L_WARNING;
+static int stamped;
+static int running;
+static int stopping;
+static pthread_t tid;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+
+/* timestamp is formatted once a second per thread */
+static __thread time_t stamp_sec = -1;
+static __thread char stamp[24];
+static __thread size_t stamp_len;
+
+void
+log_init(int fd, loglevel level, int stamp)
+{
+	logfd = fd;
+	log_level = level;
+	stamped = stamp;
+}
+
+/* "stamp message\n" cut to size */
+static size_t
+log_format(char *buf, size_t size, const char *format, va_list ap)
+{
+	size_t len = 0;
+	int n;
+
+	if (stamped) {
+		struct timeval tv;
+
+		gettimeofday(&tv, NULL);
+		if (tv.tv_sec != stamp_sec) {
+			stamp_len = sizeof(stamp) - 1;
+			if (mk_tstamp(&tv, stamp, &stamp_len, 0) != 0)
+				stamp_len = 0;
+			stamp[stamp_len++] = ' ';
+			stamp_sec = tv.tv_sec;
+		}
+		memcpy(buf, stamp, stamp_len);
+		len = stamp_len;
+	}
+	n = vsnprintf(buf + len, size - len, format, ap);
+	if (n > 0)
+		len += n;
+	if (len > size - 1)
+		len = size - 1;
+	buf[len++] = '\n';
+	return len;
+}
+
+static struct slot *
+slot_claim(unsigned long *ppos)
+{
+	unsigned long pos = __atomic_load_n(&prod.tail, __ATOMIC_RELAXED), seq;
+	struct slot *s;
+
+	for (;;) {
+		s = &ring[pos & (LOG_SLOTS - 1)];
+		seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&prod.tail, &pos, pos + 1, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				*ppos = pos;
+				return s;
+			}
+		}
+		else if ((long)(seq - pos) < 0)
+			return NULL;	/* full */
+		else
+			pos = __atomic_load_n(&prod.tail, __ATOMIC_RELAXED);
+	}
+}
+
+int
+wrlog(loglevel level, const char *format, ...)
+{
+	char line[LOG_LINE];
+	unsigned long pos;
+	struct slot *s;
+	va_list ap;
+	size_t len;
+
+	if (level > log_level)
+		return 0;
+
+	if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+		va_start(ap, format);
+		len = log_format(line, sizeof(line), format, ap);
+		va_end(ap);
+		return write(logfd, line, len);
+	}
+
+	if (!(s = slot_claim(&pos))) {
+		__atomic_fetch_add(&shared.dropped, 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+	va_start(ap, format);
+	len = s->len = log_format(s->data, sizeof(s->data), format, ap);
+	va_end(ap);
+	__atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+
+	/* pairs with the writer setting sleeping before its last look */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&shared.sleeping, __ATOMIC_RELAXED)) {
+		pthread_mutex_lock(&lock);
+		pthread_cond_signal(&wake);
+		pthread_mutex_unlock(&lock);
+	}
+	return len;
+}
+
+static void
+write_all(struct iovec *iov, int n)
+{
+	ssize_t r;
+
+	while (n > 0) {
+		r = writev(logfd, iov, n);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return;		/* nowhere to report it */
+		}
+		while (n > 0 && (size_t)r >= iov->iov_len) {
+			r -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if (n > 0) {
+			iov->iov_base = (char *)iov->iov_base + r;
+			iov->iov_len -= r;
+		}
+	}
+}
+
+static int
+ring_ready(void)
+{
+	return __atomic_load_n(&ring[head & (LOG_SLOTS - 1)].seq, __ATOMIC_ACQUIRE) == head + 1;
+}
+
+static void *
+log_run(void *arg)
+{
+	struct iovec iov[LOG_BATCH];
+	unsigned long reported = 0, d;
+	struct timespec ts;
+	char msg[64];
+	int i, n;
+
+	for (;;) {
+		for (n = 0; n < LOG_BATCH; n++) {
+			struct slot *s = &ring[(head + n) & (LOG_SLOTS - 1)];
+			if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != head + n + 1)
+				break;
+			iov[n].iov_base = s->data;
+			iov[n].iov_len = s->len;
+		}
+		if (n > 0) {
+			write_all(iov, n);
+			for (i = 0; i < n; i++, head++)
+				__atomic_store_n(&ring[head & (LOG_SLOTS - 1)].seq,
+					head + LOG_SLOTS, __ATOMIC_RELEASE);
+		}
+
+		d = __atomic_load_n(&shared.dropped, __ATOMIC_RELAXED);
+		if (d != reported) {
+			iov[0].iov_base = msg;
+			iov[0].iov_len = snprintf(msg, sizeof(msg), "%lu log lines dropped\n",
+				d - reported);
+			write_all(iov, 1);
+			reported = d;
+		}
+		if (n > 0)
+			continue;
+
+		pthread_mutex_lock(&lock);
+		__atomic_store_n(&shared.sleeping, 1, __ATOMIC_SEQ_CST);
+		if (!ring_ready() && !stopping) {
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += LOG_IDLE_MS * 1000000L;
+			if (ts.tv_nsec >= 1000000000L) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&wake, &lock, &ts);
+		}
+		__atomic_store_n(&shared.sleeping, 0, __ATOMIC_RELAXED);
+		n = stopping && !ring_ready();
+		pthread_mutex_unlock(&lock);
+		if (n)
+			break;
+	}
+	return NULL;
+}
+
+int
+log_start(void)
+{
+	unsigned long i;
+	sigset_t all, old;
+	int rc;
+
+	for (i = 0; i < LOG_SLOTS; i++)
+		ring[i].seq = i;
+	prod.tail = head = 0;
+	stopping = 0;
+
+	/* signals stay with the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	rc = pthread_create(&tid, NULL, log_run, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (rc != 0) {
+		wrlog(L_ERROR, "Log thread create error: %s", strerror(rc));
+		return -1;
+	}
+	__atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+void
+log_stop(void)
+{
+	if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+		return;
+	pthread_mutex_lock(&lock);
+	stopping = 1;
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+	pthread_join(tid, NULL);
+	__atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+}
+
+unsigned long
+log_dropped(void)
+{
+	return __atomic_load_n(&shared.dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,33 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include "util.h"
+
+#define LOG_SLOTS	4096		/* lines the ring holds, power of two */
+#define LOG_LINE	512		/* slot size, longer lines are cut */
+#define LOG_BATCH	64		/* lines per writev() */
+#define LOG_IDLE_MS	100		/* writer naps at most that long */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* where wrlog() goes, lines up to level; stamped lines begin with
+ * the local time */
+void log_init(int fd, loglevel level, int stamped);
+
+/* from now on wrlog() only formats into a lock-free ring, a thread
+ * writes it out in batches; a line which doesn't fit is dropped and
+ * counted.  Must be called after fork(). */
+int log_start(void);
+
+/* drain the ring and write synchronously again */
+void log_stop(void);
+
+unsigned long log_dropped(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOG_H */
@@ -0,0 +1,777 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+
+#include "sfp.h"
+#include "sfp_opt.h"
+#include "relay.h"
+#include "worker.h"
+
+extern struct prog_opt sfp_opt;
+
+#define RELAY_AGAIN (-2)
+
+/* one direction of the relay: data read from 'from' is kept either in
+ * the user space ring or, in splice mode, in the pipe until written
+ * to 'to'; the ring is always drained before the pipe and its buffer
+ * released as soon as it is empty */
+struct flow {
+	int	from;
+	int	to;
+	struct ringbuf *rb;
+	int	*pipe;
+	size_t	*pipedata;
+	int64_t	*left;			/* message bytes still to read */
+	struct http_chunk *chunk;	/* chunked message, stop at its end */
+	int	splice;
+	int	keep;			/* keep sent data for a retry */
+	int	head;			/* response head is gathered, nothing sent */
+	int	server;			/* read from the server */
+	struct cache_obj *fill;		/* body read is stored as well */
+};
+
+static void
+flow_up(struct connect *c, struct flow *f)
+{
+	f->from		= c->cliio.fd;
+	f->to		= c->srvio.fd;
+	f->rb		= &c->clibuf;
+	f->pipe		= c->clipipe;
+	f->pipedata	= &c->clipipedata;
+	f->left		= &c->reqleft;
+	f->chunk	= c->reqchunked ? &c->reqchunk : NULL;
+	f->splice	= c->clisplice;
+	f->keep		= c->reused && !c->noretry && !c->resphdr;
+	f->head		= 0;
+	f->server	= 0;
+	f->fill		= NULL;
+}
+
+static void
+flow_down(struct connect *c, struct flow *f)
+{
+	f->from		= c->srvio.fd;
+	f->to		= c->cliio.fd;
+	f->rb		= &c->srvbuf;
+	f->pipe		= c->srvpipe;
+	f->pipedata	= &c->srvpipedata;
+	f->left		= &c->respleft;
+	f->chunk	= c->respchunked ? &c->chunk : NULL;
+	f->splice	= c->srvsplice;
+	f->keep		= 0;
+	f->head		= !c->tunnel && !c->resphdr;
+	f->server	= 1;
+	f->fill		= c->fill;
+}
+
+static inline int
+flow_empty(struct flow *f)
+{
+	return rb_empty(f->rb) && *f->pipedata == 0;
+}
+
+static inline int
+flow_space(struct flow *f)
+{
+	if (*f->left == 0 || (f->chunk && f->chunk->done))
+		return 0;
+	if (f->splice)
+		return *f->pipedata < RELAY_PIPE_SIZE;
+	if (!f->rb->buf)
+		return 1;
+	/* kept data is resent from the start, it must not be overwritten */
+	if (f->keep)
+		return f->rb->tail < f->rb->size;
+	/* the head may take the whole buffer, relay_head() rejects it then */
+	if (f->head)
+		return rb_used(f->rb) < f->rb->size;
+	/* refill only once a good part is sent, not byte by byte behind
+	 * a slow reader */
+	return rb_used(f->rb) <= f->rb->size / 2;
+}
+
+/* a mirrored ring if they are on, -1 - take a pooled buffer instead */
+static int
+ring_get(struct worker *w, struct ringbuf *rb)
+{
+	if (!sfp_opt.ringsize)
+		return -1;
+	if (w->nrings > 0)
+		rb->buf = w->rings[--w->nrings];
+	else if (w->ringfail)
+		return -1;
+	else if ((rb->buf = rb_mirror_map(sfp_opt.ringsize, sfp_opt.hugering)))
+		w->ringmaps++;
+	else {
+		/* huge pages may be not reserved, no use to try again */
+		w->ringfail = 1;
+		wrlog(L_WARNING, "Worker %d mirrored ring map error: %s, using pooled "
+			"buffers from now on", w->id, strerror(errno));
+		return -1;
+	}
+	rb->size = sfp_opt.ringsize;
+	rb->mirror = 1;
+	return 0;
+}
+
+/* buffer of an empty ring goes back where it came from */
+static void
+ring_release(struct worker *w, struct ringbuf *rb)
+{
+	if (!rb->mirror) {
+		buf_release(&w->bufs, &rb->buf, &rb->size);
+		return;
+	}
+	if (w->nrings < RING_CACHE_SIZE)
+		w->rings[w->nrings++] = rb->buf;
+	else
+		rb_mirror_unmap(rb->buf, rb->size);
+	rb->buf = NULL;
+	rb->size = 0;
+	rb->mirror = 0;
+}
+
+/* returns bytes read, 0 on EOF, -1 on error or RELAY_AGAIN; the ring
+ * is filled across its wrap with one readv() */
+static ssize_t
+flow_read(struct connect *c, struct flow *f)
+{
+	struct iovec iov[2];
+	size_t max;
+	ssize_t r;
+	int i, n = 0;
+
+	if (!flow_space(f))
+		return RELAY_AGAIN;
+
+	if (!f->splice && !f->rb->buf && ring_get(c->worker, f->rb) < 0 &&
+	    buf_acquire(&c->worker->bufs, &f->rb->buf, &f->rb->size, IOBUFSIZE, 0) < 0) {
+		wrlog(L_WARNING, "Buffer pool exhausted, dropping %s", c->cliaddr);
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	max = f->splice ? RELAY_PIPE_SIZE - *f->pipedata : f->rb->size;
+	if (*f->left > 0 && (uint64_t)*f->left < max)
+		max = *f->left;
+	if (!f->splice)
+		n = rb_space_iov(f->rb, iov, max, f->keep);
+
+	do {
+		if (f->splice)
+			r = splice(f->from, NULL, f->pipe[1], NULL, max,
+				SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		else
+			r = readv(f->from, iov, n);
+	} while (r < 0 && errno == EINTR);
+
+	if (r < 0)
+		return (errno == EAGAIN || errno == EWOULDBLOCK) ? RELAY_AGAIN : -1;
+
+	if (r > 0 && f->chunk) {
+		/* anything past the last chunk is not ours, and the stream
+		 * it was cut from can't carry another message */
+		size_t got = r, all = r, len;
+		ssize_t s;
+
+		for (r = 0, i = 0; i < n && got > 0; i++, got -= len) {
+			len = got < iov[i].iov_len ? got : iov[i].iov_len;
+			if ((s = http_chunk_scan(f->chunk, iov[i].iov_base, len)) < 0) {
+				errno = EPROTO;
+				return -1;
+			}
+			r += s;
+			if ((size_t)s < len)
+				break;
+		}
+		if ((size_t)r < all) {
+			if (f->server)
+				c->srvkeep = 0;
+			else
+				c->clikeep = 0;
+		}
+		if (f->chunk->done)
+			*f->left = 0;
+	}
+
+	if (r > 0 && f->fill) {
+		size_t got = r, len;
+
+		for (i = 0; got > 0; i++, got -= len) {
+			len = got < iov[i].iov_len ? got : iov[i].iov_len;
+			cache_fill(f->fill, iov[i].iov_base, len);
+		}
+	}
+
+	if (f->splice)
+		*f->pipedata += r;
+	else
+		f->rb->tail += r;
+	if (*f->left > 0)
+		*f->left -= r;
+	return r;
+}
+
+/* write out as much as possible, both parts of a wrapped ring go in
+ * one sendmsg(); returns -1 on error */
+static int
+flow_write(struct connect *c, struct flow *f)
+{
+	ssize_t r;
+
+	while (!rb_empty(f->rb)) {
+		r = rb_send(f->to, f->rb, MSG_NOSIGNAL);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		}
+		c->bytes += r;
+	}
+	/* side is idle, its buffer goes back to the pool */
+	if (!f->keep) {
+		rb_reset(f->rb);
+		ring_release(c->worker, f->rb);
+	}
+
+	while (*f->pipedata > 0) {
+		r = splice(f->pipe[0], NULL, f->to, NULL, *f->pipedata,
+			SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		}
+		if (r == 0)
+			return -1;
+		*f->pipedata -= r;
+		c->bytes += r;
+	}
+	return 0;
+}
+
+static int
+pipe_get(struct worker *w, int p[2])
+{
+	if (w->npipes > 0) {
+		w->npipes--;
+		p[0] = w->pipes[w->npipes][0];
+		p[1] = w->pipes[w->npipes][1];
+		return 0;
+	}
+
+	if (pipe2(p, O_NONBLOCK | O_CLOEXEC) < 0) {
+		wrlog(L_ERROR, "Pipe create error: %s", strerror(errno));
+		p[0] = p[1] = -1;
+		return -1;
+	}
+	/* not fatal, default size is the same on most systems */
+	(void) fcntl(p[1], F_SETPIPE_SZ, RELAY_PIPE_SIZE);
+	return 0;
+}
+
+/* a pipe still holding data can't be reused */
+static void
+pipe_put(struct worker *w, int p[2], size_t pending)
+{
+	if (p[0] < 0)
+		return;
+
+	if (pending == 0 && w->npipes < PIPE_CACHE_SIZE) {
+		w->pipes[w->npipes][0] = p[0];
+		w->pipes[w->npipes][1] = p[1];
+		w->npipes++;
+	}
+	else {
+		close(p[0]);
+		close(p[1]);
+	}
+	p[0] = p[1] = -1;
+}
+
+/* payload may bypass user space */
+static int
+splice_ok(struct connect *c)
+{
+	return sfp_opt.splice && !c->inspect;
+}
+
+void
+io_update(EV_P_ ev_io *w, int events)
+{
+	if (ev_is_active(w) && (w->events & (EV_READ | EV_WRITE)) == events)
+		return;
+	ev_io_stop(EV_A_ w);
+	if (events) {
+		ev_io_set(w, w->fd, events);
+		ev_io_start(EV_A_ w);
+	}
+}
+
+/* exchange is over: park or close the server side, then either wait
+ * for the next request from the client or close it too */
+static void
+relay_finish(EV_P_ struct connect *c)
+{
+	struct flow up;
+	int reqdone;
+
+	flow_up(c, &up);
+	reqdone = c->reqleft == 0 && flow_empty(&up);
+
+	ev_io_stop(EV_A_ &c->srvio);
+	if (c->srvkeep && reqdone && !c->srveof)
+		upstream_put(EV_A_ &c->worker->upstreams, c->srvio.fd, &c->srvsin);
+	else
+		close(c->srvio.fd);
+	c->srvio.fd = -1;
+
+	if (c->clikeep && reqdone && !c->clieof)
+		client_next(EV_A_ c);
+	else
+		connect_close(EV_A_ c);
+}
+
+/* recompute interest of both sockets, close connection when done */
+static void
+relay_update(EV_P_ struct connect *c)
+{
+	struct flow up, down;
+	int clievents = 0, srvevents = 0;
+
+	flow_up(c, &up);
+	flow_down(c, &down);
+
+	if (c->tunnel) {
+		if (c->srveof && flow_empty(&down)) {
+			connect_close(EV_A_ c);
+			return;
+		}
+		if (c->clieof && flow_empty(&up) && !c->srvshut) {
+			shutdown(c->srvio.fd, SHUT_WR);
+			c->srvshut = 1;
+		}
+	}
+	else if (c->respdone && flow_empty(&down)) {
+		relay_finish(EV_A_ c);
+		return;
+	}
+
+	if (!c->clieof && flow_space(&up))
+		clievents |= EV_READ;
+	/* a response head still being gathered is not the client's yet */
+	if (!flow_empty(&down) && (c->resphdr || c->tunnel))
+		clievents |= EV_WRITE;
+	if (!c->srveof && !c->respdone && flow_space(&down))
+		srvevents |= EV_READ;
+	if (!flow_empty(&up))
+		srvevents |= EV_WRITE;
+
+	io_update(EV_A_ &c->cliio, clievents);
+	io_update(EV_A_ &c->srvio, srvevents);
+}
+
+/* a pooled connection closed by the server before answering is retried
+ * once on another one, returns 1 if the connect was taken over */
+static int
+relay_retry(EV_P_ struct connect *c)
+{
+	if (!c->reused || c->noretry || c->resphdr || c->srvbuf.tail)
+		return 0;
+
+	wrlog(L_INFO, "Server %s:%d dropped kept-alive connection, retrying",
+		c->srvaddr, c->srvport);
+	c->noretry = 1;
+	c->reused = 0;
+	ev_io_stop(EV_A_ &c->srvio);
+	close(c->srvio.fd);
+	c->srvio.fd = -1;
+	c->srveof = 0;
+	c->clibuf.head = 0;
+	if (server_open(EV_A_ c) < 0) {
+		client_reply(c, badgw_hdr);
+		c->errors++;
+		connect_close(EV_A_ c);
+	}
+	return 1;
+}
+
+static inline void
+resp_check(struct connect *c)
+{
+	if (c->respleft == 0 || (c->respchunked && c->chunk.done))
+		c->respdone = 1;
+	if (c->respdone && c->fill) {
+		cache_fill_done(c->fill);
+		c->fill = NULL;
+	}
+}
+
+/* response head is gathered in srvbuf before anything is sent, on
+ * success the body framing is set up; returns -1 on a bad response */
+static int
+relay_head(struct connect *c)
+{
+	struct http_resp resp;
+	size_t extra;
+	int hl;
+
+	for (;;) {
+		hl = http_parse_response(c->srvbuf.buf, c->srvbuf.tail, &resp);
+		if (hl <= 0 || resp.status >= 200 || resp.status == 101)
+			break;
+		/* interim response, Expect is answered by us */
+		memmove(c->srvbuf.buf, c->srvbuf.buf + hl, c->srvbuf.tail - hl);
+		c->srvbuf.tail -= hl;
+	}
+	if (hl == 0)
+		return c->srvbuf.tail < c->srvbuf.size ? 0 : -1;
+	if (hl < 0)
+		return -1;
+
+	c->resphdr = 1;
+	if (!http_keepalive(resp.minor, resp.flags))
+		c->srvkeep = 0;
+	extra = c->srvbuf.tail - hl;
+
+	if (resp.status == 101) {
+		/* protocol switch, relay both ways until EOF */
+		c->tunnel = 1;
+		c->clikeep = c->srvkeep = 0;
+		c->reqleft = c->respleft = -1;
+		return 0;
+	}
+
+	if (c->nobody || resp.status == 204 || resp.status == 304)
+		c->respleft = 0;
+	else if (resp.flags & HTTP_F_CHUNKED) {
+		ssize_t n;
+
+		c->respchunked = 1;
+		c->respleft = -1;
+		http_chunk_init(&c->chunk);
+		n = http_chunk_scan(&c->chunk, c->srvbuf.buf + hl, extra);
+		if (n < 0)
+			return -1;
+		extra = n;
+	}
+	else if (resp.clen >= 0 && !(resp.flags & HTTP_F_TE))
+		c->respleft = resp.clen;
+	else {
+		/* delimited by close, client learns the end the same way */
+		c->respleft = -1;
+		c->srvkeep = c->clikeep = 0;
+	}
+
+	if (c->respleft >= 0) {
+		if ((uint64_t)c->respleft < extra)
+			extra = c->respleft;
+		c->respleft -= extra;
+	}
+	c->srvbuf.tail = hl + extra;
+
+	/* a response to store is read through the ring to be copied */
+	if (c->cachereq) {
+		c->fill = cache_fill_start(&c->worker->cache, c->cachereq, &resp,
+			c->srvbuf.buf, ev_now(c->worker->loop));
+		free(c->cachereq);
+		c->cachereq = NULL;
+		if (c->fill)
+			cache_fill(c->fill, c->srvbuf.buf + hl, extra);
+	}
+	resp_check(c);
+
+	if (!c->respdone && !c->respchunked && !c->fill && splice_ok(c))
+		c->srvsplice = pipe_get(c->worker, c->srvpipe) == 0;
+	return 0;
+}
+
+/* EOF from one side, returns -1 if the connect is gone */
+static int
+relay_eof(EV_P_ struct connect *c, int is_server)
+{
+	if (!is_server) {
+		c->clieof = 1;
+		if (c->tunnel)
+			return 0;
+		if (c->reqleft != 0) {
+			wrlog(L_INFO, "Client %s closed in the middle of request", c->cliaddr);
+			connect_close(EV_A_ c);
+			return -1;
+		}
+		c->clikeep = 0;
+		return 0;
+	}
+
+	c->srveof = 1;
+	if (c->tunnel)
+		return 0;
+	if (!c->resphdr) {
+		if (relay_retry(EV_A_ c))
+			return -1;
+		wrlog(L_INFO, "Server %s:%d closed without response", c->srvaddr, c->srvport);
+		client_reply(c, badgw_hdr);
+	}
+	else if (c->respleft < 0 && !c->respchunked) {
+		c->respdone = 1;
+		return 0;
+	}
+	else
+		wrlog(L_INFO, "Server %s:%d closed in the middle of response",
+			c->srvaddr, c->srvport);
+	c->errors++;
+	connect_close(EV_A_ c);
+	return -1;
+}
+
+/* handle readiness of one side: pull from it into 'in' and push the
+ * result right away, flush 'out' towards it */
+static void
+relay_io(EV_P_ struct connect *c, int revents, int is_server)
+{
+	struct flow up, down, *in, *out;
+
+	/* only moves the deadline, the wheel finds it later */
+	connect_timer(c, sfp_opt.idle_timeout);
+	flow_up(c, &up);
+	flow_down(c, &down);
+	in = is_server ? &down : &up;
+	out = is_server ? &up : &down;
+
+	if (revents & EV_READ) {
+		ssize_t r = flow_read(c, in);
+		if (r == 0) {
+			if (relay_eof(EV_A_ c, is_server) < 0)
+				return;
+		}
+		else if (r == -1) {
+			if (is_server && relay_retry(EV_A_ c))
+				return;
+			wrlog(L_INFO, "%s %s read error: %s",
+				is_server ? "Server" : "Client",
+				is_server ? c->srvaddr : c->cliaddr, strerror(errno));
+			goto error;
+		}
+		else if (r > 0 && is_server && !c->tunnel) {
+			if (!c->resphdr) {
+				if (relay_head(c) < 0) {
+					wrlog(L_INFO, "Bad response from %s:%d", c->srvaddr, c->srvport);
+					client_reply(c, badgw_hdr);
+					goto error;
+				}
+				if (!c->resphdr)
+					goto update;
+				hist_add(&c->worker->stats.ttfb, (ev_now(EV_A) - c->reqtime) * 1e6);
+				c->acc.verdict = ACC_OK;
+				flow_down(c, &down);
+			}
+			resp_check(c);
+		}
+		if (flow_write(c, in) < 0)
+			goto error;
+	}
+
+	if ((revents & EV_WRITE) && (is_server || c->resphdr || c->tunnel)) {
+		if (flow_write(c, out) < 0) {
+			if (!is_server && relay_retry(EV_A_ c))
+				return;
+			goto error;
+		}
+	}
+update:
+	relay_update(EV_A_ c);
+	return;
+error:
+	c->errors++;
+	connect_close(EV_A_ c);
+}
+
+static void
+relay_client_cb(EV_P_ ev_io *w, int revents)
+{
+	relay_io(EV_A_ CONNECT_OF(w, cliio), revents, 0);
+}
+
+static void
+relay_server_cb(EV_P_ ev_io *w, int revents)
+{
+	relay_io(EV_A_ CONNECT_OF(w, srvio), revents, 1);
+}
+
+void
+relay_free(struct connect *c)
+{
+	/* a response cut short is not stored */
+	if (c->fill) {
+		cache_fill_done(c->fill);
+		c->fill = NULL;
+	}
+	if (c->hit) {
+		cache_put(c->hit);
+		c->hit = NULL;
+	}
+	free(c->cachereq);
+	c->cachereq = NULL;
+	ring_release(c->worker, &c->clibuf);
+	ring_release(c->worker, &c->srvbuf);
+	pipe_put(c->worker, c->clipipe, c->clipipedata);
+	pipe_put(c->worker, c->srvpipe, c->srvpipedata);
+	c->clipipedata = c->srvpipedata = 0;
+}
+
+void
+relay_pipes_flush(struct worker *w)
+{
+	while (w->npipes > 0) {
+		w->npipes--;
+		close(w->pipes[w->npipes][0]);
+		close(w->pipes[w->npipes][1]);
+	}
+}
+
+void
+relay_rings_flush(struct worker *w)
+{
+	while (w->nrings > 0)
+		rb_mirror_unmap(w->rings[--w->nrings], sfp_opt.ringsize);
+}
+
+void
+relay_start(EV_P_ struct connect *c)
+{
+	struct flow up;
+
+	c->state = RELAY;
+	connect_timer(c, sfp_opt.idle_timeout);
+	if (c->tunnel)
+		c->acc.verdict = ACC_OK;
+	/* rest of the request body, or everything in a tunnel, may go
+	 * through pipes; the response head is always read into the buffer */
+	if (splice_ok(c) && c->reqleft != 0 && !c->reqchunked && !c->clisplice)
+		c->clisplice = pipe_get(c->worker, c->clipipe) == 0;
+	if (splice_ok(c) && c->tunnel && !c->srvsplice)
+		c->srvsplice = pipe_get(c->worker, c->srvpipe) == 0;
+
+	ev_set_cb(&c->cliio, relay_client_cb);
+	ev_set_cb(&c->srvio, relay_server_cb);
+
+	/* socket has just connected, push the request without waiting */
+	flow_up(c, &up);
+	if (flow_write(c, &up) < 0) {
+		if (relay_retry(EV_A_ c))
+			return;
+		wrlog(L_INFO, "Server %s write error: %s", c->srvaddr, strerror(errno));
+		c->errors++;
+		connect_close(EV_A_ c);
+		return;
+	}
+	relay_update(EV_A_ c);
+}
+
+/* stored head, the tail of it made for this client and the body, from
+ * where the last call stopped; a body on disk goes with sendfile() from
+ * its slab.  Returns bytes left or -1 on error */
+static ssize_t
+hit_write(struct connect *c)
+{
+	struct cache_obj *o = c->hit;
+	size_t body = c->nobody ? 0 : o->bodylen;
+	size_t head = o->headlen + c->hithdrlen, total = head + body;
+	struct iovec part[3] = {
+		{ o->head, o->headlen },
+		{ c->hithdr, c->hithdrlen },
+		{ o->body, o->slab ? 0 : body },
+	};
+	struct iovec iov[3];
+	struct msghdr msg;
+	size_t off;
+	off_t pos;
+	ssize_t r;
+	int i;
+
+	while (c->hitoff < total) {
+		if (o->slab && c->hitoff >= head) {
+			pos = o->off + (c->hitoff - head);
+			r = sendfile(c->cliio.fd, o->slab->fd, &pos, total - c->hitoff);
+			if (r == 0) {
+				errno = EIO;
+				return -1;
+			}
+		}
+		else {
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = iov;
+			for (i = 0, off = c->hitoff; i < 3; i++) {
+				if (off >= part[i].iov_len) {
+					off -= part[i].iov_len;
+					continue;
+				}
+				iov[msg.msg_iovlen].iov_base = (char *)part[i].iov_base + off;
+				iov[msg.msg_iovlen++].iov_len = part[i].iov_len - off;
+				off = 0;
+			}
+			r = sendmsg(c->cliio.fd, &msg, MSG_NOSIGNAL |
+				(o->slab && body ? MSG_MORE : 0));
+		}
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ?
+				(ssize_t)(total - c->hitoff) : -1;
+		}
+		c->hitoff += r;
+		c->bytes += r;
+	}
+	return 0;
+}
+
+static void
+hit_send(EV_P_ struct connect *c)
+{
+	ssize_t r = hit_write(c);
+
+	if (r < 0) {
+		wrlog(L_INFO, "Client %s write error: %s", c->cliaddr, strerror(errno));
+		c->errors++;
+		connect_close(EV_A_ c);
+		return;
+	}
+	if (r > 0) {
+		io_update(EV_A_ &c->cliio, EV_WRITE);
+		return;
+	}
+	if (c->clikeep)
+		client_next(EV_A_ c);
+	else
+		connect_close(EV_A_ c);
+}
+
+static void
+hit_client_cb(EV_P_ ev_io *w, int revents)
+{
+	struct connect *c = CONNECT_OF(w, cliio);
+
+	connect_timer(c, sfp_opt.idle_timeout);
+	hit_send(EV_A_ c);
+}
+
+void
+relay_hit(EV_P_ struct connect *c, struct cache_obj *o)
+{
+	int64_t age = o->age + (ev_now(EV_A) - o->stored);
+
+	c->hit = o;
+	c->hitoff = 0;
+	c->hithdrlen = snprintf(c->hithdr, sizeof(c->hithdr),
+		"Age: %lld\r\nConnection: %s\r\n\r\n", (long long)age,
+		c->clikeep ? "keep-alive" : "close");
+	c->state = RELAY;
+	c->acc.verdict = ACC_HIT;
+	connect_timer(c, sfp_opt.idle_timeout);
+	ev_set_cb(&c->cliio, hit_client_cb);
+	hist_add(&c->worker->stats.ttfb, (ev_now(EV_A) - c->reqtime) * 1e6);
+	hit_send(EV_A_ c);
+}
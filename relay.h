@@ -0,0 +1,43 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include "sfp.h"
+
+/* size of every splice pipe, bytes in flight per direction */
+#define RELAY_PIPE_SIZE (64 * 1024)
+
+/* number of idle pipes kept by a worker for reuse */
+#define PIPE_CACHE_SIZE 64
+
+/* number of idle mirrored rings kept by a worker, mapping them is a
+ * handful of syscalls */
+#define RING_CACHE_SIZE 64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* switch connection to RELAY state, request already sits in clireadbuf */
+void relay_start(EV_P_ struct connect *c);
+
+/* answer from the cache with o, whose reference the connection takes;
+ * the server is not contacted */
+void relay_hit(EV_P_ struct connect *c, struct cache_obj *o);
+
+/* release buffers and splice pipes of a connection */
+void relay_free(struct connect *c);
+
+/* close pipes cached by the worker */
+void relay_pipes_flush(struct worker *w);
+
+/* unmap mirrored rings cached by the worker */
+void relay_rings_flush(struct worker *w);
+
+/* watch fd for events only, stopping the watcher if none */
+void io_update(EV_P_ ev_io *w, int events);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RELAY_H */
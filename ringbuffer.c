@@ -1,125 +1,122 @@
 #include <assert.h>
-#include <stdlib.h>
+#include <errno.h>
+#include <stdint.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
 
-#include <stdio.h>
-
 #include "ringbuffer.h"
 
-struct ringbuf *
-rb_new(size_t capacity)
-{
-	struct ringbuf *rb = malloc(sizeof(*rb) + capacity);
-	if (rb == NULL)
-		return NULL;
-
-	rb->capacity	= capacity;
-	rb->tail	= 0;
-	rb->over	= 0;
-	return rb;
-};
-
-void
-rb_reset(struct ringbuf *rb)
-{
-	assert(rb != NULL);
-	rb->tail = 0;
-	rb->over = 0;
-}
-
-size_t
-rb_size(struct ringbuf *rb)
-{
-	return rb->tail;
-}
-
 char *
-rb_tailptr(struct ringbuf *rb)
+rb_mirror_map(size_t size, int huge)
 {
-	return rb->buff + rb->tail;
+	size_t align = huge ? RB_HUGE_PAGE : (size_t)sysconf(_SC_PAGESIZE);
+	char *area, *buf;
+	int fd, err;
+
+	if (size == 0 || size % align) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if ((fd = memfd_create("sfp-ring", MFD_CLOEXEC | (huge ? MFD_HUGETLB : 0))) < 0)
+		return NULL;
+	if (ftruncate(fd, size) < 0)
+		goto fail;
+
+	/* reserve room for both views, huge pages want an aligned start */
+	area = mmap(NULL, 2 * size + align, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (area == MAP_FAILED)
+		goto fail;
+	buf = (char *)(((uintptr_t)area + align - 1) & ~(uintptr_t)(align - 1));
+	if (buf > area)
+		munmap(area, buf - area);
+	munmap(buf + 2 * size, area + align - buf);
+
+	if (mmap(buf, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+	    mmap(buf + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		err = errno;
+		munmap(buf, 2 * size);
+		errno = err;
+		goto fail;
+	}
+	close(fd);
+	return buf;
+fail:
+	err = errno;
+	close(fd);
+	errno = err;
+	return NULL;
 }
 
 void
-rb_append(struct ringbuf *rb, const void *data, size_t count)
+rb_mirror_unmap(char *buf, size_t size)
 {
-	ssize_t free = rb->capacity - rb->tail;
-	if (count > free) {
-		rb->over = 1;
-
-		memcpy(rb->buff + rb->tail, data, free);
-		rb->tail = 0;
-		data += free;
-		count -= free;
-	}
-
-	memcpy(rb->buff + rb->tail, data, count);
+	munmap(buf, 2 * size);
 }
 
-size_t
-rb_recv(int fd, struct ringbuf *rb, int flags, size_t maxb)
+int
+rb_data_iov(const struct ringbuf *rb, struct iovec iov[2])
 {
-	size_t free = rb->capacity - rb->tail;
-	if (maxb > 0 && maxb < free)
-		free = maxb;
-	ssize_t r = recv(fd, rb->buff + rb->tail, free, flags);
-
-	if (r <= 0)
-		return r;
-
-	if (r < free) {
-		rb->tail += r;
-	} else {
-		rb->tail = 0;
-		rb->over = 1;
+	size_t used = rb_used(rb), pos, first;
+
+	if (used == 0)
+		return 0;
+	pos = rb->head % rb->size;
+	first = rb->size - pos;
+	iov[0].iov_base = rb->buf + pos;
+	if (used <= first || rb->mirror) {
+		iov[0].iov_len = used;
+		return 1;
 	}
-
-//printf("recv:%zi rb_size:%zi over:%i\n", r, rb_size(rb), rb->over);
-
-	return r;
+	iov[0].iov_len = first;
+	iov[1].iov_base = rb->buf;
+	iov[1].iov_len = used - first;
+	return 2;
 }
 
-void
-rb_iovec(struct ringbuf *rb, struct iovec *iov, ssize_t pos)
+int
+rb_space_iov(const struct ringbuf *rb, struct iovec iov[2], size_t max, int linear)
 {
-	if (rb->over) {
-		if (pos < 0)
-			pos = rb->tail;
-
-		iov->iov_base = rb->buff + pos;
-		if (rb->tail <= pos)
-			iov->iov_len = rb->capacity - pos;
-		else
-			iov->iov_len = rb->tail - pos;
-	} else {
-		if (pos < 0)
-			pos = 0;
-		iov->iov_base = rb->buff + pos;
-		iov->iov_len = rb->tail;
+	size_t room = rb->size - rb_used(rb), pos, first;
+
+	assert(rb_used(rb) <= rb->size);
+	if (linear)
+		room = rb->tail < rb->size ? rb->size - rb->tail : 0;
+	if (max > 0 && max < room)
+		room = max;
+	if (room == 0)
+		return 0;
+	pos = rb->tail % rb->size;
+	first = rb->size - pos;
+	iov[0].iov_base = rb->buf + pos;
+	if (room <= first || rb->mirror) {
+		iov[0].iov_len = room;
+		return 1;
 	}
+	iov[0].iov_len = first;
+	iov[1].iov_base = rb->buf;
+	iov[1].iov_len = room - first;
+	return 2;
 }
 
 ssize_t
-rb_calcpos(struct ringbuf *rb, ssize_t pos, ssize_t offset)
-{
-	if (pos < 0)
-		pos = rb->over ? rb->tail : 0;
-	pos += offset;
-	if (pos < rb->capacity)
-		return pos;
-	return 0;
-}
-
-void
-rb_shift(struct ringbuf *rb, char *to, size_t len)
+rb_send(int fd, struct ringbuf *rb, int flags)
 {
-	char *from = to + len;
-	size_t count = rb->tail - (to - rb->buff + len);
-	if (count != 0)
-		memcpy(to, from, count);
-	rb->tail -= len;
+	struct iovec iov[2];
+	struct msghdr msg;
+	ssize_t r;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = rb_data_iov(rb, iov);
+	if (msg.msg_iovlen == 0)
+		return 0;
+	r = sendmsg(fd, &msg, flags);
+	if (r > 0)
+		rb->head += r;
+	return r;
 }
-
@@ -1,24 +1,68 @@
 #ifndef RINGBUFFER_H
 #define RINGBUFFER_H
 
-#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
 struct iovec;
 
+/* relay ring: holds the stream bytes [head, tail), head counts bytes
+ * taken out and tail bytes put in since the ring was last empty, a
+ * byte lives at buf[count % size]; until the first wrap the data is
+ * plain buf[head..tail), which is what the header parsers rely on.
+ * A mirrored ring has the same pages mapped once more right after
+ * buf, so its data and its free space are always contiguous */
 struct ringbuf {
-	size_t capacity;
-	size_t tail;
-	char   over;
-	char   buff[];
+	char	*buf;		/* pooled, NULL while the ring is idle */
+	size_t	size;
+	size_t	head;
+	size_t	tail;
+	int	mirror;
 };
 
-struct ringbuf *rb_new(size_t capacity);
+/* huge page size mirrored rings are rounded to */
+#define RB_HUGE_PAGE	(2 << 20)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static inline size_t
+rb_used(const struct ringbuf *rb)
+{
+	return rb->tail - rb->head;
+}
+
+static inline int
+rb_empty(const struct ringbuf *rb)
+{
+	return rb->head == rb->tail;
+}
+
+static inline void
+rb_reset(struct ringbuf *rb)
+{
+	rb->head = rb->tail = 0;
+}
+
+/* memfd of size bytes mapped twice back to back, size is a multiple of
+ * the page size, or of RB_HUGE_PAGE with huge pages; NULL on error */
+char *rb_mirror_map(size_t size, int huge);
+void rb_mirror_unmap(char *buf, size_t size);
+
+/* queued bytes as at most two iovecs, returns their number */
+int rb_data_iov(const struct ringbuf *rb, struct iovec iov[2]);
+
+/* up to max bytes of free space as at most two iovecs, returns
+ * their number; linear keeps the ring from wrapping, so that it can
+ * be read again from the start */
+int rb_space_iov(const struct ringbuf *rb, struct iovec iov[2], size_t max, int linear);
+
+/* sendmsg() of everything queued in one call, whatever the socket
+ * takes is dropped from the ring, the rest stays for the next call */
+ssize_t rb_send(int fd, struct ringbuf *rb, int flags);
+
+#ifdef __cplusplus
+}
+#endif
 
-void rb_reset(struct ringbuf *rb);
-void rb_append(struct ringbuf *rb, const void *data, size_t count);
-size_t rb_size(struct ringbuf *rb);
-char * rb_tailptr(struct ringbuf *rb);
-size_t rb_recv(int fd, struct ringbuf *rb, int flags, size_t maxb);
-void rb_iovec(struct ringbuf *rb, struct iovec *iov, ssize_t pos);
-ssize_t rb_calcpos(struct ringbuf *rb, ssize_t pos, ssize_t offset);
-void rb_shift(struct ringbuf *rb, char *to, size_t len);
 #endif
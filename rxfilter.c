@@ -0,0 +1,840 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rxfilter.h"
+
+enum {
+	OP_SET,			/* consume a byte in sets[x] */
+	OP_SPLIT,		/* continue at x and y */
+	OP_JMP,
+	OP_MATCH,		/* rule x matched */
+	OP_MATCH_EOL		/* rule x matched if the input ends here */
+};
+
+/*
+ * parser: ERE subset, byte oriented
+ *	. [...] [^...] \d \w \s \D \W \S \n \r \t \xHH \<punct>
+ *	* + ? {m} {m,} {m,n} | (...) (?:...)
+ *	^ at the start and $ at the end of a rule, (?i) prefix
+ */
+
+enum { N_SET, N_EMPTY, N_CAT, N_ALT, N_REP };
+
+struct node {
+	int		type;
+	int		set;		/* N_SET */
+	int		a, b;		/* children */
+	int		min, max;	/* N_REP, max -1 - unbounded */
+};
+
+struct parser {
+	struct rxprog	*prog;
+	const char	*s;
+	const char	*err;
+	struct node	*nodes;
+	int		nnodes, nodesize;
+	int		icase;
+	int		depth;
+};
+
+#define RX_MAX_DEPTH	64
+#define RX_MAX_REPEAT	1000
+
+static inline void
+set_add(struct rxset *s, unsigned c)
+{
+	s->bits[c >> 5] |= 1u << (c & 31);
+}
+
+static inline int
+set_has(const struct rxset *s, unsigned c)
+{
+	return s->bits[c >> 5] & (1u << (c & 31));
+}
+
+static void
+set_range(struct rxset *s, unsigned from, unsigned to)
+{
+	for (; from <= to; from++)
+		set_add(s, from);
+}
+
+static int
+grow(void **p, int *cap, int need, size_t elsize)
+{
+	int n = *cap ? *cap : 16;
+	void *np;
+
+	if (need <= *cap)
+		return 0;
+	while (n < need)
+		n *= 2;
+	if (!(np = realloc(*p, (size_t)n * elsize)))
+		return -1;
+	*p = np;
+	*cap = n;
+	return 0;
+}
+
+static int
+new_set(struct parser *ps)
+{
+	struct rxprog *p = ps->prog;
+
+	if (grow((void **)&p->sets, &p->setsize, p->nsets + 1, sizeof(*p->sets)) < 0) {
+		ps->err = "out of memory";
+		return -1;
+	}
+	memset(&p->sets[p->nsets], 0, sizeof(p->sets[0]));
+	return p->nsets++;
+}
+
+static int
+new_node(struct parser *ps, int type, int a, int b)
+{
+	struct node *n;
+
+	if (grow((void **)&ps->nodes, &ps->nodesize, ps->nnodes + 1, sizeof(*ps->nodes)) < 0) {
+		ps->err = "out of memory";
+		return -1;
+	}
+	n = &ps->nodes[ps->nnodes];
+	memset(n, 0, sizeof(*n));
+	n->type = type;
+	n->a = a;
+	n->b = b;
+	return ps->nnodes++;
+}
+
+static void
+set_fold(struct rxset *s)
+{
+	unsigned c;
+
+	for (c = 'a'; c <= 'z'; c++)
+		if (set_has(s, c) || set_has(s, c - 32)) {
+			set_add(s, c);
+			set_add(s, c - 32);
+		}
+}
+
+static int
+hexval(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/* escape after '\' into set, returns -1 on error */
+static int
+parse_escape(struct parser *ps, struct rxset *s)
+{
+	struct rxset t;
+	int c = *ps->s++, neg = 0, i, h, l;
+
+	memset(&t, 0, sizeof(t));
+	switch (c) {
+	case 0:
+		ps->err = "trailing backslash";
+		return -1;
+	case 'D': neg = 1; /* fall through */
+	case 'd':
+		set_range(&t, '0', '9');
+		break;
+	case 'W': neg = 1; /* fall through */
+	case 'w':
+		set_range(&t, '0', '9');
+		set_range(&t, 'a', 'z');
+		set_range(&t, 'A', 'Z');
+		set_add(&t, '_');
+		break;
+	case 'S': neg = 1; /* fall through */
+	case 's':
+		set_add(&t, ' ');
+		set_range(&t, '\t', '\r');
+		break;
+	case 'n': set_add(&t, '\n'); break;
+	case 'r': set_add(&t, '\r'); break;
+	case 't': set_add(&t, '\t'); break;
+	case 'x':
+		if ((h = hexval(ps->s[0])) < 0 || (l = hexval(ps->s[1])) < 0) {
+			ps->err = "bad \\x escape";
+			return -1;
+		}
+		ps->s += 2;
+		set_add(&t, h << 4 | l);
+		break;
+	default:
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+			ps->err = "unknown escape";
+			return -1;
+		}
+		set_add(&t, (unsigned char)c);
+	}
+	for (i = 0; i < 8; i++)
+		s->bits[i] |= neg ? ~t.bits[i] : t.bits[i];
+	return 0;
+}
+
+static int
+parse_class(struct parser *ps, struct rxset *s)
+{
+	int neg = 0, i, first = 1;
+	unsigned lo, hi;
+
+	if (*ps->s == '^') {
+		neg = 1;
+		ps->s++;
+	}
+	while (*ps->s && (*ps->s != ']' || first)) {
+		first = 0;
+		if (*ps->s == '\\') {
+			struct rxset t;
+			const char *at = ++ps->s;
+			memset(&t, 0, sizeof(t));
+			if (parse_escape(ps, &t) < 0)
+				return -1;
+			/* single byte escape may start a range */
+			if (ps->s - at > 1 || strchr("dDwWsS", *at)) {
+				for (i = 0; i < 8; i++)
+					s->bits[i] |= t.bits[i];
+				continue;
+			}
+			for (lo = 0; !set_has(&t, lo); lo++)
+				;
+		}
+		else
+			lo = (unsigned char)*ps->s++;
+		hi = lo;
+		if (ps->s[0] == '-' && ps->s[1] && ps->s[1] != ']') {
+			ps->s++;
+			if (*ps->s == '\\') {
+				ps->err = "escape as range end";
+				return -1;
+			}
+			hi = (unsigned char)*ps->s++;
+			if (hi < lo) {
+				ps->err = "bad range";
+				return -1;
+			}
+		}
+		set_range(s, lo, hi);
+	}
+	if (*ps->s != ']') {
+		ps->err = "missing ]";
+		return -1;
+	}
+	ps->s++;
+	if (neg)
+		for (i = 0; i < 8; i++)
+			s->bits[i] = ~s->bits[i];
+	return 0;
+}
+
+static int parse_alt(struct parser *ps);
+
+static int
+parse_atom(struct parser *ps)
+{
+	int n, set;
+	struct rxset *s;
+
+	if (*ps->s == '(') {
+		ps->s++;
+		if (ps->s[0] == '?' && ps->s[1] == ':')
+			ps->s += 2;
+		if (++ps->depth > RX_MAX_DEPTH) {
+			ps->err = "nested too deep";
+			return -1;
+		}
+		if ((n = parse_alt(ps)) < 0)
+			return -1;
+		ps->depth--;
+		if (*ps->s != ')') {
+			ps->err = "missing )";
+			return -1;
+		}
+		ps->s++;
+		return n;
+	}
+
+	if ((set = new_set(ps)) < 0)
+		return -1;
+	s = &ps->prog->sets[set];
+	switch (*ps->s) {
+	case '[':
+		ps->s++;
+		if (parse_class(ps, s) < 0)
+			return -1;
+		break;
+	case '.':
+		ps->s++;
+		set_range(s, 0, 255);
+		s->bits['\n' >> 5] &= ~(1u << ('\n' & 31));
+		break;
+	case '\\':
+		ps->s++;
+		if (parse_escape(ps, s) < 0)
+			return -1;
+		break;
+	case '^': case '$':
+		ps->err = "anchor inside expression";
+		return -1;
+	case '*': case '+': case '?': case '{':
+		ps->err = "nothing to repeat";
+		return -1;
+	default:
+		set_add(s, (unsigned char)*ps->s++);
+	}
+	if (ps->icase)
+		set_fold(s);
+	if ((n = new_node(ps, N_SET, -1, -1)) >= 0)
+		ps->nodes[n].set = set;
+	return n;
+}
+
+static int
+parse_count(struct parser *ps, int *v)
+{
+	const char *from = ps->s;
+
+	for (*v = 0; *ps->s >= '0' && *ps->s <= '9'; ps->s++)
+		if ((*v = *v * 10 + *ps->s - '0') > RX_MAX_REPEAT) {
+			ps->err = "repeat count too large";
+			return -1;
+		}
+	return ps->s > from ? 0 : -1;
+}
+
+static int
+parse_rep(struct parser *ps)
+{
+	int n = parse_atom(ps), min, max, r;
+
+	while (n >= 0) {
+		switch (*ps->s) {
+		case '*': min = 0; max = -1; ps->s++; break;
+		case '+': min = 1; max = -1; ps->s++; break;
+		case '?': min = 0; max = 1; ps->s++; break;
+		case '{':
+			ps->s++;
+			if (parse_count(ps, &min) < 0)
+				goto badrep;
+			max = min;
+			if (*ps->s == ',') {
+				ps->s++;
+				max = -1;
+				if (*ps->s != '}' && parse_count(ps, &max) < 0)
+					goto badrep;
+			}
+			if (*ps->s != '}' || (max >= 0 && max < min))
+				goto badrep;
+			ps->s++;
+			break;
+		default:
+			return n;
+		}
+		if ((r = new_node(ps, N_REP, n, -1)) < 0)
+			return -1;
+		ps->nodes[r].min = min;
+		ps->nodes[r].max = max;
+		n = r;
+	}
+	return n;
+badrep:
+	if (!ps->err)
+		ps->err = "bad repeat";
+	return -1;
+}
+
+static int
+parse_cat(struct parser *ps)
+{
+	int n = -1, r;
+
+	while (*ps->s && *ps->s != '|' && *ps->s != ')') {
+		if ((r = parse_rep(ps)) < 0)
+			return -1;
+		if (n >= 0 && (r = new_node(ps, N_CAT, n, r)) < 0)
+			return -1;
+		n = r;
+	}
+	return n >= 0 ? n : new_node(ps, N_EMPTY, -1, -1);
+}
+
+static int
+parse_alt(struct parser *ps)
+{
+	int n = parse_cat(ps), r;
+
+	while (n >= 0 && *ps->s == '|') {
+		ps->s++;
+		if ((r = parse_cat(ps)) < 0 || (r = new_node(ps, N_ALT, n, r)) < 0)
+			return -1;
+		n = r;
+	}
+	return n;
+}
+
+/*
+ * code generation, Thompson construction
+ */
+
+static int
+emit(struct parser *ps, int op, int x, int y)
+{
+	struct rxprog *p = ps->prog;
+
+	if (p->ninst >= RX_MAX_INST) {
+		ps->err = "expression too large";
+		return -1;
+	}
+	if (grow((void **)&p->inst, &p->instsize, p->ninst + 1, sizeof(*p->inst)) < 0) {
+		ps->err = "out of memory";
+		return -1;
+	}
+	p->inst[p->ninst].op = op;
+	p->inst[p->ninst].x = x;
+	p->inst[p->ninst].y = y;
+	return p->ninst++;
+}
+
+static int
+gen(struct parser *ps, int n)
+{
+	struct rxprog *p = ps->prog;
+	struct node *nd = &ps->nodes[n];
+	int i, l1, l2;
+
+	switch (nd->type) {
+	case N_EMPTY:
+		return 0;
+	case N_SET:
+		return emit(ps, OP_SET, nd->set, 0) < 0 ? -1 : 0;
+	case N_CAT:
+		return gen(ps, nd->a) < 0 || gen(ps, nd->b) < 0 ? -1 : 0;
+	case N_ALT:
+		if ((l1 = emit(ps, OP_SPLIT, 0, 0)) < 0)
+			return -1;
+		p->inst[l1].x = p->ninst;
+		if (gen(ps, nd->a) < 0 || (l2 = emit(ps, OP_JMP, 0, 0)) < 0)
+			return -1;
+		p->inst[l1].y = p->ninst;
+		if (gen(ps, nd->b) < 0)
+			return -1;
+		p->inst[l2].x = p->ninst;
+		return 0;
+	}
+
+	/* N_REP: min copies, then either a loop or max - min optional ones */
+	for (i = 0; i < nd->min; i++)
+		if (gen(ps, nd->a) < 0)
+			return -1;
+	if (nd->max < 0) {
+		if ((l1 = emit(ps, OP_SPLIT, 0, 0)) < 0)
+			return -1;
+		p->inst[l1].x = p->ninst;
+		if (gen(ps, nd->a) < 0 || emit(ps, OP_JMP, l1, 0) < 0)
+			return -1;
+		p->inst[l1].y = p->ninst;
+		return 0;
+	}
+	for (i = nd->min; i < nd->max; i++) {
+		if ((l1 = emit(ps, OP_SPLIT, 0, 0)) < 0)
+			return -1;
+		p->inst[l1].x = p->ninst;
+		if (gen(ps, nd->a) < 0)
+			return -1;
+		p->inst[l1].y = p->ninst;
+	}
+	return 0;
+}
+
+int
+rxprog_init(struct rxprog *p)
+{
+	memset(p, 0, sizeof(*p));
+	p->cachemax = RX_CACHE_SIZE;
+	return 0;
+}
+
+void
+rxprog_free(struct rxprog *p)
+{
+	int i;
+
+	for (i = 0; i < p->nrules; i++)
+		free(p->text[i]);
+	free(p->text);
+	free(p->starts);
+	free(p->anchored);
+	free(p->inst);
+	free(p->sets);
+	memset(p, 0, sizeof(*p));
+}
+
+int
+rxprog_add(struct rxprog *p, const char *re, char *err, size_t errlen)
+{
+	struct parser ps;
+	int ninst = p->ninst, nsets = p->nsets, cap, root, eol = 0, anchored = 0;
+	size_t len;
+	char *text, *body;
+
+	memset(&ps, 0, sizeof(ps));
+	ps.prog = p;
+	if (!(text = strdup(re)) || !(body = strdup(re))) {
+		free(text);
+		snprintf(err, errlen, "out of memory");
+		return -1;
+	}
+
+	/* anchors and flags are only recognized around the expression */
+	ps.s = body;
+	if (strncmp(ps.s, "(?i)", 4) == 0) {
+		ps.icase = 1;
+		ps.s += 4;
+	}
+	if (*ps.s == '^') {
+		anchored = 1;
+		ps.s++;
+	}
+	len = strlen(ps.s);
+	if (len > 0 && ps.s[len - 1] == '$' && (len < 2 || ps.s[len - 2] != '\\')) {
+		body[ps.s - body + len - 1] = 0;
+		eol = 1;
+	}
+
+	root = parse_alt(&ps);
+	if (root >= 0 && *ps.s)
+		ps.err = *ps.s == ')' ? "unbalanced )" : "syntax error";
+	cap = p->rulesize;
+	if (!ps.err &&
+	    (grow((void **)&p->starts, &cap, p->nrules + 1, sizeof(int)) < 0 ||
+	     (cap = p->rulesize, grow((void **)&p->anchored, &cap, p->nrules + 1, sizeof(int)) < 0) ||
+	     grow((void **)&p->text, &p->rulesize, p->nrules + 1, sizeof(char *)) < 0))
+		ps.err = "out of memory";
+	if (!ps.err) {
+		p->starts[p->nrules] = p->ninst;
+		if (gen(&ps, root) == 0)
+			emit(&ps, eol ? OP_MATCH_EOL : OP_MATCH, p->nrules, 0);
+	}
+	free(ps.nodes);
+	free(body);
+
+	if (ps.err) {
+		/* drop whatever this rule produced */
+		p->ninst = ninst;
+		p->nsets = nsets;
+		snprintf(err, errlen, "%s", ps.err);
+		free(text);
+		return -1;
+	}
+	p->anchored[p->nrules] = anchored;
+	p->text[p->nrules++] = text;
+	return 0;
+}
+
+/* split bytes into classes no set tells apart */
+int
+rxprog_compile(struct rxprog *p)
+{
+	int cls[256], remap[512], i, b, n;
+
+	memset(cls, 0, sizeof(cls));
+	for (i = 0; i < p->nsets; i++) {
+		/* refine every class by membership in this set */
+		for (b = 0; b < 512; b++)
+			remap[b] = -1;
+		for (n = 0, b = 0; b < 256; b++) {
+			int key = cls[b] << 1 | !!set_has(&p->sets[i], b);
+			if (remap[key] < 0)
+				remap[key] = n++;
+			cls[b] = remap[key];
+		}
+	}
+	/* ids are numbered in byte order, first byte seen represents it */
+	for (n = 0, b = 0; b < 256; b++) {
+		if (cls[b] == n)
+			p->classrep[n++] = b;
+		p->classmap[b] = cls[b];
+	}
+	p->nclasses = n;
+	return 0;
+}
+
+/*
+ * lazy DFA
+ */
+
+struct rxstate {
+	struct rxstate	*hnext;
+	uint32_t	hash;
+	int		match;		/* rule matched, search is over */
+	int		eolmatch;	/* rule matched if input ends here */
+	int		npcs;
+	struct rxstate	**next;		/* by class, NULL - not built yet */
+	uint32_t	pcs[];
+};
+
+void
+rxcache_init(struct rxcache *c)
+{
+	memset(c, 0, sizeof(*c));
+}
+
+static void
+cache_flush(struct rxcache *c)
+{
+	struct rxstate *s, *n;
+	int i;
+
+	if (c->table)
+		for (i = 0; i < RX_BUCKETS; i++) {
+			for (s = c->table[i]; s; s = n) {
+				n = s->hnext;
+				free(s);
+			}
+			c->table[i] = NULL;
+		}
+	c->start = NULL;
+	c->bytes = 0;
+}
+
+void
+rxcache_free(struct rxcache *c)
+{
+	cache_flush(c);
+	free(c->table);
+	free(c->set[0]);
+	free(c->set[1]);
+	free(c->stack);
+	free(c->mark);
+	memset(c, 0, sizeof(*c));
+}
+
+static int
+cache_bind(struct rxcache *c, const struct rxprog *p)
+{
+	struct rxstats stats = c->stats;
+	size_t n = p->ninst + 1;
+
+	rxcache_free(c);
+	c->stats = stats;
+	c->table = calloc(RX_BUCKETS, sizeof(*c->table));
+	c->set[0] = malloc(n * sizeof(uint32_t));
+	c->set[1] = malloc(n * sizeof(uint32_t));
+	c->stack = malloc((2 * n + 1) * sizeof(uint32_t));
+	c->mark = calloc(n, sizeof(uint32_t));
+	if (!c->table || !c->set[0] || !c->set[1] || !c->stack || !c->mark) {
+		rxcache_free(c);
+		return -1;
+	}
+	c->prog = p;
+	return 0;
+}
+
+/* add pc and everything reachable from it without input */
+static int
+closure(struct rxcache *c, uint32_t pc, uint32_t *out, int n)
+{
+	const struct rxinst *in = c->prog->inst;
+	int sp = 0;
+
+	c->stack[sp++] = pc;
+	while (sp > 0) {
+		pc = c->stack[--sp];
+		if (c->mark[pc] == c->gen)
+			continue;
+		c->mark[pc] = c->gen;
+		switch (in[pc].op) {
+		case OP_SPLIT:
+			c->stack[sp++] = in[pc].y;
+			c->stack[sp++] = in[pc].x;
+			break;
+		case OP_JMP:
+			c->stack[sp++] = in[pc].x;
+			break;
+		default:
+			out[n++] = pc;
+		}
+	}
+	return n;
+}
+
+static int
+cmp_pc(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void
+new_gen(struct rxcache *c)
+{
+	if (++c->gen == 0) {
+		memset(c->mark, 0, (c->prog->ninst + 1) * sizeof(uint32_t));
+		c->gen = 1;
+	}
+}
+
+/* NFA set after byte b, unanchored rules restart at every position */
+static int
+step(struct rxcache *c, const uint32_t *in, int nin, unsigned b, uint32_t *out)
+{
+	const struct rxprog *p = c->prog;
+	int i, n = 0;
+
+	new_gen(c);
+	for (i = 0; i < nin; i++) {
+		const struct rxinst *ins = &p->inst[in[i]];
+		if (ins->op == OP_SET && set_has(&p->sets[ins->x], b))
+			n = closure(c, in[i] + 1, out, n);
+	}
+	for (i = 0; i < p->nrules; i++)
+		if (!p->anchored[i])
+			n = closure(c, p->starts[i], out, n);
+	qsort(out, n, sizeof(*out), cmp_pc);
+	return n;
+}
+
+static int
+start_set(struct rxcache *c, uint32_t *out)
+{
+	const struct rxprog *p = c->prog;
+	int i, n = 0;
+
+	new_gen(c);
+	for (i = 0; i < p->nrules; i++)
+		n = closure(c, p->starts[i], out, n);
+	qsort(out, n, sizeof(*out), cmp_pc);
+	return n;
+}
+
+static void
+set_matches(const struct rxprog *p, const uint32_t *pcs, int n, int *match, int *eolmatch)
+{
+	int i;
+
+	*match = *eolmatch = RX_NONE;
+	for (i = 0; i < n; i++) {
+		const struct rxinst *in = &p->inst[pcs[i]];
+		if (in->op == OP_MATCH && (*match == RX_NONE || in->x < *match))
+			*match = in->x;
+		if (in->op == OP_MATCH_EOL && (*eolmatch == RX_NONE || in->x < *eolmatch))
+			*eolmatch = in->x;
+	}
+}
+
+static uint32_t
+hash_pcs(const uint32_t *pcs, int n)
+{
+	uint32_t h = 2166136261u;
+	int i;
+
+	for (i = 0; i < n; i++)
+		h = (h ^ pcs[i]) * 16777619u;
+	return h;
+}
+
+/* existing state for the set or a new one, NULL if the cache is full */
+static struct rxstate *
+intern(struct rxcache *c, const uint32_t *pcs, int n)
+{
+	const struct rxprog *p = c->prog;
+	uint32_t h = hash_pcs(pcs, n);
+	struct rxstate *s, **b = &c->table[h % RX_BUCKETS];
+	size_t size;
+
+	for (s = *b; s; s = s->hnext)
+		if (s->hash == h && s->npcs == n && !memcmp(s->pcs, pcs, n * sizeof(*pcs)))
+			return s;
+
+	size = sizeof(*s) + n * sizeof(*pcs) + p->nclasses * sizeof(*s->next);
+	if (c->bytes + size > p->cachemax || !(s = malloc(size)))
+		return NULL;
+	c->bytes += size;
+	c->stats.states++;
+	s->hash = h;
+	s->npcs = n;
+	memcpy(s->pcs, pcs, n * sizeof(*pcs));
+	s->next = (struct rxstate **)(s->pcs + n);
+	memset(s->next, 0, p->nclasses * sizeof(*s->next));
+	set_matches(p, pcs, n, &s->match, &s->eolmatch);
+	s->hnext = *b;
+	*b = s;
+	return s;
+}
+
+/* plain NFA simulation for the rest of the input, no memory needed */
+static int
+nfa_run(struct rxcache *c, int n, const unsigned char *s, size_t len)
+{
+	int cur = 0, match, eolmatch;
+	size_t i;
+
+	c->stats.fallbacks++;
+	for (i = 0; i < len; i++) {
+		set_matches(c->prog, c->set[cur], n, &match, &eolmatch);
+		if (match != RX_NONE)
+			return match;
+		n = step(c, c->set[cur], n, s[i], c->set[cur ^ 1]);
+		cur ^= 1;
+	}
+	set_matches(c->prog, c->set[cur], n, &match, &eolmatch);
+	return match != RX_NONE ? match : eolmatch;
+}
+
+int
+rx_match(struct rxcache *c, const struct rxprog *p, const char *str, size_t len)
+{
+	const unsigned char *s = (const unsigned char *)str;
+	struct rxstate *st, *nx;
+	int flushes = 0, n;
+	size_t i;
+
+	if (!p->nrules)
+		return RX_NONE;
+	if (c->prog != p && cache_bind(c, p) < 0)
+		return RX_NONE;
+
+	if (!(st = c->start)) {
+		n = start_set(c, c->set[0]);
+		if (!(st = c->start = intern(c, c->set[0], n)))
+			return nfa_run(c, n, s, len);
+	}
+
+	for (i = 0; i < len; i++) {
+		unsigned cls = p->classmap[s[i]];
+
+		if (st->match != RX_NONE)
+			return st->match;
+		if ((nx = st->next[cls]) == NULL) {
+			n = step(c, st->pcs, st->npcs, p->classrep[cls], c->set[0]);
+			if ((nx = intern(c, c->set[0], n)) == NULL) {
+				/* cache is full: start over with an empty one, give
+				 * up on caching if that keeps happening */
+				c->stats.flushes++;
+				if (++flushes > RX_MAX_FLUSHES)
+					return nfa_run(c, n, s + i + 1, len - i - 1);
+				memcpy(c->set[1], c->set[0], n * sizeof(uint32_t));
+				cache_flush(c);
+				if ((nx = intern(c, c->set[1], n)) == NULL) {
+					memcpy(c->set[0], c->set[1], n * sizeof(uint32_t));
+					return nfa_run(c, n, s + i + 1, len - i - 1);
+				}
+				st = nx;
+				continue;
+			}
+			st->next[cls] = nx;
+		}
+		st = nx;
+	}
+	return st->match != RX_NONE ? st->match : st->eolmatch;
+}
@@ -0,0 +1,85 @@
+#ifndef RXFILTER_H
+#define RXFILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RX_NONE		(-1)
+#define RX_MAX_INST	(1 << 20)	/* whole program */
+#define RX_CACHE_SIZE	(1 << 20)	/* default DFA cache, bytes */
+#define RX_MAX_FLUSHES	4		/* per match, then NFA simulation */
+#define RX_BUCKETS	1024
+
+/* NFA instruction */
+struct rxinst {
+	uint8_t		op;
+	int		x;		/* set, target or rule */
+	int		y;		/* second split target */
+};
+
+struct rxset {
+	uint32_t	bits[8];
+};
+
+/* all rules of one kind compiled into a single Thompson NFA; read-only
+ * once compiled and shared by all workers */
+struct rxprog {
+	struct rxinst	*inst;
+	int		ninst, instsize;
+	struct rxset	*sets;
+	int		nsets, setsize;
+	int		*starts;	/* entry of every rule */
+	int		*anchored;	/* rule starts with ^ */
+	char		**text;
+	int		nrules, rulesize;
+	uint8_t		classmap[256];	/* byte -> equivalence class */
+	uint8_t		classrep[256];	/* class -> some byte of it */
+	int		nclasses;
+	size_t		cachemax;	/* DFA cache bound for every worker */
+};
+
+struct rxstate;
+
+struct rxstats {
+	unsigned long	states;		/* DFA states built */
+	unsigned long	flushes;	/* cache dropped for being full */
+	unsigned long	fallbacks;	/* matches finished by NFA simulation */
+};
+
+/* per-worker lazy DFA over some rxprog: states are sets of NFA
+ * instructions built on first use and kept until the cache is full */
+struct rxcache {
+	const struct rxprog *prog;
+	struct rxstate	**table;
+	struct rxstate	*start;
+	size_t		bytes;
+	uint32_t	*set[2];	/* scratch NFA state sets */
+	uint32_t	*stack;
+	uint32_t	*mark;
+	uint32_t	gen;
+	struct rxstats	stats;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int rxprog_init(struct rxprog *p);
+void rxprog_free(struct rxprog *p);
+
+/* returns -1 with a reason in err on a bad or too large expression */
+int rxprog_add(struct rxprog *p, const char *re, char *err, size_t errlen);
+int rxprog_compile(struct rxprog *p);
+
+void rxcache_init(struct rxcache *c);
+void rxcache_free(struct rxcache *c);
+
+/* rule matching somewhere in s or RX_NONE, linear in len; of several
+ * rules the one ending first wins */
+int rx_match(struct rxcache *c, const struct rxprog *p, const char *s, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RXFILTER_H */
@@ -0,0 +1,136 @@
+/* sfp-logcat: print binary access log segments as text or CSV */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "access.h"
+
+static const char *verdicts[ACC_VERDICTS] = {
+	[ACC_NONE]		= "NONE",
+	[ACC_OK]		= "OK",
+	[ACC_DENIED]		= "DENIED",
+	[ACC_BADREQ]		= "BADREQ",
+	[ACC_BLOCK_HOST]	= "BLOCK_HOST",
+	[ACC_BLOCK_URL]		= "BLOCK_URL",
+	[ACC_BLOCK_REGEX]	= "BLOCK_REGEX",
+	[ACC_NOTIMPL]		= "NOTIMPL",
+	[ACC_NORESP]		= "NORESP",
+	[ACC_UNAVAIL]		= "UNAVAIL",
+	[ACC_STATS]		= "STATS",
+	[ACC_TIMEOUT]		= "TIMEOUT",
+	[ACC_BLOCK_SNI]		= "BLOCK_SNI",
+	[ACC_HIT]		= "HIT",
+};
+
+static void
+usage(const char *app)
+{
+	fprintf(stderr, "usage: %s [-c] [-u] segment...\n"
+		"\t-c : CSV with a header line\n"
+		"\t-u : UTC times [default = local]\n", app);
+}
+
+static void
+csv_str(const char *s, size_t max)
+{
+	size_t i;
+
+	putchar('"');
+	for (i = 0; i < max && s[i]; i++) {
+		if (s[i] == '"')
+			putchar('"');
+		putchar(s[i]);
+	}
+	putchar('"');
+}
+
+static void
+print_rec(const struct access_rec *r, int csv, int utc)
+{
+	char when[32], addr[INET_ADDRSTRLEN];
+	time_t sec = r->start_us / 1000000;
+	struct tm tm;
+	const char *v = r->verdict < ACC_VERDICTS ? verdicts[r->verdict] : "?";
+	struct in_addr in;
+
+	if (utc)
+		gmtime_r(&sec, &tm);
+	else
+		localtime_r(&sec, &tm);
+	strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+	in.s_addr = r->cliaddr;
+	inet_ntop(AF_INET, &in, addr, sizeof(addr));
+
+	if (csv) {
+		printf("%s.%03u,%s,%s,%u,%llu,%.3f,%u,", when,
+			(unsigned)(r->start_us / 1000 % 1000), addr, v, r->requests,
+			(unsigned long long)r->bytes, r->duration_us / 1e3, r->errors);
+		csv_str(r->host, sizeof(r->host));
+		printf(",%u,", r->srvport);
+		csv_str(r->target, sizeof(r->target));
+		putchar('\n');
+	}
+	else
+		printf("%s.%03u %s %s %u %llu %.3fs %u %.*s:%u %.*s\n", when,
+			(unsigned)(r->start_us / 1000 % 1000), addr, v, r->requests,
+			(unsigned long long)r->bytes, r->duration_us / 1e6, r->errors,
+			(int)strnlen(r->host, sizeof(r->host)), r->host, r->srvport,
+			(int)strnlen(r->target, sizeof(r->target)), r->target);
+}
+
+static int
+cat(const char *path, int csv, int utc)
+{
+	FILE *fp = fopen(path, "rb");
+	struct access_hdr h;
+	struct access_rec r;
+
+	if (!fp) {
+		perror(path);
+		return -1;
+	}
+	if (fread(&h, sizeof(h), 1, fp) != 1 ||
+	    memcmp(h.magic, ACCESS_MAGIC, sizeof(h.magic)) || h.recsize != sizeof(r)) {
+		fprintf(stderr, "%s: not an access log segment\n", path);
+		fclose(fp);
+		return -1;
+	}
+	/* a segment still being written ends with zeroes */
+	while (fread(&r, sizeof(r), 1, fp) == 1 && r.start_us)
+		print_rec(&r, csv, utc);
+	fclose(fp);
+	return 0;
+}
+
+int
+main(int argc, char *const argv[])
+{
+	int ch, csv = 0, utc = 0, rc = 0;
+
+	while ((ch = getopt(argc, argv, "cuh")) != -1) {
+		switch (ch) {
+		case 'c':
+			csv = 1;
+			break;
+		case 'u':
+			utc = 1;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind == argc) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (csv)
+		printf("time,client,verdict,requests,bytes,duration_ms,errors,host,port,target\n");
+	for (; optind < argc; optind++)
+		if (cat(argv[optind], csv, utc) < 0)
+			rc = 1;
+	return rc;
+}
@@ -1,13 +1,39 @@
 #include <netdb.h>
+#include <signal.h>
 #include <assert.h>
 #include <string.h>
 
 #include "sfp.h"
 #include "util.h"
 #include "sfp_opt.h"
+#include "worker.h"
+#include "relay.h"
+#include "http.h"
+#include "tls.h"
+#include "cache.h"
+#include "config.h"
+#include "log.h"
 
 FILE *logfp = NULL;
 struct prog_opt sfp_opt;
+struct config *sfp_cfg = NULL;
+
+static const char badreq_hdr[] =
+	"HTTP/1.0 400 Bad Request\r\nConnection: close\r\n\r\n";
+static const char forbidden_hdr[] =
+	"HTTP/1.0 403 Forbidden\r\nConnection: close\r\n\r\n";
+static const char unavail_hdr[] =
+	"HTTP/1.0 503 Service Unavailable\r\nConnection: close\r\n\r\n";
+const char badgw_hdr[] =
+	"HTTP/1.0 502 Bad Gateway\r\nConnection: close\r\n\r\n";
+static const char timeout_hdr[] =
+	"HTTP/1.0 408 Request Timeout\r\nConnection: close\r\n\r\n";
+static const char gwtimeout_hdr[] =
+	"HTTP/1.0 504 Gateway Timeout\r\nConnection: close\r\n\r\n";
+static const char continue_hdr[] =
+	"HTTP/1.1 100 Continue\r\n\r\n";
+static const char established_hdr[] =
+	"HTTP/1.1 200 Connection established\r\n\r\n";
 
 struct sockaddr_in *
 sinsock(struct sockaddr_in *sin, struct prog_opt *sfp_opt)
@@ -26,7 +52,7 @@ sinsock(struct sockaddr_in *sin, struct prog_opt *sfp_opt)
 }
 
 int
-server_socket(struct sockaddr_in *sin)
+server_socket(struct sockaddr_in *sin, int reuseport)
 {
 	int fd;
 	int one = 1;
@@ -48,18 +74,33 @@ server_socket(struct sockaddr_in *sin)
 		return -1;
 	}
 
+	if (reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1) {
+		error_log(errno, "Server reuseport error");
+		close(fd);
+		return -1;
+	}
+
+	/* accepted sockets inherit these, nothing is set per client */
 	if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbufsize, sizeof(sndbufsize)) == -1) {
 		error_log(errno, "Sevrer socket sendbuf error");
 		close(fd);
 		return -1;
 	}
-/*
+
 	if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == -1) {
 		error_log(errno, "Server tcp_nodelay set error");
 		close(fd);
 		return -1;
 	}
-*/
+
+	/* client is accepted once its first data is in */
+	if (sfp_opt.defer_accept > 0 && setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+			&sfp_opt.defer_accept, sizeof(sfp_opt.defer_accept)) == -1) {
+		error_log(errno, "Server defer accept error");
+		close(fd);
+		return -1;
+	}
+
 	if (ioctl(fd, FIONBIO, &nonblock) < 0) {
 		error_log(errno, "Server socket set nonblock error");
 		close(fd);
@@ -74,7 +115,7 @@ server_socket(struct sockaddr_in *sin)
 	}
 
 
-	if (listen(fd, 64) == -1) {
+	if (listen(fd, sfp_opt.backlog) == -1) {
 		error_log(errno, "Server socket listen error");
 		close(fd);
 		return -1;
@@ -83,105 +124,714 @@ server_socket(struct sockaddr_in *sin)
 	return fd;
 }
 
+void client_cbread(EV_P_ ev_io *w, int revents);
+
+static void
+client_timeout(struct timewheel *tw, struct tw_timer *t)
+{
+	struct connect *c = CONNECT_OF(t, timer);
+	struct ev_loop *loop = tw->data;
+
+	switch (c->state) {
+	case CLI_CONNECT:
+		/* a quiet kept-alive client just goes */
+		if (c->clibuf.tail) {
+			wrlog(L_INFO, "Client %s request timeout", c->cliaddr);
+			client_reply(c, timeout_hdr);
+		}
+		break;
+	case SRV_CONNECT:
+		wrlog(L_INFO, "Server %s:%d connect timeout for %s", c->srvaddr,
+			c->srvport, c->cliaddr);
+		client_reply(c, gwtimeout_hdr);
+		break;
+	case CLI_HELLO:
+		wrlog(L_INFO, "Client %s tunnel hello timeout", c->cliaddr);
+		break;
+	default:
+		wrlog(L_INFO, "Client %s idle timeout", c->cliaddr);
+		break;
+	}
+	STAT_INC(c->worker->stats.timeouts);
+	c->acc.verdict = ACC_TIMEOUT;
+	connect_close(EV_A_ c);
+}
+
+/* arm the timeout of the state being entered, sec 0 - none */
 void
-server_accept(EV_P_ ev_io *w, int revents)
+connect_timer(struct connect *c, int sec)
 {
-	int fd = accept(w->fd, NULL, NULL);
-	if (fd < 0) {
-		wrlog(L_CRITICAL, "Client accept error: %s", strerror(errno));
+	if (sec > 0)
+		tw_add(&c->worker->wheel, &c->timer, sec);
+	else
+		tw_del(&c->worker->wheel, &c->timer);
+}
+
+static void
+client_open(EV_P_ struct worker *wrk, int fd, const struct sockaddr_in *peer)
+{
+	/* nothing is spent on a client we don't serve */
+	if (wrk->conf->cfg && acl_check(&wrk->conf->cfg->acl, peer->sin_addr.s_addr) == ACL_DENY) {
+		STAT_INC(wrk->stats.denied);
+		if (wrk->access.dir) {
+			struct access_rec r;
+			memset(&r, 0, sizeof(r));
+			r.start_us = ev_now(EV_A) * 1e6;
+			r.cliaddr = peer->sin_addr.s_addr;
+			r.verdict = ACC_DENIED;
+			access_write(&wrk->access, &r);
+		}
+		close(fd);
 		return;
 	}
 
-	int one = 1;
-	if (ioctl(fd, FIONBIO, &one) < 0) {
-		wrlog(L_CRITICAL, "Client nonblock ioctl error: %s", strerror(errno));
+	struct connect *connect = connpool_get(&wrk->pool);
+	if (!connect) {
+		wrlog(L_CRITICAL, "Client alloc error");
 		close(fd);
 		return;
 	}
+	inet_ntop(AF_INET, &peer->sin_addr, connect->cliaddr, sizeof(connect->cliaddr));
+	connect->clibuf.tail = 0;
+	connect->bytes = 0;
+	connect->errors = 0;
+	connect->starttime = ev_now(EV_A);
+	connect->acc.start_us = connect->starttime * 1e6;
+	connect->acc.cliaddr = peer->sin_addr.s_addr;
+	connect->state = CLI_CONNECT;
+	connect->worker = wrk;
+	connect->conf = wconfig_get(wrk);
+	connect->srvio.fd = -1;
+	connect->clipipe[0] = connect->clipipe[1] = -1;
+	connect->srvpipe[0] = connect->srvpipe[1] = -1;
+
+	tw_timer_init(&connect->timer, client_timeout);
+	connect_timer(connect, sfp_opt.timeout);
+
+	LIST_INSERT_HEAD(&wrk->conns, connect, link);
+	wrk->nconns++;
+	STAT_INC(wrk->stats.accepts);
+
+	ev_io_init(&connect->cliio, client_cbread, fd, EV_READ);
+	ev_io_start(EV_A_ &connect->cliio);
+}
+
+/* drain the accept queue up to a cap so a connection storm can't starve
+ * the connections already open; socket options come from the listener */
+void
+server_accept(EV_P_ ev_io *w, int revents)
+{
+	struct worker *wrk = loop_worker(EV_A);
+	struct sockaddr_in peer;
+	socklen_t peerlen;
+	int fd, n;
+
+	for (n = 0; n < ACCEPT_BATCH; n++) {
+		peerlen = sizeof(peer);
+		fd = accept4(w->fd, (struct sockaddr *)&peer, &peerlen, SOCK_NONBLOCK);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				wrlog(L_CRITICAL, "Client accept error: %s", strerror(errno));
+			return;
+		}
+		client_open(EV_A_ wrk, fd, &peer);
+	}
+}
+
+void
+connect_close(EV_P_ struct connect *c)
+{
+	struct worker *wrk = c->worker;
+
+	ev_io_stop(EV_A_ &c->cliio);
+	close(c->cliio.fd);
+	if (c->srvio.fd >= 0) {
+		ev_io_stop(EV_A_ &c->srvio);
+		close(c->srvio.fd);
+	}
+	resolver_cancel(&c->dnsw);
+	relay_free(c);
+	tw_del(&wrk->wheel, &c->timer);
+	wconfig_put(wrk, c->conf);
+
+	STAT_ADD(wrk->stats.bytes, c->bytes);
+	STAT_ADD(wrk->stats.errors, c->errors);
+	hist_add(&wrk->stats.lifetime, (ev_now(EV_A) - c->starttime) * 1e6);
+	STAT_INC(wrk->stats.closes);
+	if (wrk->access.dir) {
+		c->acc.duration_us = (ev_now(EV_A) - c->starttime) * 1e6;
+		c->acc.bytes = c->bytes;
+		c->acc.errors = c->errors > UINT16_MAX ? UINT16_MAX : c->errors;
+		access_write(&wrk->access, &c->acc);
+	}
+	wrk->nconns--;
+	LIST_REMOVE(c, link);
+	connpool_put(&wrk->pool, c);
+}
+
+/* best effort reply before closing, socket buffer is empty at this point */
+void
+client_reply(struct connect *c, const char *hdr)
+{
+	if (send(c->cliio.fd, hdr, strlen(hdr), MSG_NOSIGNAL) < 0)
+		wrlog(L_INFO, "Client %s reply error: %s", c->cliaddr, strerror(errno));
+}
+
+/* a clean tunnel goes to the relay, bytes read so far go first */
+static void
+tunnel_pass(EV_P_ struct connect *c)
+{
+	c->peek = 0;
+	STAT_INC(c->worker->stats.tunnels);
+	relay_start(EV_A_ c);
+}
+
+/* host name of the TLS hello, as far as the client has sent it,
+ * through the host rules */
+static void
+tunnel_peek(EV_P_ struct connect *c)
+{
+	struct config *cfg = c->conf->cfg;
+	char name[TLS_NAME_MAX + 1];
+	int r = tls_sni(c->clibuf.buf, c->clibuf.tail, name);
+
+	if (r == TLS_MORE && c->clibuf.tail < IOBUFSIZE)
+		return;
+	/* a hello bigger than a buffer can't be checked, so it is not let
+	 * through either; streams that are not TLS and hellos without a
+	 * host name have nothing to match and do pass */
+	if (r == TLS_MORE) {
+		wrlog(L_INFO, "TLS hello from %s is too big to check", c->cliaddr);
+		STAT_INC(c->worker->stats.blocked_sni);
+		c->acc.verdict = ACC_BLOCK_SNI;
+		connect_close(EV_A_ c);
+		return;
+	}
+	if (r == TLS_SNI && hostfilter_match(&cfg->hosts, name, strlen(name))) {
+		wrlog(L_INFO, "Blocked TLS %s for %s", name, c->cliaddr);
+		STAT_INC(c->worker->stats.blocked_sni);
+		c->acc.verdict = ACC_BLOCK_SNI;
+		connect_close(EV_A_ c);
+		return;
+	}
+	if (r != TLS_SNI)
+		wrlog(L_DEBUG, "Tunnel %s:%d for %s has no TLS host name", c->srvaddr,
+			c->srvport, c->cliaddr);
+	tunnel_pass(EV_A_ c);
+}
+
+static void
+tunnel_cbclient(EV_P_ ev_io *w, int revents)
+{
+	struct connect *c = CONNECT_OF(w, cliio);
+	ssize_t r;
+
+	if (c->clibuf.tail == c->clibuf.size &&
+	    buf_acquire(&c->worker->bufs, &c->clibuf.buf, &c->clibuf.size,
+			c->clibuf.size ? IOBUFSIZE : BUF_SMALL, c->clibuf.tail) < 0) {
+		wrlog(L_WARNING, "Buffer pool exhausted, dropping %s", c->cliaddr);
+		c->acc.verdict = ACC_UNAVAIL;
+		connect_close(EV_A_ c);
+		return;
+	}
+	r = recv(w->fd, c->clibuf.buf + c->clibuf.tail, c->clibuf.size - c->clibuf.tail, 0);
+	if (r < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return;
+		wrlog(L_ERROR, "Client %s receive error: %s", c->cliaddr, strerror(errno));
+	}
+	if (r <= 0) {
+		connect_close(EV_A_ c);
+		return;
+	}
+	c->clibuf.tail += r;
+	tunnel_peek(EV_A_ c);
+}
+
+/* TLS clients speak first, a server that does isn't talking TLS */
+static void
+tunnel_cbserver(EV_P_ ev_io *w, int revents)
+{
+	tunnel_pass(EV_A_ CONNECT_OF(w, srvio));
+}
+
+/* CONNECT has reached the server: tell the client, then either relay
+ * right away or wait for the hello to check its host name first */
+static void
+tunnel_start(EV_P_ struct connect *c)
+{
+	if (send(c->cliio.fd, established_hdr, sizeof(established_hdr) - 1, MSG_NOSIGNAL) < 0) {
+		wrlog(L_INFO, "Client %s reply error: %s", c->cliaddr, strerror(errno));
+		c->errors++;
+		connect_close(EV_A_ c);
+		return;
+	}
+	if (!c->peek) {
+		tunnel_pass(EV_A_ c);
+		return;
+	}
+	c->state = CLI_HELLO;
+	connect_timer(c, sfp_opt.timeout);
+	ev_set_cb(&c->cliio, tunnel_cbclient);
+	io_update(EV_A_ &c->cliio, EV_READ);
+	ev_set_cb(&c->srvio, tunnel_cbserver);
+	io_update(EV_A_ &c->srvio, EV_READ);
+	tunnel_peek(EV_A_ c);
+}
+
+static void
+server_cbconnect(EV_P_ ev_io *w, int revents)
+{
+	struct connect *c = CONNECT_OF(w, srvio);
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	if (getsockopt(w->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+		err = errno;
+	if (err) {
+		wrlog(L_WARNING, "Server %s:%d connect error: %s",
+			c->srvaddr, c->srvport, strerror(err));
+		client_reply(c, badgw_hdr);
+		c->errors++;
+		connect_close(EV_A_ c);
+		return;
+	}
+
+	if (c->req.is_connect)
+		tunnel_start(EV_A_ c);
+	else
+		relay_start(EV_A_ c);
+}
+
+static int
+server_connect(EV_P_ struct connect *c, const struct sockaddr_in *sin)
+{
+	int one = 1;
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		wrlog(L_CRITICAL, "Server socket create error: %s", strerror(errno));
+		return -1;
+	}
 
 	if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == -1) {
-		wrlog(L_CRITICAL, "Client tcp_nodelay setsockopt error: %s", strerror(errno));
+		wrlog(L_CRITICAL, "Server tcp_nodelay setsockopt error: %s", strerror(errno));
 		/* Do nothing, not a fatal error.  */
 	}
 
-	int len;
-	for (len = 1 << 20; len > 0; len -= 1 << 18)
-		if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &len, sizeof(len)) == 0) {
-			break;
-		}
+	if (connect(fd, (struct sockaddr *)sin, sizeof(*sin)) < 0 && errno != EINPROGRESS) {
+		wrlog(L_WARNING, "Server %s:%d connect error: %s",
+			c->srvaddr, c->srvport, strerror(errno));
+		close(fd);
+		return -1;
+	}
 
+	ev_io_init(&c->srvio, server_cbconnect, fd, EV_WRITE);
+	ev_io_start(EV_A_ &c->srvio);
+	return 0;
+}
 
-	struct connect *connect = calloc(sizeof(*connect), 1);
-	const char *peerip = get_peerip(fd);
-	strncpy(connect->cliaddr, peerip, sizeof(connect->cliaddr));
-	connect->clibufdata = 0;
-	connect->bytes = 0;
-	connect->errors = 0;
-	connect->starttime = time(NULL);
-	connect->state = CLI_CONNECT;
+/* idle pooled connection to c->srvsin if there is one, new otherwise */
+int
+server_open(EV_P_ struct connect *c)
+{
+	int fd = -1;
+
+	inet_ntop(AF_INET, &c->srvsin.sin_addr, c->srvaddr, sizeof(c->srvaddr));
+	c->srvport = ntohs(c->srvsin.sin_port);
+	if (c->srvkeep && !c->noretry)
+		fd = upstream_get(EV_A_ &c->worker->upstreams, &c->srvsin);
+	if (fd < 0)
+		return server_connect(EV_A_ c, &c->srvsin);
+
+	c->reused = 1;
+	ev_io_init(&c->srvio, server_cbconnect, fd, 0);
+	relay_start(EV_A_ c);
+	return 0;
+}
 
-	void client_cbread(ev_io *w, int revents);
-	ev_io_init(&connect->cliio, (void *)client_cbread, fd, EV_READ);
-	ev_io_start(&connect->cliio);
+static void
+server_cbresolve(EV_P_ struct dns_waiter *w, int status, struct in_addr addr)
+{
+	struct connect *c = CONNECT_OF(w, dnsw);
+
+	if (status != DNS_OK) {
+		wrlog(L_WARNING, "Can't resolve server for %s", c->cliaddr);
+		client_reply(c, badgw_hdr);
+		connect_close(EV_A_ c);
+		return;
+	}
+
+	memset(&c->srvsin, 0, sizeof(c->srvsin));
+	c->srvsin.sin_family = AF_INET;
+	c->srvsin.sin_port = htons(c->srvport);
+	c->srvsin.sin_addr = addr;
+	if (server_open(EV_A_ c) < 0) {
+		client_reply(c, badgw_hdr);
+		connect_close(EV_A_ c);
+	}
 }
 
+/* regex rules over the target and every header line, logs the rule */
+static int
+request_regex(struct connect *c, const struct http_req *req, const char *host)
+{
+	struct wconfig *wc = c->conf;
+	int r, i;
+
+	r = rx_match(&wc->rxurl, &wc->cfg->rxurl, c->clibuf.buf + req->target.off,
+		req->target.len);
+	if (r != RX_NONE) {
+		wrlog(L_INFO, "Blocked %s for %s by url regex %s", host, c->cliaddr,
+			wc->cfg->rxurl.text[r]);
+		return 1;
+	}
+	if (!wc->cfg->rxhdr.nrules)
+		return 0;
+
+	for (i = 0; i < req->nhdrs; i++) {
+		const struct http_hdr *h = &req->hdrs[i];
+		r = rx_match(&wc->rxhdr, &wc->cfg->rxhdr, c->clibuf.buf + h->name.off,
+			h->value.off + h->value.len - h->name.off);
+		if (r != RX_NONE) {
+			wrlog(L_INFO, "Blocked %s for %s by header regex %s", host,
+				c->cliaddr, wc->cfg->rxhdr.text[r]);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* request to the proxy itself rather than through it */
+static int
+is_stat_request(const char *buf, const struct http_req *req)
+{
+	return !req->is_connect && req->path.off == req->target.off &&
+		req->port == sfp_opt.listen_port &&
+		req->method.len == 3 && 0 == memcmp(buf + req->method.off, "GET", 3) &&
+		req->target.len == sizeof(STAT_PATH) - 1 &&
+		0 == memcmp(buf + req->target.off, STAT_PATH, req->target.len);
+}
+
+static void
+client_stats(struct connect *c)
+{
+	struct stats sum;
+	char hdr[128], body[4096];
+	double uptime = workers_stats(&sum);
+	size_t len = stats_format(&sum, uptime, workers_count(), body, sizeof(body));
+	int n = snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\n"
+		"Content-Length: %zu\r\nConnection: close\r\n\r\n", len);
+
+	if (send(c->cliio.fd, hdr, n, MSG_NOSIGNAL | MSG_MORE) < 0 ||
+	    send(c->cliio.fd, body, len, MSG_NOSIGNAL) < 0)
+		wrlog(L_INFO, "Client %s stats reply error: %s", c->cliaddr, strerror(errno));
+}
+
+/* answer from the cache if it has the response, otherwise remember the
+ * request so the response can be stored; returns 1 if answered */
+static int
+client_cache(EV_P_ struct connect *c, int hdrlen)
+{
+	struct worker *wrk = c->worker;
+	struct cache_obj *o;
+	char key[CACHE_KEY_MAX];
+	ssize_t n;
+	int how;
+
+	if (c->tunnel || c->reqleft != 0)
+		return 0;
+	how = cache_request(c->clibuf.buf, &c->req);
+	if (how == CACHE_BYPASS || (n = cache_key(c->clibuf.buf, &c->req, key, sizeof(key))) < 0)
+		return 0;
+	if (how == CACHE_LOOKUP && (o = cache_lookup(&wrk->cache, key, n,
+			c->clibuf.buf, hdrlen, ev_now(EV_A)))) {
+		STAT_INC(wrk->stats.cache_hits);
+		relay_hit(EV_A_ c, o);
+		return 1;
+	}
+	STAT_INC(wrk->stats.cache_misses);
+	if (!c->nobody)
+		c->cachereq = cache_req_new(key, n, c->clibuf.buf, hdrlen);
+	return 0;
+}
 
 void
-client_cbread(ev_io *w, int revents)
+client_cbread(EV_P_ ev_io *w, int revents)
 {
 	struct connect *c = (struct connect *)w;
+	struct worker *wrk = c->worker;
+	struct http_req *req = &c->req;
+	struct config *cfg = c->conf->cfg;
+	struct in_addr addr;
+	char host[256];
+	char hdr[IOBUFSIZE];
+	int r;
+
 	if (c->state == CLI_CONNECT) {
-		int r = recv(w->fd, c->clireadbuf + c->clibufdata, IOBUFSIZE - c->clibufdata, 0);
+		if (c->clibuf.tail == 0)
+			http_req_init(req);
+		/* small buffer first, full one only for big headers */
+		if (c->clibuf.tail == c->clibuf.size &&
+		    buf_acquire(&c->worker->bufs, &c->clibuf.buf, &c->clibuf.size,
+				c->clibuf.size ? IOBUFSIZE : BUF_SMALL, c->clibuf.tail) < 0) {
+			wrlog(L_WARNING, "Buffer pool exhausted, dropping %s", c->cliaddr);
+			c->acc.verdict = ACC_UNAVAIL;
+			client_reply(c, unavail_hdr);
+			goto close;
+		}
+
+		r = recv(w->fd, c->clibuf.buf + c->clibuf.tail, c->clibuf.size - c->clibuf.tail, 0);
 		if (r < 0) {
 			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
 				return;
 
 			wrlog(L_ERROR, "Client %s receive error: %s", c->cliaddr, strerror(errno));
-// TODO			
-//			client_close(c);
-			return;
+			goto close;
 		}
-		c->clibufdata += r;
-		char *lf = memchr(c->clireadbuf, '\n', c->clibufdata);
-		if (!lf && c->clibufdata < IOBUFSIZE)
+		if (r == 0)
+			goto close;
+
+		c->clibuf.tail += r;
+		int hdrlen = http_parse_request(c->clibuf.buf, c->clibuf.tail, req);
+		if (hdrlen == 0 && c->clibuf.tail < IOBUFSIZE)
 			return;
 
-		if (!lf) {
+		if (hdrlen <= 0) {
 			wrlog(L_WARNING, "Can't parse request from %s", c->cliaddr);
+			STAT_INC(wrk->stats.badreq);
+			c->acc.verdict = ACC_BADREQ;
+			client_reply(c, badreq_hdr);
 			goto close;
 		}
 
-		if (lf - 1 > c->clireadbuf && *(lf - 1) == '\r')
-			lf--;
-		*lf = 0;
+		if (wrk->access.dir) {
+			if (c->acc.requests < UINT16_MAX)
+				c->acc.requests++;
+			c->acc.srvport = req->port;
+			http_slice_str(c->clibuf.buf, req->target, c->acc.target, sizeof(c->acc.target));
+			http_slice_str(c->clibuf.buf, req->host, c->acc.host, sizeof(c->acc.host));
+		}
+		c->acc.verdict = ACC_NORESP;
 
-/*		int cno = client_parse_get(c);
-		if (cno == 0) {
-			wrlog(L_WARNING, "Can't parse request from %s", c->cliaddr);
-			client_write(c, notfound_hdr, strlen(notfound_hdr));
+		if (is_stat_request(c->clibuf.buf, req)) {
+			c->acc.verdict = ACC_STATS;
+			client_stats(c);
+			goto close;
+		}
+		STAT_INC(wrk->stats.requests);
+		c->reqtime = ev_now(EV_A);
+		http_slice_str(c->clibuf.buf, req->host, host, sizeof(host));
+		if (cfg && hostfilter_match(&cfg->hosts, host, strlen(host))) {
+			wrlog(L_INFO, "Blocked %s for %s", host, c->cliaddr);
+			STAT_INC(wrk->stats.blocked_host);
+			c->acc.verdict = ACC_BLOCK_HOST;
+			client_reply(c, forbidden_hdr);
 			goto close;
 		}
-		if(cno == -1 ) {
-			// write stat
-			write_stat(c->io.fd);
+
+		if (cfg && (r = urlfilter_match(&cfg->urls, c->clibuf.buf + req->target.off,
+				req->target.len, wrk->id)) != URLFILTER_NONE) {
+			wrlog(L_INFO, "Blocked %s for %s by url rule %d", host, c->cliaddr, r);
+			STAT_INC(wrk->stats.blocked_url);
+			c->acc.verdict = ACC_BLOCK_URL;
+			client_reply(c, forbidden_hdr);
+			goto close;
+		}
+
+		if (cfg && request_regex(c, req, host)) {
+			STAT_INC(wrk->stats.blocked_regex);
+			c->acc.verdict = ACC_BLOCK_REGEX;
+			client_reply(c, forbidden_hdr);
 			goto close;
 		}
-*/
 
+		c->srvport = req->port;
+		if (req->is_connect) {
+			/* anything after the head already belongs to the tunnel */
+			size_t early = c->clibuf.tail - hdrlen;
+
+			memmove(c->clibuf.buf, c->clibuf.buf + hdrlen, early);
+			c->clibuf.tail = early;
+			c->clibuf.head = 0;
+			c->tunnel = 1;
+			c->peek = cfg && cfg->hosts.rules > 0;
+			c->clikeep = c->srvkeep = 0;
+			c->reqleft = c->respleft = -1;
+			c->noretry = 1;
+			goto resolve;
+		}
+
+		/* request framing, anything past the body is a pipelined
+		 * request which is not supported and ends the connection */
+		size_t body = c->clibuf.tail - hdrlen;
+		c->clikeep = http_keepalive(req->minor, req->flags);
+		c->nobody = req->is_head;
+		if (req->flags & HTTP_F_TE) {
+			/* chunked is the only framing known here, and a length
+			 * next to it would be read differently by the origin */
+			ssize_t s = -1;
+
+			if ((req->flags & HTTP_F_CHUNKED) && req->clen < 0) {
+				http_chunk_init(&c->reqchunk);
+				s = http_chunk_scan(&c->reqchunk, c->clibuf.buf + hdrlen, body);
+			}
+			if (s < 0) {
+				wrlog(L_WARNING, "Bad request body framing from %s", c->cliaddr);
+				STAT_INC(wrk->stats.badreq);
+				c->acc.verdict = ACC_BADREQ;
+				client_reply(c, badreq_hdr);
+				goto close;
+			}
+			c->reqchunked = 1;
+			if ((size_t)s < body) {
+				body = s;
+				c->clikeep = 0;
+			}
+			c->reqleft = c->reqchunk.done ? 0 : -1;
+			c->respleft = -1;
+		}
+		else {
+			int64_t clen = req->clen > 0 ? req->clen : 0;
+			if (body > clen) {
+				body = clen;
+				c->clikeep = 0;
+			}
+			c->reqleft = clen - body;
+			c->respleft = -1;	/* until the head is read */
+		}
+		c->srvkeep = !c->tunnel && sfp_opt.upstream_idle > 0;
+		c->noretry = c->reqleft != 0;
+		if ((req->flags & HTTP_F_EXPECT) && req->minor >= 1 && c->reqleft != 0)
+			client_reply(c, continue_hdr);
+		if (cache_enabled(&wrk->cache) && client_cache(EV_A_ c, hdrlen))
+			return;
+
+		/* rewrite request for the origin, keep body bytes behind it */
+		ssize_t n = http_build_request(c->clibuf.buf, req, c->srvkeep, hdr, sizeof(hdr));
+		if (n < 0 || n + body > IOBUFSIZE) {
+			wrlog(L_WARNING, "Request from %s is too large", c->cliaddr);
+			STAT_INC(wrk->stats.badreq);
+			c->acc.verdict = ACC_BADREQ;
+			client_reply(c, badreq_hdr);
+			goto close;
+		}
+		if (buf_acquire(&c->worker->bufs, &c->clibuf.buf, &c->clibuf.size,
+				n + body, c->clibuf.tail) < 0) {
+			wrlog(L_WARNING, "Buffer pool exhausted, dropping %s", c->cliaddr);
+			c->acc.verdict = ACC_UNAVAIL;
+			client_reply(c, unavail_hdr);
+			goto close;
+		}
+		memmove(c->clibuf.buf + n, c->clibuf.buf + hdrlen, body);
+		memcpy(c->clibuf.buf, hdr, n);
+		c->clibuf.tail = n + body;
+		c->clibuf.head = 0;
+
+resolve:
+		/* resolving is part of SRV_CONNECT, client is not read meanwhile */
+		c->state = SRV_CONNECT;
+		connect_timer(c, sfp_opt.connect_timeout);
+		ev_io_stop(EV_A_ &c->cliio);
+		c->dnsw.cb = server_cbresolve;
+		r = resolver_lookup(EV_A_ &c->worker->resolver, host, &c->dnsw, &addr);
+		if (r == DNS_PENDING)
+			return;
+		if (r != DNS_OK) {
+			wrlog(L_WARNING, "Can't resolve %s for %s", host, c->cliaddr);
+			client_reply(c, badgw_hdr);
+			goto close;
+		}
+		server_cbresolve(EV_A_ &c->dnsw, r, addr);
 	}
 	return;
 close:
-//	connect_close();	
+	connect_close(EV_A_ c);
 	return;
 }
 
+/* exchange is over and both sides are clean, wait for the next request */
+void
+client_next(EV_P_ struct connect *c)
+{
+	relay_free(c);
+	c->state = CLI_CONNECT;
+	connect_timer(c, sfp_opt.timeout);
+	c->clibuf.tail = c->clibuf.head = 0;
+	c->srvbuf.tail = c->srvbuf.head = 0;
+	c->reqleft = c->respleft = 0;
+	c->srveof = c->srvshut = 0;
+	c->clisplice = c->srvsplice = 0;
+	c->tunnel = c->peek = c->resphdr = c->respdone = c->respchunked = 0;
+	c->reqchunked = 0;
+	c->nobody = c->clikeep = c->srvkeep = c->reused = c->noretry = 0;
+
+	ev_set_cb(&c->cliio, client_cbread);
+	io_update(EV_A_ &c->cliio, EV_READ);
+}
+
+static void
+config_log(const struct config *cfg)
+{
+	wrlog(L_NOTICE, "Config %s: %zu host rules, %zu url rules, %d regex rules",
+		cfg->path, cfg->hosts.rules, cfg->urls.nrules,
+		cfg->rxurl.nrules + cfg->rxhdr.nrules);
+}
+
+/* per-rule hit counters, rules never hit are candidates for removal */
+static void
+sig_dump(EV_P_ ev_signal *w, int revents)
+{
+	FILE *fp = logfp ? logfp : stderr;
+
+	if (!sfp_cfg)
+		return;
+	fprintf(fp, "URL rule hits (%s):\n", sfp_cfg->path);
+	urlfilter_dump(&sfp_cfg->urls, fp);
+	fflush(fp);
+}
+
+/* new config is built here, off the workers, and only then published;
+ * connections accepted before keep the one they started with */
+static void
+sig_reload(EV_P_ ev_signal *w, int revents)
+{
+	struct config *cfg;
+
+	if (!sfp_opt.configfile) {
+		wrlog(L_WARNING, "Got SIGHUP, no config file to reload");
+		return;
+	}
+	wrlog(L_NOTICE, "Got SIGHUP, reloading %s", sfp_opt.configfile);
+	if (!(cfg = config_load(sfp_opt.configfile, sfp_opt.workers))) {
+		wrlog(L_ERROR, "Config reload failed, the old one stays");
+		return;
+	}
+	config_log(cfg);
+	if (!cache_diskconf_same(&sfp_cfg->disk, &cfg->disk))
+		wrlog(L_WARNING, "Disk cache settings take effect on restart only");
+	workers_config(cfg);
+	config_unref(sfp_cfg);
+	sfp_cfg = cfg;
+}
+
+static void
+sig_stop(EV_P_ ev_signal *w, int revents)
+{
+	wrlog(L_NOTICE, "Got signal %d, stopping", w->signum);
+	workers_stop();
+	ev_break(EV_A_ EVBREAK_ALL);
+}
+
 
 int main(int argc, char* const argv[])
 {
 	int rc;
 	struct sockaddr_in sin, *ssin;
 
-	ev_default_loop(ev_recommended_backends() | EVFLAG_SIGNALFD);
+	struct ev_loop *loop = ev_default_loop(ev_recommended_backends() | EVFLAG_SIGNALFD);
+	signal(SIGPIPE, SIG_IGN);
 	rc = get_opt(argc, argv);
 	if (rc) {
 		return rc;
@@ -193,8 +843,7 @@ int main(int argc, char* const argv[])
 		abort();
 	}
 
-	int fd = server_socket(ssin);
-	if (fd < 0) {
+	if (workers_listen(sfp_opt.workers, ssin) < 0) {
 		exit(1);
 	}
 
@@ -204,6 +853,16 @@ int main(int argc, char* const argv[])
 			fprintf(stderr,"Can't open log '%s'! %s\n", sfp_opt.logfile, strerror(errno));
 			exit(EXIT_FAILURE);
 		}
+		log_init(fileno(logfp), sfp_opt.loglevel, 1);
+	}
+	else
+		log_init(STDERR_FILENO, sfp_opt.loglevel, 0);
+
+	if (sfp_opt.configfile) {
+		sfp_cfg = config_load(sfp_opt.configfile, sfp_opt.workers);
+		if (!sfp_cfg)
+			exit(EXIT_FAILURE);
+		config_log(sfp_cfg);
 	}
 
 	if (! sfp_opt.is_foreground) {
@@ -215,7 +874,11 @@ int main(int argc, char* const argv[])
 			fprintf(stderr,"Can't run as daemon!\n");
 			exit(EXIT_FAILURE);
 		}
+		ev_loop_fork(EV_A);
 	}
+	/* threads don't survive the fork, so only now */
+	if (log_start() < 0)
+		exit(EXIT_FAILURE);
 	wrlog(L_EMERGENCY, APP_NAME " start");
 
 	if( sfp_opt.pidfile && 0 != (rc = make_pidfile( sfp_opt.pidfile, getpid())) ) {
@@ -223,11 +886,29 @@ int main(int argc, char* const argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	ev_io io;
-	ev_io_init(&io, server_accept, fd, EV_READ);
-	ev_io_start(&io);
+	ev_signal sigint, sigterm;
+	ev_signal_init(&sigint, sig_stop, SIGINT);
+	ev_signal_start(EV_A_ &sigint);
+	ev_signal_init(&sigterm, sig_stop, SIGTERM);
+	ev_signal_start(EV_A_ &sigterm);
+	ev_signal sigusr1;
+	ev_signal_init(&sigusr1, sig_dump, SIGUSR1);
+	ev_signal_start(EV_A_ &sigusr1);
+	ev_signal sighup;
+	ev_signal_init(&sighup, sig_reload, SIGHUP);
+	ev_signal_start(EV_A_ &sighup);
+
+	bufpool_init(sfp_opt.bufmem);
+	if (workers_start(sfp_cfg) < 0) {
+		workers_stop();
+		workers_wait();
+		exit(EXIT_FAILURE);
+	}
+	wrlog(L_NOTICE, "Started %d worker(s)", sfp_opt.workers);
 
-	ev_run(0);
+	ev_run(EV_A_ 0);
+	workers_wait();
+	bufpool_destroy();
 
 	wrlog(L_EMERGENCY, APP_NAME " stopped");
 	if (sfp_opt.pidfile) {
@@ -236,6 +917,10 @@ int main(int argc, char* const argv[])
 		}
 	}
 
+	if (log_dropped())
+		wrlog(L_WARNING, "%lu log lines dropped in all", log_dropped());
+	log_stop();
+	config_unref(sfp_cfg);
 	free_opt(&sfp_opt);
 	if (logfp)
 		fclose(logfp);
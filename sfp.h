@@ -2,6 +2,7 @@
 #define SFP_H
 
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <unistd.h>
@@ -15,12 +16,16 @@
 #include <sys/types.h>
 #include <time.h>
 
-#define EV_MULTIPLICITY 0
+#define EV_MULTIPLICITY 1
 #include <ev.h>
 
 #include "util.h"
 #include "queue.h"
 #include "ringbuffer.h"
+#include "dns.h"
+#include "http.h"
+#include "access.h"
+#include "timewheel.h"
 
 #define APP_NAME "sfp v0.1"
 
@@ -30,6 +35,12 @@
 #define DZ_STDIO_OPEN  1   /* do not close STDIN, STDOUT, STDERR */
 #define TVSTAMP_GMT  1
 
+/* connections taken off the listen queue per wakeup */
+#define ACCEPT_BATCH 64
+
+/* listen queue, the kernel caps it at net.core.somaxconn */
+#define LISTEN_BACKLOG 1024
+
 /* max size of string with IPv4 address */
 #define IPADDR_STR_SIZE 16
 
@@ -43,27 +54,94 @@ static const char CONFIG_NAME[]	= "sfp.cfg";
 typedef enum {
 	CLI_CONNECT,
 	SRV_CONNECT,
+	CLI_HELLO,		/* CONNECT tunnel is up, waiting for a TLS hello */
 	RELAY
 } connstate;
 
 
+/* max request header and relay buffer size, buffers are taken from
+ * the buffer pool only while a side has data in flight */
 #define IOBUFSIZE 16384
+struct worker;
+struct wconfig;
+struct cache_obj;
+struct cache_req;
 struct connect {
 	ev_io	cliio;
 	char	cliaddr[IPADDR_STR_SIZE];
-	char	clireadbuf[IOBUFSIZE];
-	size_t  clibufdata;
+	struct ringbuf clibuf;		/* client -> server data, head is sent */
+	int	clipipe[2];		/* client -> server splice pipe */
+	size_t	clipipedata;
 
 	ev_io	srvio;
 	char	srvaddr[IPADDR_STR_SIZE];
-	char	srvreadbuf[IOBUFSIZE];
-	size_t 	srvbufdata;
+	int	srvport;
+	struct sockaddr_in srvsin;
+	struct dns_waiter dnsw;
+	struct ringbuf srvbuf;		/* server -> client data, head is sent */
+	int	srvpipe[2];		/* server -> client splice pipe */
+	size_t	srvpipedata;
+
+	struct http_req req;		/* request head, parsed as it arrives */
+
+	/* framing of the current request/response exchange */
+	int64_t	reqleft;		/* request body not read yet, -1 - till EOF
+					 * or the last chunk */
+	int64_t	respleft;		/* response body not read yet, -1 - till EOF */
+	struct http_chunk chunk;	/* chunked response */
+	struct http_chunk reqchunk;	/* chunked request */
+
+	struct cache_req *cachereq;	/* a miss the response may be stored for */
+	struct cache_obj *fill;		/* response being stored */
+	struct cache_obj *hit;		/* cached response being sent */
+	size_t	hitoff;			/* its bytes sent */
+	char	hithdr[64];		/* its Age and Connection */
+	int	hithdrlen;
 
-	time_t starttime;
+	ev_tstamp reqtime;		/* request head is read */
+	struct access_rec acc;		/* filled in as it goes, written at close */
+	struct tw_timer timer;		/* timeout of the current state */
+	struct wconfig *conf;		/* filters as of accept */
+	ev_tstamp starttime;
 	size_t bytes;
 	int errors;
 	connstate state;
+	unsigned clieof:1;
+	unsigned srveof:1;
+	unsigned srvshut:1;		/* write side of server socket is shut */
+	unsigned clisplice:1;		/* client -> server data goes via clipipe */
+	unsigned srvsplice:1;		/* server -> client data goes via srvpipe */
+	unsigned inspect:1;		/* payload must pass through buffers */
+	unsigned tunnel:1;		/* no framing, relay until EOF */
+	unsigned peek:1;		/* CONNECT, look at the TLS hello first */
+	unsigned resphdr:1;		/* response head is read */
+	unsigned respdone:1;		/* whole response is read */
+	unsigned respchunked:1;
+	unsigned reqchunked:1;
+	unsigned nobody:1;		/* HEAD request */
+	unsigned clikeep:1;		/* client connection outlives the exchange */
+	unsigned srvkeep:1;		/* server connection may go to the pool */
+	unsigned reused:1;		/* server connection came from the pool */
+	unsigned noretry:1;		/* request can't be resent to another connection */
+	struct worker *worker;
 	LIST_ENTRY(connect) link;
 };
 
+/* connect from pointer to its member watcher */
+#define CONNECT_OF(ptr, field) \
+	((struct connect *)((char *)(ptr) - offsetof(struct connect, field)))
+
+/* origin-form GET of it to the proxy port is answered with counters */
+#define STAT_PATH "/stat"
+
+int server_socket(struct sockaddr_in *sin, int reuseport);
+void server_accept(EV_P_ ev_io *w, int revents);
+void connect_close(EV_P_ struct connect *c);
+int server_open(EV_P_ struct connect *c);
+void client_next(EV_P_ struct connect *c);
+void client_reply(struct connect *c, const char *hdr);
+void connect_timer(struct connect *c, int sec);
+
+extern const char badgw_hdr[];
+
 #endif
@@ -5,9 +5,34 @@
 
 #include "sfp.h"
 #include "sfp_opt.h"
+#include "worker.h"
 
 extern struct prog_opt sfp_opt;
 
+/* io_uring and linux aio submit the watcher changes of a loop iteration
+ * in one system call instead of an epoll_ctl() each */
+static const struct {
+	const char	*name;
+	unsigned	flag;
+} backends[] = {
+	{ "epoll",	EVBACKEND_EPOLL },
+	{ "iouring",	EVBACKEND_IOURING },
+	{ "linuxaio",	EVBACKEND_LINUXAIO },
+	{ "poll",	EVBACKEND_POLL },
+	{ "select",	EVBACKEND_SELECT },
+};
+
+const char*
+backend_name( unsigned backend )
+{
+	size_t i;
+
+	for( i = 0; i < sizeof(backends) / sizeof(backends[0]); i++ )
+		if( backends[i].flag == backend )
+			return backends[i].name;
+	return "unknown";
+}
+
 /* convert input parameter into an IPv4-address string */
 int
 get_ipaddr( const char* s, char* buf, size_t len )
@@ -33,10 +58,25 @@ init_opt( struct prog_opt* so )
 	assert( so );
 	so->is_foreground = 0;
 	so->is_immediate = 0;
+	so->splice = f_TRUE;
 	so->listen_addr[0] = 0;
+	so->nameserver[0] = 0;
 	so->listen_port = 3128;
-	so->timeout = 20,
-	so->logfile = so->configfile = so->pidfile = NULL;
+	so->backlog = LISTEN_BACKLOG;
+	so->defer_accept = 0;
+	so->timeout = 20;
+	so->connect_timeout = 10;
+	so->idle_timeout = 300;
+	so->workers = 1;
+	so->backend = 0;
+	so->bufmem = 0;
+	so->ringsize = 0;
+	so->hugering = f_FALSE;
+	so->cachemem = 0;
+	so->upstream_idle = UPSTREAM_MAX_IDLE;
+	so->upstream_timeout = UPSTREAM_IDLE_TIMEOUT;
+	so->logfile = so->configfile = so->pidfile = so->accessdir = NULL;
+	so->access_segment = (size_t)ACCESS_SEGMENT_SIZE << 20;
 	so->loglevel = L_ERROR;
 	return rc;
 }
@@ -52,31 +92,61 @@ free_opt( struct prog_opt* so )
 		free(so->configfile);
 	if( so->pidfile )
 		free(so->pidfile);
+	if( so->accessdir )
+		free(so->accessdir);
 }
 
 void
 usage( const char* app, FILE* fp )
 {
-	(void) fprintf (fp, "usage: %s [-f] [-v level] [-b listenaddr] [-p port] "
-		"[-t timeout] "
-		"[-c configfile] [-l logfile] [-P pidfile]\n"
+	(void) fprintf (fp, "usage: %s [-f] [-v level] [-b listenaddr] [-p port] [-L backlog] [-D sec] "
+		"[-t timeout] [-C timeout] [-I timeout] [-w workers] [-B backend] [-S] [-M bufmem] "
+		"[-m ringsize] [-H] [-R cachemem] [-d nameserver] "
+		"[-k maxidle] [-K idletimeout] "
+		"[-c configfile] [-l logfile] [-a accessdir] [-A segsize] [-P pidfile]\n"
 		, app );
 	(void) fprintf(fp,
 		"\t-v : set verbosity level 0-5 [default = 0]\n"
 		"\t-f : run foreground, do NOT run as a daemon\n"
+		"\t-S : relay through user space buffers, do NOT use splice()\n"
 		"\t-b : (IPv4) address to listen on [default = %s]\n"
 		"\t-p : port to listen on\n"
-		"\t-t : timeout, sec [default = %d]\n"
+		"\t-L : listen queue length [default = %d]\n"
+		"\t-D : accept clients only when they send data or after sec, 0 - off "
+		"[default = 0]\n"
+		"\t-t : request head timeout, sec, 0 - none [default = %d]\n"
+		"\t-C : server resolve and connect timeout, sec, 0 - none [default = %d]\n"
+		"\t-I : idle relay timeout, sec, 0 - none [default = %d]\n"
+		"\t-w : number of worker threads, 1-%d [default = %d]\n"
+		"\t-B : event backend of the workers, epoll, iouring, linuxaio, poll or select "
+		"[default = best available]\n"
+		"\t-d : DNS server, ip[:port] [default = from /etc/resolv.conf]\n"
+		"\t-M : memory for I/O buffers of all connections, MB [default = no limit]\n"
+		"\t-m : relay through mirrored rings of KB each, memory mapped twice, "
+		"not counted in -M, 0 - off [default = 0]\n"
+		"\t-H : back mirrored rings with huge pages, sizes are rounded up to %d KB\n"
+		"\t-R : memory for cached responses of all workers, MB, 0 - off "
+		"[default = 0]\n"
+		"\t-k : idle server connections kept per destination, 0 - no reuse [default = %d]\n"
+		"\t-K : idle server connection timeout, sec [default = %d]\n"
 		"\t-l : log file name\n"
 		"\t-c : config file name\n"
+		"\t-a : directory for binary access log segments, see sfp-logcat\n"
+		"\t-A : access log segment size, MB [default = %d]\n"
 		"\t-P : pid file name\n"
-		,IPv4_ALL, sfp_opt.timeout);
+		,IPv4_ALL, LISTEN_BACKLOG, sfp_opt.timeout, sfp_opt.connect_timeout,
+		sfp_opt.idle_timeout, MAX_WORKERS, sfp_opt.workers, RB_HUGE_PAGE >> 10,
+		UPSTREAM_MAX_IDLE, UPSTREAM_IDLE_TIMEOUT, ACCESS_SEGMENT_SIZE);
 	(void) fprintf( fp, "Examples:\n"
 		"  %s -p 4022 \n"
 		"\tlisten for HTTP requests on port 4022, all network interfaces\n"
 		"  %s -b 192.168.1.1 -p 4022\n"
-		"\tlisten for HTTP requests on IP 192.168.1.1, port 4022;\n",
-		app, app);
+		"\tlisten for HTTP requests on IP 192.168.1.1, port 4022;\n"
+		"  %s -w 4\n"
+		"\tserve with 4 worker threads, each with its own loop and socket;\n"
+		"Counters and latencies of a running proxy on port 4022:\n"
+		"  curl http://127.0.0.1:4022" STAT_PATH "\n",
+		app, app, app);
 	return;
 }
 
@@ -84,7 +154,7 @@ int
 get_opt(int argc, char* const argv[])
 {
 	int rc = 0, ch = 0;
-	static const char OPTMASK[] = "fv:b:l:p:t:P:r";
+	static const char OPTMASK[] = "fSHv:b:l:c:a:A:p:L:D:t:C:I:w:B:M:m:R:d:k:K:P:r";
 
 	rc = init_opt( &sfp_opt );
 	while( (0 == rc) && (-1 != (ch = getopt(argc, argv, OPTMASK))) ) {
@@ -120,6 +190,9 @@ get_opt(int argc, char* const argv[])
 				  sfp_opt.loglevel = L_DEBUG;
 				  break;
 
+			case 'S': sfp_opt.splice = f_FALSE;
+				  break;
+
 			case 'b':
 				  rc = get_ipaddr( optarg, sfp_opt.listen_addr, sizeof(sfp_opt.listen_addr) );
 				  if( 0 != rc ) {
@@ -138,6 +211,24 @@ get_opt(int argc, char* const argv[])
 				  }
 				  break;
 
+			case 'L':
+				  sfp_opt.backlog = atoi( optarg );
+				  if( sfp_opt.backlog <= 0 ) {
+					  (void) fprintf( stderr, "Invalid backlog: [%d]\n",
+							  sfp_opt.backlog );
+					  rc = ERR_PARAM;
+				  }
+				  break;
+
+			case 'D':
+				  sfp_opt.defer_accept = atoi( optarg );
+				  if( sfp_opt.defer_accept < 0 ) {
+					  (void) fprintf( stderr, "Invalid defer accept: [%d]\n",
+							  sfp_opt.defer_accept );
+					  rc = ERR_PARAM;
+				  }
+				  break;
+
 			case 't':
 				  sfp_opt.timeout = atoi( optarg );
 				  if( sfp_opt.timeout < 0 ) {
@@ -147,6 +238,108 @@ get_opt(int argc, char* const argv[])
 				  }
 				  break;
 
+			case 'C':
+				  sfp_opt.connect_timeout = atoi( optarg );
+				  if( sfp_opt.connect_timeout < 0 ) {
+					  (void) fprintf( stderr, "Invalid connect timeout: [%d]\n",
+							  sfp_opt.connect_timeout );
+					  rc = ERR_PARAM;
+				  }
+				  break;
+
+			case 'I':
+				  sfp_opt.idle_timeout = atoi( optarg );
+				  if( sfp_opt.idle_timeout < 0 ) {
+					  (void) fprintf( stderr, "Invalid idle timeout: [%d]\n",
+							  sfp_opt.idle_timeout );
+					  rc = ERR_PARAM;
+				  }
+				  break;
+
+			case 'w':
+				  sfp_opt.workers = atoi( optarg );
+				  if( sfp_opt.workers <= 0 || sfp_opt.workers > MAX_WORKERS ) {
+					  (void) fprintf( stderr, "Invalid number of workers: [%d]\n",
+							  sfp_opt.workers );
+					  rc = ERR_PARAM;
+				  }
+				  break;
+
+			case 'B': {
+				  size_t i;
+				  for( i = 0; i < sizeof(backends) / sizeof(backends[0]); i++ )
+					  if( 0 == strcmp(optarg, backends[i].name) )
+						  break;
+				  if( i == sizeof(backends) / sizeof(backends[0]) ||
+				      !(ev_supported_backends() & backends[i].flag) ) {
+					  (void) fprintf( stderr, "Unsupported backend: [%s]\n", optarg );
+					  rc = ERR_PARAM;
+					  break;
+				  }
+				  sfp_opt.backend = backends[i].flag;
+				  break;
+			}
+
+			case 'M': {
+				  int mb = atoi( optarg );
+				  if( mb < 0 ) {
+					  (void) fprintf( stderr, "Invalid buffer memory: [%d]\n", mb );
+					  rc = ERR_PARAM;
+				  }
+				  sfp_opt.bufmem = (size_t)mb << 20;
+				  break;
+			}
+
+			case 'm': {
+				  int kb = atoi( optarg );
+				  if( kb < 0 ) {
+					  (void) fprintf( stderr, "Invalid ring size: [%d]\n", kb );
+					  rc = ERR_PARAM;
+				  }
+				  sfp_opt.ringsize = (size_t)kb << 10;
+				  break;
+			}
+
+			case 'H': sfp_opt.hugering = f_TRUE;
+				  break;
+
+			case 'R': {
+				  int mb = atoi( optarg );
+				  if( mb < 0 ) {
+					  (void) fprintf( stderr, "Invalid cache memory: [%d]\n", mb );
+					  rc = ERR_PARAM;
+				  }
+				  sfp_opt.cachemem = (size_t)mb << 20;
+				  break;
+			}
+
+			case 'd':
+				  if( strlen(optarg) >= sizeof(sfp_opt.nameserver) ) {
+					  (void) fprintf( stderr, "Invalid nameserver: [%s]\n", optarg );
+					  rc = ERR_PARAM;
+					  break;
+				  }
+				  strcpy( sfp_opt.nameserver, optarg );
+				  break;
+
+			case 'k':
+				  sfp_opt.upstream_idle = atoi( optarg );
+				  if( sfp_opt.upstream_idle < 0 ) {
+					  (void) fprintf( stderr, "Invalid idle connections: [%d]\n",
+							  sfp_opt.upstream_idle );
+					  rc = ERR_PARAM;
+				  }
+				  break;
+
+			case 'K':
+				  sfp_opt.upstream_timeout = atoi( optarg );
+				  if( sfp_opt.upstream_timeout <= 0 ) {
+					  (void) fprintf( stderr, "Invalid idle timeout: [%d]\n",
+							  sfp_opt.upstream_timeout );
+					  rc = ERR_PARAM;
+				  }
+				  break;
+
 			case 'l':
 				  sfp_opt.logfile = strdup(optarg);
 				  break;
@@ -159,6 +352,20 @@ get_opt(int argc, char* const argv[])
 				  sfp_opt.pidfile = strdup(optarg);
 				  break;
 
+			case 'a':
+				  sfp_opt.accessdir = strdup(optarg);
+				  break;
+
+			case 'A': {
+				  int mb = atoi( optarg );
+				  if( mb <= 0 ) {
+					  (void) fprintf( stderr, "Invalid segment size: [%d]\n", mb );
+					  rc = ERR_PARAM;
+				  }
+				  sfp_opt.access_segment = (size_t)mb << 20;
+				  break;
+			}
+
 			case ':':
 				  (void) fprintf( stderr,
 						  "Option [-%c] requires an argument\n",
@@ -179,6 +386,12 @@ get_opt(int argc, char* const argv[])
 		}
 	} /* while getopt */
 
+	/* mirrored rings are mapped in whole pages */
+	if( sfp_opt.ringsize ) {
+		size_t page = sfp_opt.hugering ? RB_HUGE_PAGE : (size_t)sysconf(_SC_PAGESIZE);
+		sfp_opt.ringsize = (sfp_opt.ringsize + page - 1) / page * page;
+	}
+
 	if (rc) {
 		free_opt( &sfp_opt );
 		return rc;
@@ -18,12 +18,28 @@ static const char	IPv4_ALL[]	= "0.0.0.0";
 struct prog_opt {
 	flag_t		is_foreground;
 	flag_t		is_immediate;
+	flag_t		splice;
 	char		listen_addr[IPADDR_STR_SIZE];
 	int		listen_port;
-	int		timeout;
+	int		backlog;
+	int		defer_accept;		/* sec, 0 - off */
+	int		timeout;		/* request head, sec */
+	int		connect_timeout;	/* resolve and connect */
+	int		idle_timeout;		/* relay without any I/O */
+	int		workers;
+	unsigned	backend;	/* libev backend of the workers, 0 - auto */
+	char		nameserver[IPADDR_STR_SIZE + PORT_STR_SIZE];
+	size_t		bufmem;		/* buffer pool cap, bytes, 0 - no cap */
+	size_t		ringsize;	/* mirrored relay rings, bytes, 0 - off */
+	flag_t		hugering;	/* on huge pages */
+	size_t		cachemem;	/* response cache of all workers, bytes, 0 - off */
+	int		upstream_idle;	/* idle server connections per destination */
+	int		upstream_timeout;
 	char*		logfile;
 	char*		configfile;
 	char*		pidfile;
+	char*		accessdir;	/* binary access log, NULL - off */
+	size_t		access_segment;	/* its segment size, bytes */
 	loglevel	loglevel;
 };
 
@@ -46,6 +62,10 @@ usage( const char* app, FILE* fp );
 int
 get_opt(int argc, char* const argv[] );
 
+/* name of a single libev backend flag */
+const char*
+backend_name( unsigned backend );
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "stats.h"
+
+#define LOAD(var)	__atomic_load_n(&(var), __ATOMIC_RELAXED)
+
+static void
+hist_merge(struct hist *to, const struct hist *from)
+{
+	uint64_t max = LOAD(from->max);
+	int i;
+
+	for (i = 0; i < HIST_SIZE; i++)
+		to->count[i] += LOAD(from->count[i]);
+	to->total += LOAD(from->total);
+	to->sum += LOAD(from->sum);
+	if (max > to->max)
+		to->max = max;
+}
+
+void
+stats_merge(struct stats *to, const struct stats *from)
+{
+	to->accepts += LOAD(from->accepts);
+	to->closes += LOAD(from->closes);
+	to->denied += LOAD(from->denied);
+	to->requests += LOAD(from->requests);
+	to->bytes += LOAD(from->bytes);
+	to->errors += LOAD(from->errors);
+	to->timeouts += LOAD(from->timeouts);
+	to->badreq += LOAD(from->badreq);
+	to->blocked_host += LOAD(from->blocked_host);
+	to->blocked_url += LOAD(from->blocked_url);
+	to->blocked_regex += LOAD(from->blocked_regex);
+	to->tunnels += LOAD(from->tunnels);
+	to->blocked_sni += LOAD(from->blocked_sni);
+	to->cache_hits += LOAD(from->cache_hits);
+	to->cache_misses += LOAD(from->cache_misses);
+	to->pool_slabs += LOAD(from->pool_slabs);
+	to->pool_hiwat += LOAD(from->pool_hiwat);
+	to->pool_misses += LOAD(from->pool_misses);
+	hist_merge(&to->ttfb, &from->ttfb);
+	hist_merge(&to->lifetime, &from->lifetime);
+}
+
+/* highest value of the bucket */
+static uint64_t
+bucket_top(int i)
+{
+	unsigned shift;
+
+	if (i < 2 * HIST_SUB)
+		return i;
+	shift = (i >> HIST_SUB_BITS) - 1;
+	return ((uint64_t)(i - (shift << HIST_SUB_BITS) + 1) << shift) - 1;
+}
+
+/* value at quantile q, counts are read while being updated so the
+ * total is taken from the buckets themselves */
+static uint64_t
+hist_quantile(const struct hist *h, uint64_t total, double q)
+{
+	uint64_t want = (uint64_t)(q * total + 0.5), seen = 0;
+	int i;
+
+	if (want == 0)
+		want = 1;
+	for (i = 0; i < HIST_SIZE; i++) {
+		seen += h->count[i];
+		if (seen >= want)
+			return bucket_top(i) < h->max ? bucket_top(i) : h->max;
+	}
+	return h->max;
+}
+
+static size_t
+hist_format(const char *name, const struct hist *h, char *buf, size_t size)
+{
+	uint64_t total = 0;
+	int i, n;
+
+	for (i = 0; i < HIST_SIZE; i++)
+		total += h->count[i];
+	if (total == 0)
+		n = snprintf(buf, size, "%s_count 0\n", name);
+	else
+		n = snprintf(buf, size, "%s_count %llu\n%s_mean_ms %.3f\n"
+			"%s_p50_ms %.3f\n%s_p90_ms %.3f\n%s_p99_ms %.3f\n"
+			"%s_p999_ms %.3f\n%s_max_ms %.3f\n",
+			name, (unsigned long long)total,
+			name, h->sum / 1e3 / (h->total ? h->total : 1),
+			name, hist_quantile(h, total, 0.5) / 1e3,
+			name, hist_quantile(h, total, 0.9) / 1e3,
+			name, hist_quantile(h, total, 0.99) / 1e3,
+			name, hist_quantile(h, total, 0.999) / 1e3,
+			name, h->max / 1e3);
+	if (n < 0)
+		return 0;
+	return (size_t)n < size ? (size_t)n : size - 1;
+}
+
+size_t
+stats_format(const struct stats *s, double uptime, int nworkers, char *buf, size_t size)
+{
+	/* closes can be counted ahead of accepts of another worker */
+	uint64_t active = s->accepts > s->closes ? s->accepts - s->closes : 0;
+	size_t len;
+	int n;
+
+	if (uptime < 1)
+		uptime = 1;
+	n = snprintf(buf, size,
+		"uptime %.0f\n"
+		"workers %d\n"
+		"active %llu\n"
+		"accepts %llu\n"
+		"accepts_per_sec %.2f\n"
+		"requests %llu\n"
+		"bytes %llu\n"
+		"errors %llu\n"
+		"timeouts %llu\n"
+		"denied_acl %llu\n"
+		"bad_requests %llu\n"
+		"blocked_host %llu\n"
+		"blocked_url %llu\n"
+		"blocked_regex %llu\n"
+		"tunnels %llu\n"
+		"blocked_sni %llu\n"
+		"cache_hits %llu\n"
+		"cache_misses %llu\n"
+		"pool_slabs %llu\n"
+		"pool_hiwat %llu\n"
+		"pool_misses %llu\n",
+		uptime, nworkers,
+		(unsigned long long)active,
+		(unsigned long long)s->accepts, s->accepts / uptime,
+		(unsigned long long)s->requests,
+		(unsigned long long)s->bytes,
+		(unsigned long long)s->errors,
+		(unsigned long long)s->timeouts,
+		(unsigned long long)s->denied,
+		(unsigned long long)s->badreq,
+		(unsigned long long)s->blocked_host,
+		(unsigned long long)s->blocked_url,
+		(unsigned long long)s->blocked_regex,
+		(unsigned long long)s->tunnels,
+		(unsigned long long)s->blocked_sni,
+		(unsigned long long)s->cache_hits,
+		(unsigned long long)s->cache_misses,
+		(unsigned long long)s->pool_slabs,
+		(unsigned long long)s->pool_hiwat,
+		(unsigned long long)s->pool_misses);
+	if (n < 0)
+		return 0;
+	len = (size_t)n < size ? (size_t)n : size - 1;
+	len += hist_format("ttfb", &s->ttfb, buf + len, size - len);
+	len += hist_format("lifetime", &s->lifetime, buf + len, size - len);
+	return len;
+}
@@ -0,0 +1,87 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CACHE_LINE	64
+
+/* log-linear histogram of microseconds: values below 2^HIST_SUB_BITS
+ * exactly, above it 2^HIST_SUB_BITS buckets per power of two, so any
+ * value is off by 1/32 at most; larger than 2^HIST_MAX_BITS (~19 hours)
+ * go to the last bucket */
+#define HIST_SUB_BITS	5
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS	36
+#define HIST_SIZE	((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct hist {
+	uint64_t	count[HIST_SIZE];
+	uint64_t	total;
+	uint64_t	sum;
+	uint64_t	max;
+};
+
+/* counters of one worker; only the owner writes them, with plain
+ * stores, other threads read them for a report.  Whole cache lines
+ * are taken so workers never write the same line. */
+struct stats {
+	uint64_t	accepts;
+	uint64_t	closes;
+	uint64_t	denied;		/* by the client ACL */
+	uint64_t	requests;
+	uint64_t	bytes;
+	uint64_t	errors;
+	uint64_t	timeouts;
+	uint64_t	badreq;		/* malformed or too large */
+	uint64_t	blocked_host;
+	uint64_t	blocked_url;
+	uint64_t	blocked_regex;
+	uint64_t	tunnels;	/* CONNECT, established */
+	uint64_t	blocked_sni;	/* CONNECT, by the TLS server name */
+	uint64_t	cache_hits;
+	uint64_t	cache_misses;	/* of requests the cache could answer */
+	uint64_t	pool_slabs;	/* connection pool, allocated */
+	uint64_t	pool_hiwat;	/* most connects in use at once */
+	uint64_t	pool_misses;	/* connects the pool had to grow for */
+	struct hist	ttfb;		/* request read to first response byte */
+	struct hist	lifetime;	/* client connection */
+} __attribute__((aligned(CACHE_LINE)));
+
+/* single writer update, a load and a store without a locked insn; the
+ * store is atomic so readers never see a torn value */
+#define STAT_ADD(var, n)	__atomic_store_n(&(var), (var) + (n), __ATOMIC_RELAXED)
+#define STAT_INC(var)		STAT_ADD(var, 1)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static inline void
+hist_add(struct hist *h, uint64_t v)
+{
+	unsigned shift = 0;
+
+	if (v >= (1ULL << HIST_MAX_BITS))
+		v = (1ULL << HIST_MAX_BITS) - 1;
+	if (v >= HIST_SUB)
+		shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+	STAT_INC(h->count[(shift << HIST_SUB_BITS) + (v >> shift)]);
+	STAT_INC(h->total);
+	STAT_ADD(h->sum, v);
+	if (v > h->max)
+		__atomic_store_n(&h->max, v, __ATOMIC_RELAXED);
+}
+
+/* add up counters of some worker read from another thread */
+void stats_merge(struct stats *to, const struct stats *from);
+
+/* plain text report, returns its length */
+size_t stats_format(const struct stats *s, double uptime, int nworkers,
+		char *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STATS_H */
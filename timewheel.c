@@ -0,0 +1,118 @@
+#include <string.h>
+
+#include "timewheel.h"
+
+#define TW_MASK		(TW_SLOTS - 1)
+#define TW_MAX		((1ULL << (TW_BITS * TW_LEVELS)) - 1)
+
+void
+tw_init(struct timewheel *tw, double now, void *data)
+{
+	int l, s;
+
+	memset(tw, 0, sizeof(*tw));
+	for (l = 0; l < TW_LEVELS; l++)
+		for (s = 0; s < TW_SLOTS; s++)
+			LIST_INIT(&tw->slots[l][s]);
+	tw->start = now;
+	tw->data = data;
+}
+
+/* slot by the distance from now, expire is not in the past; one due now
+ * goes to the level 0 slot about to be run */
+static void
+place(struct timewheel *tw, struct tw_timer *t)
+{
+	uint64_t d = t->expire - tw->now;
+	int l;
+
+	for (l = 0; l < TW_LEVELS - 1; l++)
+		if (d < (1ULL << (TW_BITS * (l + 1))))
+			break;
+	LIST_INSERT_HEAD(&tw->slots[l][(t->expire >> (TW_BITS * l)) & TW_MASK], t, link);
+}
+
+void
+tw_add(struct timewheel *tw, struct tw_timer *t, double sec)
+{
+	uint64_t ticks = sec / TW_TICK + 0.999;
+
+	if (ticks == 0)
+		ticks = 1;
+	if (ticks > TW_MAX)
+		ticks = TW_MAX;
+	if (t->armed) {
+		/* later deadline is found when the current slot comes up */
+		if (tw->now + ticks >= t->expire) {
+			t->expire = tw->now + ticks;
+			return;
+		}
+		LIST_REMOVE(t, link);
+	}
+	else {
+		t->armed = 1;
+		tw->count++;
+	}
+	t->expire = tw->now + ticks;
+	place(tw, t);
+}
+
+void
+tw_del(struct timewheel *tw, struct tw_timer *t)
+{
+	if (!t->armed)
+		return;
+	LIST_REMOVE(t, link);
+	t->armed = 0;
+	tw->count--;
+}
+
+/* move the slot of level l which the wheel has just reached down */
+static void
+cascade(struct timewheel *tw, int l)
+{
+	struct tw_slot *slot = &tw->slots[l][(tw->now >> (TW_BITS * l)) & TW_MASK];
+	struct tw_timer *t;
+
+	while ((t = LIST_FIRST(slot)) != NULL) {
+		LIST_REMOVE(t, link);
+		if (t->expire < tw->now)
+			t->expire = tw->now;
+		place(tw, t);
+	}
+}
+
+void
+tw_advance(struct timewheel *tw, double now)
+{
+	uint64_t target = (now - tw->start) / TW_TICK;
+	struct tw_slot *slot;
+	struct tw_timer *t;
+	int l;
+
+	while (tw->now < target) {
+		tw->now++;
+		if (tw->count == 0) {
+			/* nothing to turn, jump */
+			tw->now = target;
+			break;
+		}
+		for (l = 1; l < TW_LEVELS; l++) {
+			if ((tw->now >> (TW_BITS * (l - 1))) & TW_MASK)
+				break;
+			cascade(tw, l);
+		}
+
+		slot = &tw->slots[0][tw->now & TW_MASK];
+		while ((t = LIST_FIRST(slot)) != NULL) {
+			LIST_REMOVE(t, link);
+			if (t->expire > tw->now) {
+				place(tw, t);
+				continue;
+			}
+			t->armed = 0;
+			tw->count--;
+			t->cb(tw, t);
+		}
+	}
+}
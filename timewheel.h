@@ -0,0 +1,63 @@
+#ifndef TIMEWHEEL_H
+#define TIMEWHEEL_H
+
+#include <stdint.h>
+
+#include "queue.h"
+
+#define TW_TICK		0.25		/* sec */
+#define TW_BITS		6
+#define TW_SLOTS	(1 << TW_BITS)
+#define TW_LEVELS	4		/* 64^4 ticks, ~48 days */
+
+struct timewheel;
+struct tw_timer;
+
+typedef void (*tw_cb)(struct timewheel *tw, struct tw_timer *t);
+
+struct tw_timer {
+	LIST_ENTRY(tw_timer) link;
+	uint64_t	expire;		/* tick */
+	tw_cb		cb;
+	unsigned	armed:1;
+};
+
+LIST_HEAD(tw_slot, tw_timer);
+
+/* hierarchical timing wheel: a timer sits in the level its distance
+ * fits in and moves down as the wheel turns, so arming and cancelling
+ * are O(1) whatever the number of timers; a timer pushed further away
+ * only gets a new expire and is moved when its old slot comes up */
+struct timewheel {
+	struct tw_slot	slots[TW_LEVELS][TW_SLOTS];
+	uint64_t	now;		/* ticks done */
+	double		start;		/* time of tick 0 */
+	unsigned long	count;
+	void		*data;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void tw_init(struct timewheel *tw, double now, void *data);
+
+static inline void
+tw_timer_init(struct tw_timer *t, tw_cb cb)
+{
+	t->cb = cb;
+	t->armed = 0;
+}
+
+/* (re)arm to fire after sec seconds, rounded up to a tick */
+void tw_add(struct timewheel *tw, struct tw_timer *t, double sec);
+void tw_del(struct timewheel *tw, struct tw_timer *t);
+
+/* fire all timers due by now */
+void tw_advance(struct timewheel *tw, double now);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TIMEWHEEL_H */
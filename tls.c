@@ -0,0 +1,142 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "tls.h"
+
+#define REC_HEADER	5
+#define REC_MAX		16384		/* plaintext record, RFC 8446 5.1 */
+#define CT_HANDSHAKE	22
+#define HS_CLIENT_HELLO	1
+#define EXT_SERVER_NAME	0
+#define SNI_HOST_NAME	0
+
+/* handshake bytes of a record stream, headers stepped over; every
+ * read is also counted against the hello so it can't run past it */
+struct hs_reader {
+	const unsigned char *p;
+	size_t		len;		/* bytes in the buffer */
+	size_t		pos;		/* next one */
+	size_t		recend;		/* end of the current record */
+	size_t		left;		/* of the hello body */
+};
+
+/* make the next byte available, TLS_MORE or TLS_NOTLS if it isn't */
+static int
+hs_avail(struct hs_reader *r)
+{
+	const unsigned char *h;
+	size_t n;
+
+	while (r->pos == r->recend) {
+		if (r->len - r->pos < REC_HEADER)
+			return TLS_MORE;
+		h = r->p + r->pos;
+		n = h[3] << 8 | h[4];
+		if (h[0] != CT_HANDSHAKE || h[1] != 3 || n == 0 || n > REC_MAX)
+			return TLS_NOTLS;
+		r->pos += REC_HEADER;
+		r->recend = r->pos + n;
+	}
+	return r->pos < r->len ? 1 : TLS_MORE;
+}
+
+/* copy n bytes out, or just skip them if to is NULL */
+static int
+hs_read(struct hs_reader *r, unsigned char *to, size_t n)
+{
+	size_t k;
+	int s;
+
+	if (n > r->left)
+		return TLS_NOTLS;
+	r->left -= n;
+	while (n > 0) {
+		if ((s = hs_avail(r)) <= 0)
+			return s;
+		k = r->recend < r->len ? r->recend - r->pos : r->len - r->pos;
+		if (k > n)
+			k = n;
+		if (to) {
+			memcpy(to, r->p + r->pos, k);
+			to += k;
+		}
+		r->pos += k;
+		n -= k;
+	}
+	return 1;
+}
+
+/* big endian integer of n bytes */
+static int
+hs_uint(struct hs_reader *r, size_t n, size_t *v)
+{
+	unsigned char b[3];
+	size_t i;
+	int s;
+
+	if ((s = hs_read(r, b, n)) <= 0)
+		return s;
+	for (*v = 0, i = 0; i < n; i++)
+		*v = *v << 8 | b[i];
+	return 1;
+}
+
+/* skip a vector with a length prefix of n bytes */
+static int
+hs_skipvec(struct hs_reader *r, size_t n)
+{
+	size_t len;
+	int s;
+
+	if ((s = hs_uint(r, n, &len)) <= 0)
+		return s;
+	return hs_read(r, NULL, len);
+}
+
+#define TRY(e)	do { if ((s = (e)) <= 0) return s; } while (0)
+
+int
+tls_sni(const char *buf, size_t len, char name[TLS_NAME_MAX + 1])
+{
+	struct hs_reader r = { (const unsigned char *)buf, len, 0, 0, 4 };
+	size_t v, extlen, type, n;
+	int s;
+
+	/* a TLS client speaks first, and with a handshake record */
+	if (len > 0 && r.p[0] != CT_HANDSHAKE)
+		return TLS_NOTLS;
+
+	TRY(hs_uint(&r, 1, &v));
+	if (v != HS_CLIENT_HELLO)
+		return TLS_NOTLS;
+	TRY(hs_uint(&r, 3, &r.left));
+
+	TRY(hs_read(&r, NULL, 2 + 32));		/* version, random */
+	TRY(hs_skipvec(&r, 1));			/* session id */
+	TRY(hs_skipvec(&r, 2));			/* cipher suites */
+	TRY(hs_skipvec(&r, 1));			/* compression methods */
+	if (r.left == 0)
+		return TLS_NOSNI;
+
+	TRY(hs_uint(&r, 2, &extlen));
+	if (extlen != r.left)
+		return TLS_NOTLS;
+	while (r.left > 0) {
+		TRY(hs_uint(&r, 2, &type));
+		TRY(hs_uint(&r, 2, &n));
+		if (type != EXT_SERVER_NAME) {
+			TRY(hs_read(&r, NULL, n));
+			continue;
+		}
+		/* server_name_list, the host_name entry is the only one in use */
+		TRY(hs_uint(&r, 2, &v));
+		TRY(hs_uint(&r, 1, &type));
+		TRY(hs_uint(&r, 2, &n));
+		if (type != SNI_HOST_NAME || n == 0 || n > TLS_NAME_MAX)
+			return TLS_NOTLS;
+		TRY(hs_read(&r, (unsigned char *)name, n));
+		name[n] = 0;
+		return memchr(name, 0, n) ? TLS_NOTLS : TLS_SNI;
+	}
+	return TLS_NOSNI;
+}
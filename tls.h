@@ -0,0 +1,29 @@
+#ifndef TLS_H
+#define TLS_H
+
+#include <stddef.h>
+
+/* what the first bytes of a tunnel turned out to be */
+#define TLS_NOTLS	(-1)	/* not a TLS handshake, or a broken one */
+#define TLS_MORE	0	/* ClientHello is not complete yet */
+#define TLS_SNI		1	/* host name found */
+#define TLS_NOSNI	2	/* ClientHello without a host name */
+
+/* longest host name, as DNS has it */
+#define TLS_NAME_MAX	255
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* server_name of the ClientHello at the start of buf, copied to name
+ * nul terminated; records may be cut anywhere and the hello may span
+ * several of them, so it is called again over all bytes so far as more
+ * arrive; nothing is allocated and nothing past the host name is read */
+int tls_sni(const char *buf, size_t len, char name[TLS_NAME_MAX + 1]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TLS_H */
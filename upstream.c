@@ -0,0 +1,203 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sfp.h"
+#include "upstream.h"
+
+struct upidle {
+	ev_io		io;		/* readable while idle means closed */
+	ev_tstamp	since;
+	struct updest	*dest;
+	struct upstream_pool *pool;
+	TAILQ_ENTRY(upidle) dlink;	/* per destination, newest first */
+	TAILQ_ENTRY(upidle) alink;
+};
+
+struct updest {
+	struct updest	*next;
+	in_addr_t	ip;
+	in_port_t	port;
+	int		nidle;
+	TAILQ_HEAD(updest_idle, upidle) idle;
+};
+
+static inline unsigned
+dest_bucket(in_addr_t ip, in_port_t port)
+{
+	return ((ip * 2654435761u) ^ port) % UPSTREAM_BUCKETS;
+}
+
+static struct updest *
+dest_find(struct upstream_pool *p, const struct sockaddr_in *sin, int create)
+{
+	unsigned b = dest_bucket(sin->sin_addr.s_addr, sin->sin_port);
+	struct updest *d;
+
+	for (d = p->table[b]; d; d = d->next)
+		if (d->ip == sin->sin_addr.s_addr && d->port == sin->sin_port)
+			return d;
+	if (!create || !(d = calloc(1, sizeof(*d))))
+		return NULL;
+	d->ip = sin->sin_addr.s_addr;
+	d->port = sin->sin_port;
+	TAILQ_INIT(&d->idle);
+	d->next = p->table[b];
+	p->table[b] = d;
+	return d;
+}
+
+static void
+dest_free(struct upstream_pool *p, struct updest *d)
+{
+	struct updest **pp = &p->table[dest_bucket(d->ip, d->port)];
+	while (*pp != d)
+		pp = &(*pp)->next;
+	*pp = d->next;
+	free(d);
+}
+
+/* take idle connection out of the pool, returns its fd */
+static int
+idle_remove(EV_P_ struct upstream_pool *p, struct upidle *u)
+{
+	struct updest *d = u->dest;
+	int fd = u->io.fd;
+
+	ev_io_stop(EV_A_ &u->io);
+	TAILQ_REMOVE(&d->idle, u, dlink);
+	TAILQ_REMOVE(&p->all, u, alink);
+	p->nidle--;
+	if (--d->nidle == 0)
+		dest_free(p, d);
+	free(u);
+	return fd;
+}
+
+static void
+idle_cbread(EV_P_ ev_io *w, int revents)
+{
+	struct upidle *u = (struct upidle *)w;
+	struct upstream_pool *p = u->pool;
+
+	p->stats.dead++;
+	close(idle_remove(EV_A_ p, u));
+}
+
+static void
+sweep_cb(EV_P_ ev_timer *w, int revents)
+{
+	struct upstream_pool *p = (struct upstream_pool *)((char *)w - offsetof(struct upstream_pool, sweep));
+	ev_tstamp deadline = ev_now(EV_A) - p->timeout;
+	struct upidle *u;
+
+	while ((u = TAILQ_FIRST(&p->all)) != NULL && u->since <= deadline) {
+		p->stats.expired++;
+		close(idle_remove(EV_A_ p, u));
+	}
+}
+
+int
+upstream_init(EV_P_ struct upstream_pool *p, int maxidle, int timeout)
+{
+	memset(p, 0, sizeof(*p));
+	TAILQ_INIT(&p->all);
+	p->maxidle = maxidle;
+	p->timeout = timeout > 0 ? timeout : UPSTREAM_IDLE_TIMEOUT;
+	if (maxidle <= 0)
+		return 0;
+
+	p->table = calloc(UPSTREAM_BUCKETS, sizeof(*p->table));
+	if (!p->table)
+		return -1;
+	/* expiry is checked at a quarter of the timeout granularity */
+	ev_timer_init(&p->sweep, sweep_cb, p->timeout / 4, p->timeout / 4);
+	ev_timer_start(EV_A_ &p->sweep);
+	return 0;
+}
+
+void
+upstream_destroy(EV_P_ struct upstream_pool *p)
+{
+	struct upidle *u;
+
+	if (!p->table)
+		return;
+	ev_timer_stop(EV_A_ &p->sweep);
+	while ((u = TAILQ_FIRST(&p->all)) != NULL)
+		close(idle_remove(EV_A_ p, u));
+	free(p->table);
+	p->table = NULL;
+}
+
+/* socket still open and the server has sent nothing since */
+static int
+idle_alive(int fd)
+{
+	char c;
+	ssize_t r = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	return r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+int
+upstream_get(EV_P_ struct upstream_pool *p, const struct sockaddr_in *sin)
+{
+	struct updest *d;
+
+	if (!p->table)
+		return -1;
+
+	while ((d = dest_find(p, sin, 0)) != NULL) {
+		int fd = idle_remove(EV_A_ p, TAILQ_FIRST(&d->idle));
+		if (idle_alive(fd)) {
+			p->stats.reused++;
+			return fd;
+		}
+		p->stats.dead++;
+		close(fd);
+	}
+	p->stats.misses++;
+	return -1;
+}
+
+void
+upstream_put(EV_P_ struct upstream_pool *p, int fd, const struct sockaddr_in *sin)
+{
+	struct updest *d;
+	struct upidle *u;
+
+	if (!p->table || !(d = dest_find(p, sin, 1))) {
+		close(fd);
+		return;
+	}
+
+	if (d->nidle >= p->maxidle || p->nidle >= UPSTREAM_MAX_TOTAL) {
+		/* make room by dropping the oldest one */
+		struct upidle *old = d->nidle >= p->maxidle ?
+			TAILQ_LAST(&d->idle, updest_idle) : TAILQ_FIRST(&p->all);
+		p->stats.dropped++;
+		close(idle_remove(EV_A_ p, old));
+		if (!(d = dest_find(p, sin, 1))) {
+			close(fd);
+			return;
+		}
+	}
+
+	if (!(u = malloc(sizeof(*u)))) {
+		if (d->nidle == 0)
+			dest_free(p, d);
+		close(fd);
+		return;
+	}
+	u->since = ev_now(EV_A);
+	u->dest = d;
+	u->pool = p;
+	TAILQ_INSERT_HEAD(&d->idle, u, dlink);
+	TAILQ_INSERT_TAIL(&p->all, u, alink);
+	d->nidle++;
+	p->nidle++;
+	p->stats.parked++;
+
+	ev_io_init(&u->io, idle_cbread, fd, EV_READ);
+	ev_io_start(EV_A_ &u->io);
+}
@@ -0,0 +1,55 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <netinet/in.h>
+#include <ev.h>
+
+#include "queue.h"
+
+#define UPSTREAM_MAX_IDLE	8	/* per destination */
+#define UPSTREAM_MAX_TOTAL	1024	/* per worker */
+#define UPSTREAM_IDLE_TIMEOUT	30	/* sec */
+#define UPSTREAM_BUCKETS	256
+
+struct updest;
+struct upidle;
+
+struct upstream_stats {
+	unsigned long	parked;
+	unsigned long	reused;
+	unsigned long	misses;		/* nothing idle for the destination */
+	unsigned long	dead;		/* closed by the server or failed check */
+	unsigned long	expired;	/* idle timeout */
+	unsigned long	dropped;	/* over the idle limits */
+};
+
+/* per-worker pool of idle keep-alive server connections by (ip, port) */
+struct upstream_pool {
+	struct updest	**table;
+	TAILQ_HEAD(, upidle) all;	/* oldest first */
+	size_t		nidle;
+	int		maxidle;
+	ev_tstamp	timeout;
+	ev_timer	sweep;
+	struct upstream_stats stats;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* maxidle 0 disables reuse */
+int upstream_init(EV_P_ struct upstream_pool *p, int maxidle, int timeout);
+void upstream_destroy(EV_P_ struct upstream_pool *p);
+
+/* live idle connection to sin or -1 */
+int upstream_get(EV_P_ struct upstream_pool *p, const struct sockaddr_in *sin);
+
+/* park fd, closing it if the pool is full */
+void upstream_put(EV_P_ struct upstream_pool *p, int fd, const struct sockaddr_in *sin);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UPSTREAM_H */
@@ -0,0 +1,312 @@
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_SSSE3_PATH 1
+#endif
+
+#include "urlfilter.h"
+
+#define AC_MAX_STATES	(1u << 24)	/* edge target is 24 bits */
+#define HITS_ALIGN	64		/* a cache line per row of counters */
+
+struct ac_node {
+	uint32_t	child;		/* 0 - none, root is never a child */
+	uint32_t	sibling;
+	int32_t		rule;
+	uint8_t		byte;
+};
+
+static inline unsigned char
+lc(unsigned char c)
+{
+	return (c >= 'A' && c <= 'Z') ? c | 0x20 : c;
+}
+
+/* grow array *p of elements to hold at least need of them */
+static int
+grow(void **p, size_t *cap, size_t need, size_t elsize)
+{
+	size_t n = *cap ? *cap : 64;
+	void *np;
+
+	if (need <= *cap)
+		return 0;
+	while (n < need)
+		n *= 2;
+	if (!(np = realloc(*p, n * elsize)))
+		return -1;
+	*p = np;
+	*cap = n;
+	return 0;
+}
+
+int
+urlfilter_init(struct urlfilter *uf)
+{
+	memset(uf, 0, sizeof(*uf));
+	if (grow((void **)&uf->nodes, &uf->nodesize, 1, sizeof(*uf->nodes)) < 0)
+		return -1;
+	memset(&uf->nodes[0], 0, sizeof(uf->nodes[0]));
+	uf->nodes[0].rule = URLFILTER_NONE;
+	uf->nnodes = 1;
+	return 0;
+}
+
+void
+urlfilter_free(struct urlfilter *uf)
+{
+	free(uf->states);
+	free(uf->edges);
+	free(uf->text);
+	free(uf->textoff);
+	free(uf->hits);
+	free(uf->nodes);
+	memset(uf, 0, sizeof(*uf));
+}
+
+static uint32_t
+node_child(struct urlfilter *uf, uint32_t n, uint8_t b, int create)
+{
+	uint32_t c;
+
+	for (c = uf->nodes[n].child; c; c = uf->nodes[c].sibling)
+		if (uf->nodes[c].byte == b)
+			return c;
+	if (!create ||
+	    grow((void **)&uf->nodes, &uf->nodesize, uf->nnodes + 1, sizeof(*uf->nodes)) < 0)
+		return 0;
+	c = uf->nnodes++;
+	uf->nodes[c].byte = b;
+	uf->nodes[c].rule = URLFILTER_NONE;
+	uf->nodes[c].child = 0;
+	uf->nodes[c].sibling = uf->nodes[n].child;
+	uf->nodes[n].child = c;
+	return c;
+}
+
+int
+urlfilter_add(struct urlfilter *uf, const char *pattern)
+{
+	size_t len = strlen(pattern), i;
+	uint32_t n = 0;
+
+	if (len == 0 || !uf->nodes || uf->nnodes + len >= AC_MAX_STATES)
+		return -1;
+	for (i = 0; i < len; i++)
+		if (!(n = node_child(uf, n, lc(pattern[i]), 1)))
+			return -1;
+	/* same pattern twice is one rule */
+	if (uf->nodes[n].rule != URLFILTER_NONE)
+		return 0;
+
+	if (grow((void **)&uf->text, &uf->textsize, uf->textlen + len + 1, 1) < 0)
+		return -1;
+	if (grow((void **)&uf->textoff, &uf->rulesize, uf->nrules + 1, sizeof(*uf->textoff)) < 0)
+		return -1;
+	memcpy(uf->text + uf->textlen, pattern, len + 1);
+	uf->textoff[uf->nrules] = uf->textlen;
+	uf->textlen += len + 1;
+	uf->nodes[n].rule = uf->nrules++;
+	return 0;
+}
+
+static inline uint32_t
+ac_next(const struct urlfilter *uf, uint32_t s, unsigned char b)
+{
+	for (;;) {
+		const struct ac_state *st;
+		const uint32_t *e, *end;
+
+		if (s == 0)
+			return uf->root[b];
+		st = &uf->states[s];
+		for (e = uf->edges + st->edges, end = e + st->nedges; e < end; e++) {
+			unsigned eb = *e & 0xff;
+			if (eb == b)
+				return *e >> 8;
+			if (eb > b)
+				break;
+		}
+		s = st->fail;
+	}
+}
+
+static void
+start_byte(struct urlfilter *uf, unsigned char b)
+{
+	/* bucket by high nibble, exact for ASCII */
+	uf->lo[b & 15] |= 1 << ((b >> 4) & 7);
+	uf->hi[b >> 4] |= 1 << ((b >> 4) & 7);
+}
+
+static size_t
+skip_scalar(const struct urlfilter *uf, const unsigned char *s, size_t i, size_t len)
+{
+	for (; i < len; i++)
+		if (uf->lo[s[i] & 15] & uf->hi[s[i] >> 4])
+			break;
+	return i;
+}
+
+#ifdef HAVE_SSSE3_PATH
+/* 16 bytes at a time: two pshufb lookups give the bucket bits for both
+ * nibbles, any common bit means a possible pattern start */
+__attribute__((target("ssse3")))
+static size_t
+skip_ssse3(const struct urlfilter *uf, const unsigned char *s, size_t i, size_t len)
+{
+	const __m128i lo = _mm_loadu_si128((const __m128i *)uf->lo);
+	const __m128i hi = _mm_loadu_si128((const __m128i *)uf->hi);
+	const __m128i nib = _mm_set1_epi8(0x0f);
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+		__m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(v, nib));
+		__m128i h = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(v, 4), nib));
+		unsigned m = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(l, h), zero)) & 0xffff;
+		if (m)
+			return i + __builtin_ctz(m);
+	}
+	return skip_scalar(uf, s, i, len);
+}
+#endif
+
+static size_t (*skip)(const struct urlfilter *, const unsigned char *, size_t, size_t) = skip_scalar;
+
+int
+urlfilter_compile(struct urlfilter *uf, int nthreads)
+{
+	uint32_t *queue, *id, head, tail, s, nedges = 0;
+	uint32_t kids[256];
+	int k, nk, j;
+	size_t row;
+
+	if (!uf->nodes || nthreads < 1)
+		return -1;
+	row = (uf->nrules * sizeof(*uf->hits) + HITS_ALIGN - 1) & ~(size_t)(HITS_ALIGN - 1);
+	if (row && posix_memalign((void **)&uf->hits, HITS_ALIGN, nthreads * row) != 0)
+		return -1;
+	if (row)
+		memset(uf->hits, 0, nthreads * row);
+	uf->hitrow = row / sizeof(*uf->hits);
+	uf->nthreads = nthreads;
+	queue = malloc(uf->nnodes * sizeof(*queue));
+	id = malloc(uf->nnodes * sizeof(*id));
+	uf->states = calloc(uf->nnodes, sizeof(*uf->states));
+	uf->edges = malloc((uf->nnodes > 1 ? uf->nnodes - 1 : 1) * sizeof(*uf->edges));
+	if (!queue || !id || !uf->states || !uf->edges) {
+		free(queue);
+		free(id);
+		return -1;
+	}
+
+	/* BFS numbering keeps the hot shallow states together */
+	queue[0] = 0;
+	id[0] = 0;
+	for (head = 0, tail = 1; head < tail; head++) {
+		uint32_t c;
+		for (c = uf->nodes[queue[head]].child; c; c = uf->nodes[c].sibling) {
+			id[c] = tail;
+			queue[tail++] = c;
+		}
+	}
+	uf->nstates = tail;
+
+	/* edges sorted by byte */
+	memset(uf->root, 0, sizeof(uf->root));
+	for (s = 0; s < uf->nstates; s++) {
+		struct ac_node *n = &uf->nodes[queue[s]];
+		uint32_t c;
+
+		for (nk = 0, c = n->child; c; c = uf->nodes[c].sibling) {
+			for (j = nk++; j > 0 && uf->nodes[kids[j - 1]].byte > uf->nodes[c].byte; j--)
+				kids[j] = kids[j - 1];
+			kids[j] = c;
+		}
+		uf->states[s].edges = nedges;
+		uf->states[s].nedges = nk;
+		uf->states[s].rule = n->rule;
+		for (k = 0; k < nk; k++) {
+			uint8_t b = uf->nodes[kids[k]].byte;
+			uf->edges[nedges++] = id[kids[k]] << 8 | b;
+			if (s == 0)
+				uf->root[b] = id[kids[k]];
+		}
+	}
+
+	/* failure and dictionary links, parents are done before children */
+	for (s = 0; s < uf->nstates; s++) {
+		struct ac_state *st = &uf->states[s];
+		for (k = 0; k < (int)st->nedges; k++) {
+			uint32_t e = uf->edges[st->edges + k];
+			struct ac_state *t = &uf->states[e >> 8];
+			uint32_t f = s ? ac_next(uf, st->fail, e & 0xff) : 0;
+
+			t->fail = f;
+			t->dict = uf->states[f].rule != URLFILTER_NONE ? f : uf->states[f].dict;
+		}
+	}
+
+	memset(uf->lo, 0, sizeof(uf->lo));
+	memset(uf->hi, 0, sizeof(uf->hi));
+	for (k = 0; k < 256; k++)
+		if (uf->root[lc(k)])
+			start_byte(uf, k);
+#ifdef HAVE_SSSE3_PATH
+	if (__builtin_cpu_supports("ssse3"))
+		skip = skip_ssse3;
+#endif
+
+	free(queue);
+	free(id);
+	free(uf->nodes);
+	uf->nodes = NULL;
+	uf->nnodes = uf->nodesize = 0;
+	return 0;
+}
+
+int
+urlfilter_match(const struct urlfilter *uf, const char *str, size_t len, int thread)
+{
+	const unsigned char *s = (const unsigned char *)str;
+	unsigned long *hits;
+	int first = URLFILTER_NONE;
+	uint32_t st = 0, d;
+	size_t i = 0;
+
+	if (!uf->nstates || !uf->nrules)
+		return URLFILTER_NONE;
+	hits = uf->hits + thread * uf->hitrow;
+
+	while (i < len) {
+		if (st == 0 && (i = skip(uf, s, i, len)) == len)
+			break;
+		st = ac_next(uf, st, lc(s[i++]));
+		d = uf->states[st].rule != URLFILTER_NONE ? st : uf->states[st].dict;
+		for (; d; d = uf->states[d].dict) {
+			int r = uf->states[d].rule;
+			/* only this thread writes its row, a plain add will do */
+			__atomic_store_n(&hits[r], hits[r] + 1, __ATOMIC_RELAXED);
+			if (first == URLFILTER_NONE)
+				first = r;
+		}
+	}
+	return first;
+}
+
+void
+urlfilter_dump(const struct urlfilter *uf, FILE *fp)
+{
+	unsigned long sum;
+	size_t i;
+	int t;
+
+	for (i = 0; i < uf->nrules; i++) {
+		for (sum = 0, t = 0; t < uf->nthreads; t++)
+			sum += __atomic_load_n(&uf->hits[t * uf->hitrow + i], __ATOMIC_RELAXED);
+		fprintf(fp, "%lu\t%s\n", sum, uf->text + uf->textoff[i]);
+	}
+}
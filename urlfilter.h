@@ -0,0 +1,75 @@
+#ifndef URLFILTER_H
+#define URLFILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define URLFILTER_NONE	(-1)
+
+/* automaton state; edges of a state are a sorted run in the shared
+ * edge array, each edge is (target << 8 | byte) */
+struct ac_state {
+	uint32_t	edges;		/* first edge */
+	uint32_t	nedges;
+	uint32_t	fail;
+	int32_t		rule;		/* pattern ending here or URLFILTER_NONE */
+	uint32_t	dict;		/* nearest fail state with a rule, 0 - none */
+};
+
+struct ac_node;
+
+/* Aho-Corasick automaton over ASCII case folded bytes: patterns are added
+ * into a plain trie, urlfilter_compile() lays the states out in BFS order
+ * and computes failure links; root transitions are a dense table and a
+ * nibble table prefilter skips input while the automaton stays at root */
+struct urlfilter {
+	/* compiled */
+	struct ac_state	*states;
+	uint32_t	*edges;
+	uint32_t	nstates;
+	uint32_t	root[256];
+	uint8_t		lo[16];		/* start byte sets by low/high nibble */
+	uint8_t		hi[16];
+
+	/* rules */
+	char		*text;		/* patterns, nul separated */
+	size_t		textlen, textsize;
+	uint32_t	*textoff;
+	size_t		nrules, rulesize;
+
+	/* a row of counters per thread, written by that thread only */
+	unsigned long	*hits;
+	size_t		hitrow;		/* counters per row, padded */
+	int		nthreads;
+
+	/* build time trie, freed on compile */
+	struct ac_node	*nodes;
+	size_t		nnodes, nodesize;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int urlfilter_init(struct urlfilter *uf);
+void urlfilter_free(struct urlfilter *uf);
+
+/* literal pattern, returns -1 if empty or out of memory */
+int urlfilter_add(struct urlfilter *uf, const char *pattern);
+/* nthreads - callers of urlfilter_match(), each counts its own hits */
+int urlfilter_compile(struct urlfilter *uf, int nthreads);
+
+/* first rule found in s or URLFILTER_NONE; hit counters of all rules
+ * found are bumped in the row of thread, 0 <= thread < nthreads; any
+ * number of threads may match at once, each with its own row */
+int urlfilter_match(const struct urlfilter *uf, const char *s, size_t len, int thread);
+
+/* "hits<TAB>pattern" per rule, summed over all threads */
+void urlfilter_dump(const struct urlfilter *uf, FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* URLFILTER_H */
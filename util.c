@@ -189,57 +189,6 @@ mk_tstamp( const struct timeval* tv, char* buf, size_t* len,
 }
 
 
-int
-wrlog(loglevel level, const char *format, ...)
-{
-	va_list ap;
-	char tstamp[ 24 ] = {'\0'};
-	size_t ts_len = sizeof(tstamp) - 1;
-	struct timeval tv_now;
-	int rc = 0, n = 0, total = 0;
-
-	if (level > L_WARNING)
-		return rc;
-
-	if (!logfp) {
-		va_start( ap, format );
-		n = vfprintf( stderr, format, ap );
-		va_end( ap );
-		fputc('\n', stderr);
-		return n;
-	}
-
-	(void)gettimeofday( &tv_now, NULL );
-	errno = 0;
-	do {
-		rc = mk_tstamp( &tv_now, tstamp, &ts_len, 0 );
-		if( 0 != rc )
-			break;
-
-		n = fprintf( logfp, "%s ", tstamp );
-		if( n <= 0 )
-			break;
-		total += n;
-
-		va_start( ap, format );
-		n = vfprintf( logfp, format, ap );
-		va_end( ap );
-
-		if( n <= 0 ) break;
-		total += n;
-
-	} while(0);
-
-	if( n <= 0 ) {
-		error_log(errno, "fprintf/vfprintf" );
-		return -1;
-	}
-	fputc('\n', logfp);
-	fflush(logfp);
-
-	return (0 != rc) ? -1 : total;
-}
-
 /* error output to custom log
  * and syslog
  */
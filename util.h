@@ -3,6 +3,8 @@
 
 #include <sys/types.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <sys/time.h>
 
 typedef enum {
 	L_EMERGENCY = 0,
@@ -24,6 +26,7 @@ extern "C" {
 int daemonize(int options);
 int make_pidfile( const char* fpath, pid_t pid );
 int wrlog( loglevel level, const char *format, ...);
+int mk_tstamp( const struct timeval* tv, char* buf, size_t* len, int32_t flags );
 void error_log( int err, const char* format, ... );
 const char * get_peerip(int fd);
 const char * format_time(int interval);
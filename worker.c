@@ -0,0 +1,367 @@
+#include <assert.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sfp.h"
+#include "sfp_opt.h"
+#include "worker.h"
+
+extern struct prog_opt sfp_opt;
+
+static struct worker *workers = NULL;
+static int nworkers = 0;
+static ev_tstamp started;
+
+/* create listening sockets for n workers, SO_REUSEPORT lets the kernel
+ * spread incoming connections among them */
+int
+workers_listen(int n, struct sockaddr_in *sin)
+{
+	int i;
+
+	assert(n > 0 && n <= MAX_WORKERS);
+	/* counters are cache line aligned */
+	if (posix_memalign((void **)&workers, CACHE_LINE, n * sizeof(*workers)) != 0)
+		workers = NULL;
+	if (!workers) {
+		error_log(errno, "Workers alloc error");
+		return -1;
+	}
+	memset(workers, 0, n * sizeof(*workers));
+
+	for (i = 0; i < n; i++) {
+		workers[i].id = i;
+		workers[i].fd = server_socket(sin, n > 1);
+		if (workers[i].fd < 0) {
+			while (--i >= 0)
+				close(workers[i].fd);
+			free(workers);
+			workers = NULL;
+			return -1;
+		}
+	}
+	nworkers = n;
+	return 0;
+}
+
+static void
+worker_stop_cb(EV_P_ ev_async *w, int revents)
+{
+	ev_break(EV_A_ EVBREAK_ALL);
+}
+
+static struct wconfig *
+wconfig_new(struct config *cfg)
+{
+	struct wconfig *wc = calloc(1, sizeof(*wc));
+
+	if (!wc)
+		return NULL;
+	wc->cfg = cfg;
+	rxcache_init(&wc->rxurl);
+	rxcache_init(&wc->rxhdr);
+	return wc;
+}
+
+static void
+wconfig_free(struct worker *w, struct wconfig *wc)
+{
+	int i;
+	struct rxcache *rx[2] = { &wc->rxurl, &wc->rxhdr };
+
+	for (i = 0; i < 2; i++) {
+		w->rxstats.states += rx[i]->stats.states;
+		w->rxstats.flushes += rx[i]->stats.flushes;
+		w->rxstats.fallbacks += rx[i]->stats.fallbacks;
+		rxcache_free(rx[i]);
+	}
+	config_unref(wc->cfg);
+	free(wc);
+}
+
+/* last connection of a replaced snapshot is gone */
+void
+wconfig_retire(struct worker *w, struct wconfig *wc)
+{
+	LIST_REMOVE(wc, link);
+	wconfig_free(w, wc);
+}
+
+static void
+worker_conf_cb(EV_P_ ev_async *a, int revents)
+{
+	struct worker *w = loop_worker(EV_A);
+	struct config *cfg = __atomic_exchange_n(&w->newconf, NULL, __ATOMIC_ACQ_REL);
+	struct wconfig *wc, *old = w->conf;
+
+	if (!cfg)
+		return;
+	if (!(wc = wconfig_new(cfg))) {
+		wrlog(L_CRITICAL, "Worker %d config alloc error, keeping the old one", w->id);
+		config_unref(cfg);
+		return;
+	}
+	w->conf = wc;
+	if (old->users)
+		LIST_INSERT_HEAD(&w->oldconf, old, link);
+	else
+		wconfig_free(w, old);
+}
+
+static void
+wheel_tick(EV_P_ ev_timer *t, int revents)
+{
+	tw_advance(&loop_worker(EV_A)->wheel, ev_now(EV_A));
+}
+
+static void *
+worker_run(void *arg)
+{
+	struct worker *w = arg;
+	char name[16];
+
+	snprintf(name, sizeof(name), "sfp-w%d", w->id);
+	pthread_setname_np(pthread_self(), name);
+
+	ev_run(w->loop, 0);
+
+	while (!LIST_EMPTY(&w->conns))
+		connect_close(w->loop, LIST_FIRST(&w->conns));
+
+	relay_pipes_flush(w);
+	if (sfp_opt.ringsize)
+		wrlog(L_NOTICE, "Worker %d mirrored rings: %lu mapped%s", w->id,
+			w->ringmaps, w->ringfail ? ", mapping failed" : "");
+	relay_rings_flush(w);
+	wrlog(L_NOTICE, "Worker %d: %llu accepted, %llu denied by ACL", w->id,
+		(unsigned long long)w->stats.accepts, (unsigned long long)w->stats.denied);
+	wrlog(L_NOTICE, "Worker %d connection pool: %llu slabs, high-water %llu, "
+		"%llu misses", w->id, (unsigned long long)w->stats.pool_slabs,
+		(unsigned long long)w->stats.pool_hiwat,
+		(unsigned long long)w->stats.pool_misses);
+	connpool_destroy(&w->pool);
+	bufcache_flush(&w->bufs);
+	wrlog(L_NOTICE, "Worker %d DNS: %lu lookups, %lu hits, %lu negative hits, "
+		"%lu coalesced, %lu queries, %lu timeouts", w->id,
+		w->resolver.stats.lookups, w->resolver.stats.hits,
+		w->resolver.stats.neghits, w->resolver.stats.coalesced,
+		w->resolver.stats.queries, w->resolver.stats.timeouts);
+	resolver_destroy(w->loop, &w->resolver);
+	wrlog(L_NOTICE, "Worker %d upstream: %lu parked, %lu reused, %lu misses, "
+		"%lu dead, %lu expired, %lu dropped", w->id,
+		w->upstreams.stats.parked, w->upstreams.stats.reused,
+		w->upstreams.stats.misses, w->upstreams.stats.dead,
+		w->upstreams.stats.expired, w->upstreams.stats.dropped);
+	upstream_destroy(w->loop, &w->upstreams);
+	if (w->cache.budget)
+		wrlog(L_NOTICE, "Worker %d cache: %llu hits, %llu misses, %lu stores, "
+			"%lu evictions, %lu expired, %lu replaced, %lu skipped, %zu objects, "
+			"%zu bytes", w->id, (unsigned long long)w->stats.cache_hits,
+			(unsigned long long)w->stats.cache_misses, w->cache.stats.stores,
+			w->cache.stats.evictions, w->cache.stats.expired,
+			w->cache.stats.replaced, w->cache.stats.skipped, w->cache.nobjs,
+			w->cache.used);
+	if (w->cache.disk)
+		wrlog(L_NOTICE, "Worker %d disk cache: %lu hits, %lu stores, %lu evictions, "
+			"%lu rescued, %lu skipped, %zu objects, %lu writes, %lu copies, "
+			"%lu bytes, %lu errors, %lu slabs recycled, %lu refused", w->id,
+			w->cache.stats.disk_hits, w->cache.stats.disk_stores,
+			w->cache.stats.disk_evictions, w->cache.stats.rescued,
+			w->cache.stats.disk_skipped, w->cache.ndisk,
+			w->cache.disk->stats.writes, w->cache.disk->stats.copies,
+			w->cache.disk->stats.bytes, w->cache.disk->stats.errors,
+			w->cache.disk->stats.recycled, w->cache.disk->stats.refused);
+	cache_destroy(&w->cache);
+	/* no connections left, so no replaced snapshots either */
+	wconfig_free(w, w->conf);
+	w->conf = NULL;
+	config_unref(__atomic_exchange_n(&w->newconf, NULL, __ATOMIC_ACQ_REL));
+	wrlog(L_NOTICE, "Worker %d regex DFA: %lu states, %lu flushes, %lu fallbacks",
+		w->id, w->rxstats.states, w->rxstats.flushes, w->rxstats.fallbacks);
+	if (w->access.dir)
+		wrlog(L_NOTICE, "Worker %d access log: %lu records, %lu segments, %lu lost",
+			w->id, w->access.records, w->access.segments, w->access.errors);
+	access_close(&w->access);
+	ev_timer_stop(w->loop, &w->tick);
+	ev_io_stop(w->loop, &w->acceptio);
+	ev_async_stop(w->loop, &w->stopw);
+	ev_async_stop(w->loop, &w->confw);
+	close(w->fd);
+	ev_loop_destroy(w->loop);
+	w->loop = NULL;
+	return NULL;
+}
+
+int
+workers_start(struct config *cfg)
+{
+	int i;
+	sigset_t all, old;
+
+	started = ev_time();
+	/* signals are handled by the default loop in the main thread only */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+
+	for (i = 0; i < nworkers; i++) {
+		struct worker *w = &workers[i];
+
+		/* a backend asked for explicitly has no fallback, the kernel
+		 * may lack it or forbid it */
+		w->loop = ev_loop_new(sfp_opt.backend ? sfp_opt.backend : ev_recommended_backends());
+		if (!w->loop) {
+			wrlog(L_CRITICAL, "Worker %d loop create error%s%s", i,
+				sfp_opt.backend ? ", no backend " : "",
+				sfp_opt.backend ? backend_name(sfp_opt.backend) : "");
+			break;
+		}
+		if (i == 0)
+			wrlog(L_NOTICE, "Workers run on %s", backend_name(ev_backend(w->loop)));
+		ev_set_userdata(w->loop, w);
+		LIST_INIT(&w->conns);
+		LIST_INIT(&w->oldconf);
+		bufcache_init(&w->bufs);
+		if (connpool_init(&w->pool, CONNPOOL_PREALLOC, &w->stats) < 0) {
+			wrlog(L_CRITICAL, "Worker %d connection pool alloc error", i);
+			ev_loop_destroy(w->loop);
+			w->loop = NULL;
+			break;
+		}
+		if (resolver_init(w->loop, &w->resolver, sfp_opt.nameserver) < 0) {
+			wrlog(L_CRITICAL, "Worker %d resolver init error", i);
+			connpool_destroy(&w->pool);
+			ev_loop_destroy(w->loop);
+			w->loop = NULL;
+			break;
+		}
+		if (access_open(&w->access, sfp_opt.accessdir, i, sfp_opt.access_segment) < 0) {
+			wrlog(L_CRITICAL, "Worker %d access log open error", i);
+			resolver_destroy(w->loop, &w->resolver);
+			connpool_destroy(&w->pool);
+			ev_loop_destroy(w->loop);
+			w->loop = NULL;
+			break;
+		}
+		if (upstream_init(w->loop, &w->upstreams, sfp_opt.upstream_idle,
+				sfp_opt.upstream_timeout) < 0) {
+			wrlog(L_CRITICAL, "Worker %d upstream pool alloc error", i);
+			access_close(&w->access);
+			resolver_destroy(w->loop, &w->resolver);
+			connpool_destroy(&w->pool);
+			ev_loop_destroy(w->loop);
+			w->loop = NULL;
+			break;
+		}
+		if (cache_init(&w->cache, sfp_opt.cachemem / nworkers) < 0 ||
+		    (cfg && cache_disk_init(w->loop, &w->cache, &cfg->disk, i, nworkers) < 0)) {
+			wrlog(L_CRITICAL, "Worker %d cache init error", i);
+			cache_destroy(&w->cache);
+			upstream_destroy(w->loop, &w->upstreams);
+			access_close(&w->access);
+			resolver_destroy(w->loop, &w->resolver);
+			connpool_destroy(&w->pool);
+			ev_loop_destroy(w->loop);
+			w->loop = NULL;
+			break;
+		}
+		if (!(w->conf = wconfig_new(config_ref(cfg)))) {
+			wrlog(L_CRITICAL, "Worker %d config alloc error", i);
+			config_unref(cfg);
+			cache_destroy(&w->cache);
+			upstream_destroy(w->loop, &w->upstreams);
+			access_close(&w->access);
+			resolver_destroy(w->loop, &w->resolver);
+			connpool_destroy(&w->pool);
+			ev_loop_destroy(w->loop);
+			w->loop = NULL;
+			break;
+		}
+
+		/* one coarse timer turns the wheel of all connection timeouts */
+		tw_init(&w->wheel, ev_now(w->loop), w->loop);
+		ev_timer_init(&w->tick, wheel_tick, TW_TICK, TW_TICK);
+		ev_timer_start(w->loop, &w->tick);
+
+		ev_io_init(&w->acceptio, server_accept, w->fd, EV_READ);
+		ev_io_start(w->loop, &w->acceptio);
+		ev_async_init(&w->stopw, worker_stop_cb);
+		ev_async_start(w->loop, &w->stopw);
+		ev_async_init(&w->confw, worker_conf_cb);
+		ev_async_start(w->loop, &w->confw);
+
+		if (0 != pthread_create(&w->tid, NULL, worker_run, w)) {
+			wrlog(L_CRITICAL, "Worker %d thread create error", i);
+			wconfig_free(w, w->conf);
+			cache_destroy(&w->cache);
+			upstream_destroy(w->loop, &w->upstreams);
+			access_close(&w->access);
+			resolver_destroy(w->loop, &w->resolver);
+			connpool_destroy(&w->pool);
+			ev_loop_destroy(w->loop);
+			w->loop = NULL;
+			break;
+		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (i < nworkers) {
+		nworkers = i;
+		return -1;
+	}
+	return 0;
+}
+
+double
+workers_stats(struct stats *sum)
+{
+	int i;
+
+	memset(sum, 0, sizeof(*sum));
+	for (i = 0; i < nworkers; i++)
+		stats_merge(sum, &workers[i].stats);
+	return ev_time() - started;
+}
+
+/* number of workers, fixed once they run */
+int
+workers_count(void)
+{
+	return nworkers;
+}
+
+void
+workers_config(struct config *cfg)
+{
+	struct config *old;
+	int i;
+
+	for (i = 0; i < nworkers; i++) {
+		if (!workers[i].loop)
+			continue;
+		/* a config the worker has not picked up yet is just replaced */
+		old = __atomic_exchange_n(&workers[i].newconf, config_ref(cfg), __ATOMIC_ACQ_REL);
+		config_unref(old);
+		ev_async_send(workers[i].loop, &workers[i].confw);
+	}
+}
+
+void
+workers_stop(void)
+{
+	int i;
+	for (i = 0; i < nworkers; i++)
+		if (workers[i].loop)
+			ev_async_send(workers[i].loop, &workers[i].stopw);
+}
+
+void
+workers_wait(void)
+{
+	int i;
+	for (i = 0; i < nworkers; i++)
+		pthread_join(workers[i].tid, NULL);
+	free(workers);
+	workers = NULL;
+	nworkers = 0;
+}
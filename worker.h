@@ -0,0 +1,109 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <pthread.h>
+
+#include "sfp.h"
+#include "relay.h"
+#include "connpool.h"
+#include "bufpool.h"
+#include "upstream.h"
+#include "rxfilter.h"
+#include "stats.h"
+#include "access.h"
+#include "timewheel.h"
+#include "config.h"
+#include "cache.h"
+
+/* max number of worker threads */
+#define MAX_WORKERS 256
+
+/* config snapshot as a worker sees it: one reference on the config for
+ * all connections of the worker started with it, and the lazy DFA of its
+ * regex rules */
+struct wconfig {
+	struct config	*cfg;		/* NULL - no config file */
+	unsigned long	users;		/* connections */
+	struct rxcache	rxurl;
+	struct rxcache	rxhdr;
+	LIST_ENTRY(wconfig) link;
+};
+
+/* every worker owns its loop, its listening socket and all connections
+ * accepted on it; nothing here is touched by other threads except
+ * through the async watcher */
+struct worker {
+	int		id;
+	pthread_t	tid;
+	struct ev_loop	*loop;
+	int		fd;
+	ev_io		acceptio;
+	ev_async	stopw;
+	LIST_HEAD(, connect) conns;
+	size_t		nconns;
+	struct connpool	pool;
+	struct bufcache	bufs;
+	struct resolver	resolver;
+	struct upstream_pool upstreams;
+	struct wconfig	*conf;		/* new connections take this one */
+	LIST_HEAD(, wconfig) oldconf;	/* replaced, still in use */
+	struct config	*newconf;	/* handed over by the main thread */
+	ev_async	confw;
+	struct rxstats	rxstats;	/* of the snapshots gone */
+	struct access_log access;
+	struct timewheel wheel;		/* connection timeouts */
+	ev_timer	tick;
+	struct stats	stats;
+	int		pipes[PIPE_CACHE_SIZE][2];
+	int		npipes;
+	char		*rings[RING_CACHE_SIZE];	/* mirrored, sfp_opt.ringsize */
+	int		nrings;
+	unsigned long	ringmaps;
+	int		ringfail;	/* map failed, no more tries */
+	struct cache	cache;		/* responses, sfp_opt.cachemem / workers */
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int workers_listen(int n, struct sockaddr_in *sin);
+int workers_start(struct config *cfg);
+void workers_stop(void);
+void workers_wait(void);
+
+/* sum of all worker counters, returns seconds since start */
+double workers_stats(struct stats *sum);
+int workers_count(void);
+
+/* publish a new config, every worker takes its own reference and
+ * switches to it between events */
+void workers_config(struct config *cfg);
+void wconfig_retire(struct worker *w, struct wconfig *wc);
+
+/* worker which owns the loop */
+static inline struct worker *
+loop_worker(struct ev_loop *loop)
+{
+	return (struct worker *)ev_userdata(loop);
+}
+
+static inline struct wconfig *
+wconfig_get(struct worker *w)
+{
+	w->conf->users++;
+	return w->conf;
+}
+
+static inline void
+wconfig_put(struct worker *w, struct wconfig *wc)
+{
+	if (--wc->users == 0 && wc != w->conf)
+		wconfig_retire(w, wc);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WORKER_H */